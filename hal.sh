@@ -6,7 +6,7 @@ if [ "$1" == "-help"];then
 	echo "./hal.sh [B32/B64]"
 	exit
 else
-	export HAL_MODULE=gps.defaullt
+	export HAL_MODULE=gps.default
 fi
 
 CURRENT_PATH=$(pwd)
@@ -0,0 +1,238 @@
+/*
+ * FixColumns kernel check and benchmark.
+ *
+ * Runs the vector track length and SNR histogram of wl_gps/wl_fix_columns.c
+ * against their scalar references (wl_fix_columns_track_length_scalar and
+ * wl_fix_columns_snr_histogram_scalar, libm one pair or value at a time),
+ * first on edge cases (antimeridian crossings, the poles, jumps long enough
+ * for the libm fallback, NaN, infinities, negative and out of range SNRs,
+ * every length up to a few vectors), then on a random-walk track and random
+ * SNRs, and reports the cost per point of both and the speedup.
+ *
+ * Track lengths may only differ by the summation order, -e relative;
+ * histograms must be equal. The run fails on any disagreement.
+ *
+ * Host build:
+ *   gcc -O2 -Iwl_gps -I$AOSP/hardware/libhardware/include \
+ *       -I$AOSP/system/core/include tools/wl_fix_columns_bench.c \
+ *       wl_gps/wl_fix_columns.c -lm -o wl_fix_columns_bench
+ *
+ * Usage: wl_fix_columns_bench [-f fixes] [-s satellites] [-n rounds] [-e rel_error]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wl_fix_columns.h"
+
+#define BENCH_METERS_PER_DEG (111195.08)
+#define BENCH_DEG_TO_RAD     (3.14159265358979323846 / 180.0)
+#define BENCH_CENTER_LAT     (31.2)
+#define BENCH_CENTER_LON     (121.5)
+/*a fix a second at motorway speed*/
+#define BENCH_STEP_M         (30.0)
+/*longest edge case track, a few vector steps and a tail*/
+#define BENCH_MAX_SHORT      (9)
+
+static double bench_rand(void)
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*1 when the vector and the scalar length of the track disagree*/
+static int bench_check_track(const char *name, const double *latitude, const double *longitude,
+            int count, double rel_error)
+{
+    double fast = wl_fix_columns_track_length(latitude, longitude, count);
+    double ref = wl_fix_columns_track_length_scalar(latitude, longitude, count);
+
+    if (fabs(fast - ref) <= rel_error * ref)
+        return 0;
+    fprintf(stderr, "MISMATCH track %s, %d fixes: %.9f m, scalar %.9f m\n", name, count, fast, ref);
+    return 1;
+}
+
+/*1 when the vector and the scalar histogram of the values disagree*/
+static int bench_check_snr(const char *name, const float *snr, int count)
+{
+    uint32_t fast[WL_SNR_HISTOGRAM_BINS];
+    uint32_t ref[WL_SNR_HISTOGRAM_BINS];
+    int bin;
+
+    memset(fast, 0, sizeof(fast));
+    memset(ref, 0, sizeof(ref));
+    wl_fix_columns_snr_histogram(snr, count, fast);
+    wl_fix_columns_snr_histogram_scalar(snr, count, ref);
+    for (bin = 0; bin < WL_SNR_HISTOGRAM_BINS; bin++)
+    {
+        if (fast[bin] != ref[bin])
+        {
+            fprintf(stderr, "MISMATCH snr %s, %d values: bin %d has %u, scalar %u\n", name, count,
+                bin, fast[bin], ref[bin]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int bench_edge_cases(double rel_error)
+{
+    static const double antimeridian_lat[] = { 10.0, 10.001, 10.002, 10.003, 10.004 };
+    static const double antimeridian_lon[] = { 179.998, 179.999, -180.0, -179.999, -179.998 };
+    static const double pole_lat[] = { 89.999, 90.0, 89.999, 90.0, -90.0, -89.999 };
+    static const double pole_lon[] = { 0.0, 45.0, 180.0, -90.0, 0.0, 120.0 };
+    /*Shanghai, Beijing, Sydney, Sao Paulo, back to Shanghai*/
+    static const double jump_lat[] = { 31.2, 39.9, -33.9, -23.5, 31.2 };
+    static const double jump_lon[] = { 121.5, 116.4, 151.2, -46.6, 121.5 };
+    static const double still_lat[] = { 31.2, 31.2, 31.2, 31.2, 31.2 };
+    static const double still_lon[] = { 121.5, 121.5, 121.5, 121.5, 121.5 };
+    static const float snr[] =
+    {
+        -5.0f, -0.0f, 0.0f, 0.5f, 1.0f, 12.99f, 13.0f, 62.0f, 62.999f, 63.0f, 63.5f, 99.0f,
+        NAN, INFINITY, -INFINITY, 1e30f, -1e30f, 45.25f, 7.0f, 8.0f, 9.0f
+    };
+    double latitude[BENCH_MAX_SHORT], longitude[BENCH_MAX_SHORT];
+    int failed = 0;
+    int count, i;
+
+    failed += bench_check_track("antimeridian", antimeridian_lat, antimeridian_lon, 5, rel_error);
+    failed += bench_check_track("poles", pole_lat, pole_lon, 6, rel_error);
+    failed += bench_check_track("jumps", jump_lat, jump_lon, 5, rel_error);
+    failed += bench_check_track("still", still_lat, still_lon, 5, rel_error);
+
+    /*every split between the vector loop and the scalar tail*/
+    for (count = 0; count <= BENCH_MAX_SHORT; count++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            latitude[i] = BENCH_CENTER_LAT + i * 0.001;
+            longitude[i] = BENCH_CENTER_LON - i * 0.002;
+        }
+        failed += bench_check_track("short", latitude, longitude, count, rel_error);
+    }
+    for (count = 0; count <= (int)(sizeof(snr) / sizeof(snr[0])); count++)
+        failed += bench_check_snr("edge", snr, count);
+    return failed;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-f fixes] [-s satellites] [-n rounds] [-e rel_error]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    double *latitude, *longitude;
+    float *snr;
+    uint32_t hist[WL_SNR_HISTOGRAM_BINS];
+    int fix_count = 1000000;
+    int sv_count = 4000000;
+    int rounds = 20;
+    double rel_error = 1e-9;
+    double heading = 0;
+    double start, fast_ns, ref_ns;
+    volatile double sink = 0;
+    int failed;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "f:s:n:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'f':
+            fix_count = atoi(optarg);
+            break;
+        case 's':
+            sv_count = atoi(optarg);
+            break;
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 'e':
+            rel_error = atof(optarg);
+            break;
+        default:
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((fix_count < 2) || (sv_count < 1) || (rounds < 1) || !(rel_error >= 0))
+    {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    failed = bench_edge_cases(rel_error);
+
+    srand(1);
+    latitude = malloc(fix_count * sizeof(double));
+    longitude = malloc(fix_count * sizeof(double));
+    snr = malloc(sv_count * sizeof(float));
+    if ((latitude == NULL) || (longitude == NULL) || (snr == NULL))
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    latitude[0] = BENCH_CENTER_LAT;
+    longitude[0] = BENCH_CENTER_LON;
+    for (i = 1; i < fix_count; i++)
+    {
+        heading += (bench_rand() - 0.5) * 0.5;
+        latitude[i] = latitude[i - 1] + BENCH_STEP_M * cos(heading) / BENCH_METERS_PER_DEG;
+        longitude[i] = longitude[i - 1] + BENCH_STEP_M * sin(heading)
+            / (BENCH_METERS_PER_DEG * cos(latitude[i - 1] * BENCH_DEG_TO_RAD));
+    }
+    /*mostly what receivers report, a few below and above the histogram*/
+    for (i = 0; i < sv_count; i++)
+        snr[i] = (float)(bench_rand() * 70.0 - 3.0);
+
+    failed += bench_check_track("random walk", latitude, longitude, fix_count, rel_error);
+    failed += bench_check_snr("random", snr, sv_count);
+
+    start = bench_now_ns();
+    for (i = 0; i < rounds; i++)
+        sink += wl_fix_columns_track_length(latitude, longitude, fix_count);
+    fast_ns = (bench_now_ns() - start) / rounds / fix_count;
+    start = bench_now_ns();
+    for (i = 0; i < rounds; i++)
+        sink += wl_fix_columns_track_length_scalar(latitude, longitude, fix_count);
+    ref_ns = (bench_now_ns() - start) / rounds / fix_count;
+    printf("track length: %d fixes, %.0f m, %.2f ns/fix, scalar %.2f ns/fix, speedup %.2fx\n",
+        fix_count, wl_fix_columns_track_length(latitude, longitude, fix_count), fast_ns, ref_ns,
+        ref_ns / fast_ns);
+
+    memset(hist, 0, sizeof(hist));
+    start = bench_now_ns();
+    for (i = 0; i < rounds; i++)
+        wl_fix_columns_snr_histogram(snr, sv_count, hist);
+    fast_ns = (bench_now_ns() - start) / rounds / sv_count;
+    start = bench_now_ns();
+    for (i = 0; i < rounds; i++)
+        wl_fix_columns_snr_histogram_scalar(snr, sv_count, hist);
+    ref_ns = (bench_now_ns() - start) / rounds / sv_count;
+    sink += hist[0];
+    printf("snr histogram: %d values, %.2f ns/value, scalar %.2f ns/value, speedup %.2fx\n",
+        sv_count, fast_ns, ref_ns, ref_ns / fast_ns);
+
+    free(snr);
+    free(longitude);
+    free(latitude);
+
+    if (failed)
+    {
+        fprintf(stderr, "%d checks failed\n", failed);
+        return 1;
+    }
+    return 0;
+}
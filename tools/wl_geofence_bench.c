@@ -0,0 +1,238 @@
+/*
+ * Geofence engine benchmark.
+ *
+ * Registers a set of random circular fences around a city-sized area, drives
+ * a random-walk track through it and reports the cost per fix of
+ * wl_geofence_check_fix (wl_gps/wl_geofence.c). The same track is then run
+ * through a brute-force check of every fence, and both must produce the same
+ * enter/exit counts.
+ *
+ * Host build:
+ *   gcc -O2 -Iwl_gps -I$AOSP/hardware/libhardware/include \
+ *       -I$AOSP/system/core/include tools/wl_geofence_bench.c \
+ *       wl_gps/wl_geofence.c -lm -o wl_geofence_bench
+ *
+ * Usage: wl_geofence_bench [-n fences] [-f fixes] [-a area_deg] [-r max_radius_m]
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wl_geofence.h"
+
+#define BENCH_METERS_PER_DEG (111195.08)
+#define BENCH_DEG_TO_RAD     (3.14159265358979323846 / 180.0)
+#define BENCH_CENTER_LAT     (31.2)
+#define BENCH_CENTER_LON     (121.5)
+/*a fix a second at motorway speed*/
+#define BENCH_STEP_M         (30.0)
+
+typedef struct
+{
+    double m_latitude;
+    double m_longitude;
+    double m_radius;
+} BenchFence;
+
+typedef struct
+{
+    unsigned long m_entered;
+    unsigned long m_exited;
+} BenchCounts;
+
+static double bench_rand(void)
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_on_transition(void *user, int32_t geofence_id, GpsLocation *location,
+            int32_t transition)
+{
+    BenchCounts *counts = (BenchCounts *)user;
+
+    if (transition == GPS_GEOFENCE_ENTERED)
+        counts->m_entered++;
+    else if (transition == GPS_GEOFENCE_EXITED)
+        counts->m_exited++;
+}
+
+/*random walk that bounces off the edges of the area*/
+static GpsLocation *bench_make_track(int fix_count, double area_deg)
+{
+    GpsLocation *track = calloc(fix_count, sizeof(GpsLocation));
+    double lat = BENCH_CENTER_LAT;
+    double lon = BENCH_CENTER_LON;
+    double heading = 0;
+    int i;
+
+    if (track == NULL)
+        return NULL;
+
+    for (i = 0; i < fix_count; i++)
+    {
+        heading += (bench_rand() - 0.5) * 0.6;
+        lat += cos(heading) * BENCH_STEP_M / BENCH_METERS_PER_DEG;
+        lon += sin(heading) * BENCH_STEP_M / (BENCH_METERS_PER_DEG * cos(lat * BENCH_DEG_TO_RAD));
+        if (fabs(lat - BENCH_CENTER_LAT) > area_deg / 2 || fabs(lon - BENCH_CENTER_LON) > area_deg / 2)
+            heading += 3.14159265358979323846;
+
+        track[i].size = sizeof(GpsLocation);
+        track[i].latitude = lat;
+        track[i].longitude = lon;
+        track[i].timestamp = (GpsUtcTime)i * 1000;
+    }
+    return track;
+}
+
+static void bench_brute_force(const BenchFence *fences, int fence_count, GpsLocation *track,
+            int fix_count, BenchCounts *counts)
+{
+    unsigned char *inside = calloc(fence_count, 1);
+    int i, j;
+
+    if (inside == NULL)
+        return;
+
+    for (i = 0; i < fix_count; i++)
+    {
+        for (j = 0; j < fence_count; j++)
+        {
+            double dx = (track[i].longitude - fences[j].m_longitude) * BENCH_METERS_PER_DEG *
+                        cos(fences[j].m_latitude * BENCH_DEG_TO_RAD);
+            double dy = (track[i].latitude - fences[j].m_latitude) * BENCH_METERS_PER_DEG;
+            unsigned char now = (dx * dx + dy * dy <= fences[j].m_radius * fences[j].m_radius);
+
+            if (now && !inside[j])
+                counts->m_entered++;
+            else if (!now && inside[j])
+                counts->m_exited++;
+            inside[j] = now;
+        }
+    }
+    free(inside);
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n fences] [-f fixes] [-a area_deg] [-r max_radius_m]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    WlGeofenceEngine engine;
+    BenchFence *fences;
+    GpsLocation *track;
+    BenchCounts indexed, brute;
+    int fence_count = 10000;
+    int fix_count = 1000000;
+    double area_deg = 0.5;
+    double max_radius = 500.0;
+    double start, elapsed;
+    unsigned long tested = 0;
+    int brute_fixes;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:f:a:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            fence_count = atoi(optarg);
+            break;
+        case 'f':
+            fix_count = atoi(optarg);
+            break;
+        case 'a':
+            area_deg = atof(optarg);
+            break;
+        case 'r':
+            max_radius = atof(optarg);
+            break;
+        default:
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((fence_count <= 0) || (fix_count <= 0) || !(area_deg > 0) || !(max_radius >= 50.0))
+    {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    srand(1);
+    fences = calloc(fence_count, sizeof(BenchFence));
+    track = bench_make_track(fix_count, area_deg);
+    if ((fences == NULL) || (track == NULL))
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    wl_geofence_engine_init(&engine);
+    for (i = 0; i < fence_count; i++)
+    {
+        fences[i].m_latitude = BENCH_CENTER_LAT + (bench_rand() - 0.5) * area_deg;
+        fences[i].m_longitude = BENCH_CENTER_LON + (bench_rand() - 0.5) * area_deg;
+        fences[i].m_radius = 50.0 + bench_rand() * (max_radius - 50.0);
+        if (wl_geofence_add(&engine, i, fences[i].m_latitude, fences[i].m_longitude, fences[i].m_radius,
+            GPS_GEOFENCE_EXITED, GPS_GEOFENCE_ENTERED | GPS_GEOFENCE_EXITED) != GPS_GEOFENCE_OPERATION_SUCCESS)
+        {
+            fprintf(stderr, "cannot add fence %d\n", i);
+            return 1;
+        }
+    }
+
+    memset(&indexed, 0, sizeof(indexed));
+    start = bench_now_ns();
+    for (i = 0; i < fix_count; i++)
+    {
+        wl_geofence_check_fix(&engine, &track[i], bench_on_transition, &indexed);
+        tested += engine.m_last_tested;
+    }
+    elapsed = bench_now_ns() - start;
+
+    printf("fences %d, fixes %d, cells %d, large %d\n", fence_count, fix_count,
+        engine.m_cell_count, engine.m_large_count);
+    printf("indexed: %.1f ns/fix, %.1f fences tested/fix, %lu entered, %lu exited\n",
+        elapsed / fix_count, (double)tested / fix_count, indexed.m_entered, indexed.m_exited);
+
+    /*the brute force is slow, check it on a prefix of the track*/
+    brute_fixes = (fix_count < 20000) ? fix_count : 20000;
+    wl_geofence_engine_free(&engine);
+    wl_geofence_engine_init(&engine);
+    for (i = 0; i < fence_count; i++)
+        wl_geofence_add(&engine, i, fences[i].m_latitude, fences[i].m_longitude, fences[i].m_radius,
+            GPS_GEOFENCE_EXITED, GPS_GEOFENCE_ENTERED | GPS_GEOFENCE_EXITED);
+    memset(&indexed, 0, sizeof(indexed));
+    for (i = 0; i < brute_fixes; i++)
+        wl_geofence_check_fix(&engine, &track[i], bench_on_transition, &indexed);
+
+    memset(&brute, 0, sizeof(brute));
+    start = bench_now_ns();
+    bench_brute_force(fences, fence_count, track, brute_fixes, &brute);
+    elapsed = bench_now_ns() - start;
+    printf("brute force: %.1f ns/fix over %d fixes, %lu entered, %lu exited\n",
+        elapsed / brute_fixes, brute_fixes, brute.m_entered, brute.m_exited);
+
+    wl_geofence_engine_free(&engine);
+    free(track);
+    free(fences);
+
+    if ((brute.m_entered != indexed.m_entered) || (brute.m_exited != indexed.m_exited))
+    {
+        fprintf(stderr, "MISMATCH: indexed %lu/%lu over the same fixes\n", indexed.m_entered, indexed.m_exited);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,402 @@
+/*
+ * Idle wakeup check.
+ *
+ * Links the HAL in and plays the receiver behind a pty, runs init, start,
+ * a few fixes and stop through the GpsInterface, and then leaves the HAL
+ * idle. Between sessions the reader, buffer and delivery threads have
+ * nothing to do, so none of them may wake up: the check reads their wakeup
+ * counters through WL_GPS_WAKEUPS_INTERFACE once the stop settled and again
+ * after the idle period, and fails when any of them moved.
+ *
+ * The receiver answers every AT command with "OK" and sends an epoch with a
+ * fix (GGA, GSA, RMC) every 1/rate seconds from the "OK" of AT+ZGRUN=2 to
+ * AT+ZGRUN=0, and nothing at all outside of that.
+ *
+ * The HAL reads its config from NMEA_PORT_PATH_CONFIG, which the check
+ * writes; both must be built with the same path:
+ *   gcc -O2 -pthread -DNMEA_PORT_PATH_CONFIG='"/tmp/wl_gps_idle_check.conf"' \
+ *       -Iwl_gps -I$AOSP/hardware/libhardware/include \
+ *       -I$AOSP/system/core/include tools/wl_gps_idle_check.c \
+ *       wl_gps/wl_gps.c wl_gps/wl_nmea.c wl_gps/wl_geofence.c wl_gps/wl_uring.c \
+ *       wl_gps/wl_trace.c wl_gps/wl_history.c -lm \
+ *       -o wl_gps_idle_check
+ *
+ * Usage: wl_gps_idle_check [-t idle_s] [-f fixes] [-r hz] [-S settle_ms] [-c KEY=VALUE]...
+ *   -t how long the HAL is left idle after the stop, 60 seconds by default
+ *   -f how many fixes the session delivers before it is stopped
+ *   -c adds a line to the HAL config, READ_MODE=THROUGHPUT for instance
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/gps.h>
+
+#include "wl_wakeups.h"
+
+#ifndef NMEA_PORT_PATH_CONFIG
+#define NMEA_PORT_PATH_CONFIG "/tmp/wl_gps_idle_check.conf"
+#endif
+/*start keeps failing until the reader thread has the port open*/
+#define IDLE_START_TIMEOUT_MS (5000)
+#define IDLE_START_RETRY_US (1000)
+#define IDLE_FIX_TIMEOUT_MS (5000)
+#define IDLE_MAX_CONFIG (16)
+
+typedef struct
+{
+    int m_master;
+    int m_rate_hz;
+    volatile int m_done;
+
+    /*written by the receiver thread*/
+    volatile int m_running;
+    unsigned long m_at_commands;
+    unsigned long m_overruns;
+
+    /*written by the HAL's delivery thread*/
+    volatile unsigned long m_fixes;
+} IdleState;
+
+static IdleState g_idle;
+
+static double idle_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void idle_location_cb(GpsLocation *location)
+{
+    g_idle.m_fixes++;
+}
+
+static void idle_status_cb(GpsStatus *status)
+{
+}
+
+typedef struct
+{
+    void (*m_start)(void *);
+    void *m_arg;
+} IdleThread;
+
+static void *idle_thread_main(void *param)
+{
+    IdleThread thread = *(IdleThread *)param;
+
+    free(param);
+    thread.m_start(thread.m_arg);
+    return NULL;
+}
+
+static pthread_t idle_create_thread(const char *name, void (*start)(void *), void *arg)
+{
+    IdleThread *thread = malloc(sizeof(IdleThread));
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    if (NULL == thread)
+        return 0;
+    thread->m_start = start;
+    thread->m_arg = arg;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, idle_thread_main, thread))
+    {
+        free(thread);
+        tid = 0;
+    }
+    pthread_attr_destroy(&attr);
+    return tid;
+}
+
+static GpsCallbacks g_idle_callbacks =
+{
+    .size = sizeof(GpsCallbacks),
+    .location_cb = idle_location_cb,
+    .status_cb = idle_status_cb,
+    .create_thread_cb = idle_create_thread,
+};
+
+/*appends "$body*XX\r\n"*/
+static int idle_sentence(char *out, int size, const char *body)
+{
+    unsigned char sum = 0;
+    const char *p;
+
+    for (p = body; *p; p++)
+        sum ^= (unsigned char)*p;
+    return snprintf(out, size, "$%s*%02X\r\n", body, sum);
+}
+
+static int idle_epoch(char *out, int size, int epoch, int rate_hz)
+{
+    char body[160];
+    int ms = epoch * 1000 / rate_hz;
+    int sec = ms / 1000;
+    char utc[16];
+    int len = 0;
+
+    snprintf(utc, sizeof(utc), "%02d%02d%02d.%02d", (sec / 3600) % 24, (sec / 60) % 60, sec % 60,
+        (ms % 1000) / 10);
+    snprintf(body, sizeof(body), "GPGGA,%s,3107.4260,N,12121.6530,E,1,08,0.9,12.0,M,8.0,M,,", utc);
+    len += idle_sentence(out + len, size - len, body);
+    len += idle_sentence(out + len, size - len, "GPGSA,A,3,01,03,06,09,14,17,19,22,,,,,1.6,0.9,1.3");
+    snprintf(body, sizeof(body), "GPRMC,%s,A,3107.4260,N,12121.6530,E,0.0,0.0,191026,,,A", utc);
+    len += idle_sentence(out + len, size - len, body);
+    return len;
+}
+
+/*answers every complete AT line at once, AT+ZGRUN switches the epochs on and off*/
+static void idle_read_at(IdleState *idle, char *line, int *line_len, double *t0, int *epoch)
+{
+    char buf[512];
+    int len = read(idle->m_master, buf, sizeof(buf));
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        if ((buf[i] != '\r') && (buf[i] != '\n'))
+        {
+            if (*line_len < 255)
+                line[(*line_len)++] = buf[i];
+            continue;
+        }
+        line[*line_len] = '\0';
+        if (!strncmp(line, "AT", 2))
+        {
+            idle->m_at_commands++;
+            if (!strcmp(line, "AT+ZGRUN=0"))
+                idle->m_running = 0;
+            if (write(idle->m_master, "OK\r\n", 4) != 4)
+                idle->m_overruns++;
+            if (!strcmp(line, "AT+ZGRUN=2"))
+            {
+                *t0 = idle_now();
+                *epoch = 0;
+                idle->m_running = 1;
+            }
+        }
+        *line_len = 0;
+    }
+}
+
+static void *idle_receiver_thread(void *param)
+{
+    IdleState *idle = (IdleState *)param;
+    char at_line[256];
+    int at_len = 0;
+    double t0 = 0;
+    int epoch = 0;
+
+    while (!idle->m_done)
+    {
+        struct pollfd pfd;
+
+        pfd.fd = idle->m_master;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 1) > 0)
+        {
+            if (pfd.revents & POLLIN)
+                idle_read_at(idle, at_line, &at_len, &t0, &epoch);
+            else if (pfd.revents & POLLHUP)
+                usleep(1000);
+        }
+
+        if (idle->m_running && (idle_now() >= t0 + (double)epoch / idle->m_rate_hz))
+        {
+            char buf[512];
+            int len = idle_epoch(buf, sizeof(buf), epoch, idle->m_rate_hz);
+
+            if (write(idle->m_master, buf, len) != len)
+                idle->m_overruns++;
+            epoch++;
+        }
+    }
+    return NULL;
+}
+
+static int idle_open_pty(IdleState *idle, const char **config, int config_count)
+{
+    char slave_name[64];
+    struct termios ios;
+    FILE *fp;
+    int i;
+
+    idle->m_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if ((idle->m_master < 0) || grantpt(idle->m_master) || unlockpt(idle->m_master)
+        || ptsname_r(idle->m_master, slave_name, sizeof(slave_name)))
+        return -1;
+    if (tcgetattr(idle->m_master, &ios) == 0)
+    {
+        cfmakeraw(&ios);
+        tcsetattr(idle->m_master, TCSANOW, &ios);
+    }
+
+    fp = fopen(NMEA_PORT_PATH_CONFIG, "w");
+    if (NULL == fp)
+        return -1;
+    fprintf(fp, "NMEA_PORT=%s\n", slave_name);
+    for (i = 0; i < config_count; i++)
+        fprintf(fp, "%s\n", config[i]);
+    fclose(fp);
+    return 0;
+}
+
+/*init, start until it succeeds, the wanted fixes and stop; 0 or -1 with the step that failed*/
+static int idle_session(const GpsInterface *gps, unsigned long fixes)
+{
+    IdleState *idle = &g_idle;
+    double begin;
+
+    if (gps->init(&g_idle_callbacks))
+    {
+        fprintf(stderr, "init failed\n");
+        return -1;
+    }
+    begin = idle_now();
+    while (gps->start() != 0)
+    {
+        if (idle_now() - begin > IDLE_START_TIMEOUT_MS / 1000.0)
+        {
+            fprintf(stderr, "start failed\n");
+            return -1;
+        }
+        usleep(IDLE_START_RETRY_US);
+    }
+    begin = idle_now();
+    while (idle->m_fixes < fixes)
+    {
+        if (idle_now() - begin > IDLE_FIX_TIMEOUT_MS / 1000.0)
+        {
+            fprintf(stderr, "only %lu of %lu fixes\n", idle->m_fixes, fixes);
+            return -1;
+        }
+        usleep(1000);
+    }
+    if (gps->stop())
+    {
+        fprintf(stderr, "stop failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void idle_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-t idle_s] [-f fixes] [-r hz] [-S settle_ms] [-c KEY=VALUE]...\n",
+        prog);
+}
+
+int main(int argc, char **argv)
+{
+    extern struct hw_module_t HAL_MODULE_INFO_SYM;
+    IdleState *idle = &g_idle;
+    const char *config[IDLE_MAX_CONFIG];
+    int config_count = 0;
+    struct hw_device_t *device = NULL;
+    const GpsInterface *gps;
+    const WlGpsWakeupsInterface *wakeups_if;
+    WlGpsWakeups before, after;
+    pthread_t receiver;
+    int idle_s = 60;
+    int settle_ms = 500;
+    unsigned long fixes = 5;
+    int failed = 0;
+    int opt;
+
+    idle->m_rate_hz = 10;
+    while ((opt = getopt(argc, argv, "t:f:r:S:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't': idle_s = atoi(optarg); break;
+        case 'f': fixes = strtoul(optarg, NULL, 0); break;
+        case 'r': idle->m_rate_hz = atoi(optarg); break;
+        case 'S': settle_ms = atoi(optarg); break;
+        case 'c':
+            if (config_count == IDLE_MAX_CONFIG)
+            {
+                idle_usage(argv[0]);
+                return 2;
+            }
+            config[config_count++] = optarg;
+            break;
+        default:
+            idle_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((optind != argc) || (idle_s < 1) || (idle->m_rate_hz < 1) || (idle->m_rate_hz > 50)
+        || (settle_ms < 0))
+    {
+        idle_usage(argv[0]);
+        return 2;
+    }
+
+    if (idle_open_pty(idle, config, config_count) < 0)
+    {
+        fprintf(stderr, "cannot set up the pty: %s\n", strerror(errno));
+        return 1;
+    }
+    pthread_create(&receiver, NULL, idle_receiver_thread, idle);
+
+    if (HAL_MODULE_INFO_SYM.methods->open(&HAL_MODULE_INFO_SYM, GPS_HARDWARE_MODULE_ID, &device)
+        || (NULL == (gps = ((struct gps_device_t *)device)->get_gps_interface((struct gps_device_t *)device))))
+    {
+        fprintf(stderr, "cannot open the HAL\n");
+        return 1;
+    }
+    wakeups_if = (const WlGpsWakeupsInterface *)gps->get_extension(WL_GPS_WAKEUPS_INTERFACE);
+    if (NULL == wakeups_if)
+    {
+        fprintf(stderr, "the HAL has no %s extension\n", WL_GPS_WAKEUPS_INTERFACE);
+        return 1;
+    }
+
+    if (idle_session(gps, fixes))
+        failed = 1;
+    else
+    {
+        /*the last epoch may still be on its way through the threads when stop returns*/
+        usleep(settle_ms * 1000);
+        wakeups_if->get_wakeups(&before);
+        sleep(idle_s);
+        wakeups_if->get_wakeups(&after);
+
+        printf("thread,before,after\n");
+        printf("reader,%u,%u\n", before.m_reader, after.m_reader);
+        printf("parser,%u,%u\n", before.m_parser, after.m_parser);
+        printf("deliver,%u,%u\n", before.m_deliver, after.m_deliver);
+        if ((after.m_reader != before.m_reader) || (after.m_parser != before.m_parser)
+            || (after.m_deliver != before.m_deliver))
+        {
+            fprintf(stderr, "FAIL: %u reader, %u parser, %u delivery wakeups in %d s idle\n",
+                after.m_reader - before.m_reader, after.m_parser - before.m_parser,
+                after.m_deliver - before.m_deliver, idle_s);
+            failed = 1;
+        }
+    }
+    gps->cleanup();
+
+    /*the HAL leaves common.close unset*/
+    free(device);
+    idle->m_done = 1;
+    pthread_join(receiver, NULL);
+
+    fprintf(stderr, "%lu AT commands, %lu fixes, %lu overruns\n", idle->m_at_commands,
+        idle->m_fixes, idle->m_overruns);
+    return failed;
+}
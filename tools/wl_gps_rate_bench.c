@@ -0,0 +1,530 @@
+/*
+ * High-rate stream benchmark.
+ *
+ * Replays an NMEA capture (for instance one written by wl_gps_sim -o) into
+ * the HAL through a pty, one epoch every 1/rate seconds and no faster than a
+ * UART at the given baud rate would carry it, and answers the HAL's AT
+ * commands with "OK". Every sentence the HAL forwards to nmea_cb is checked
+ * against the capture in order, so a single line lost by the framer or the
+ * parser shows up as a gap. Proprietary "$P" lines are never forwarded, so
+ * every line sent, those included, is also checked against the HAL's own
+ * line counts (WL_GPS_RX_STATS_INTERFACE): none may be thrown away for its
+ * length or its checksum. The run fails if any line was dropped or any epoch
+ * failed to produce a fix.
+ *
+ * An epoch starts at each GGA. Sentences after the last RMC of the capture
+ * close no epoch and stay unforwarded, they are not expected.
+ *
+ * The HAL is linked in and reads its config from NMEA_PORT_PATH_CONFIG,
+ * which the benchmark writes; both must be built with the same path:
+ *   gcc -O2 -pthread -DNMEA_PORT_PATH_CONFIG='"/tmp/wl_gps_rate_bench.conf"' \
+ *       -Iwl_gps -I$AOSP/hardware/libhardware/include \
+ *       -I$AOSP/system/core/include tools/wl_gps_rate_bench.c \
+ *       wl_gps/wl_gps.c wl_gps/wl_nmea.c wl_gps/wl_geofence.c wl_gps/wl_uring.c \
+ *       wl_gps/wl_trace.c wl_gps/wl_history.c -lm \
+ *       -o wl_gps_rate_bench
+ *
+ * Usage: wl_gps_rate_bench [-r hz] [-b baud] [-L] [-c KEY=VALUE]... capture
+ *   -L runs with the default buffer sizes instead of HIGH_RATE=1
+ *   -c adds a line to the HAL config, READ_MODE=THROUGHPUT for instance
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <hardware/gps.h>
+
+#include "wl_nmea.h"
+#include "wl_rx_stats.h"
+
+#ifndef NMEA_PORT_PATH_CONFIG
+#define NMEA_PORT_PATH_CONFIG "/tmp/wl_gps_rate_bench.conf"
+#endif
+/*how long the HAL gets to drain once the last epoch is out*/
+#define BENCH_DRAIN_MS (500)
+/*how far ahead a forwarded line is looked for after a gap*/
+#define BENCH_RESYNC_LINES (4096)
+#define BENCH_MAX_CONFIG (16)
+
+typedef struct
+{
+    uint64_t m_hash;
+    int m_len;
+} BenchLine;
+
+typedef struct
+{
+    int m_offset;
+    int m_len;
+} BenchEpoch;
+
+typedef struct
+{
+    /*the capture*/
+    char *m_data;
+    BenchEpoch *m_epochs;
+    int m_epoch_count;
+    BenchLine *m_expected;
+    int m_expected_count;
+    /*every line sent, $P and whatever else the HAL does not forward included*/
+    int m_line_count;
+    int m_proprietary_count;
+
+    int m_rate_hz;
+    int m_baud;
+    const char *m_config[BENCH_MAX_CONFIG];
+    int m_config_count;
+    int m_master;
+    volatile int m_running;
+    volatile int m_done;
+    double *m_epoch_start;
+
+    /*written by the HAL's delivery thread*/
+    int m_next_expected;
+    unsigned long m_forwarded;
+    unsigned long m_skipped;
+    unsigned long m_unknown;
+    int m_fixes;
+    double m_latency_sum;
+    double m_latency_max;
+
+    /*written by the receiver thread*/
+    unsigned long m_overruns;
+    unsigned long m_late_epochs;
+    unsigned long m_at_commands;
+} BenchState;
+
+static BenchState g_bench;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t bench_hash(const char *p, int len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    while (len-- > 0)
+    {
+        hash ^= (unsigned char)*p++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int bench_load_capture(BenchState *bench, const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    struct stat st;
+    long size;
+    int last_rmc = -1;
+    char *p, *end;
+
+    if ((NULL == fp) || fstat(fileno(fp), &st))
+        return -1;
+    size = st.st_size;
+    bench->m_data = malloc(size + 1);
+    /*at most one epoch and one expected line per two bytes*/
+    bench->m_epochs = calloc(size / 2 + 1, sizeof(BenchEpoch));
+    bench->m_expected = calloc(size / 2 + 1, sizeof(BenchLine));
+    if (!bench->m_data || !bench->m_epochs || !bench->m_expected
+        || (fread(bench->m_data, 1, size, fp) != (size_t)size))
+    {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+    bench->m_data[size] = '\0';
+
+    p = bench->m_data;
+    end = bench->m_data + size;
+    while (p < end)
+    {
+        char *eol = memchr(p, '\n', end - p);
+        int len;
+        unsigned int type;
+
+        eol = eol ? eol + 1 : end;
+        len = eol - p;
+        while ((len > 0) && ((p[len - 1] == '\n') || (p[len - 1] == '\r')))
+            len--;
+
+        type = wl_nmea_sentence_type(p, len);
+        if (len > 0)
+            bench->m_line_count++;
+        if ((len > 1) && !strncmp(p, "$P", 2))
+            bench->m_proprietary_count++;
+        if ((type == WL_NMEA_GGA) || (bench->m_epoch_count == 0))
+        {
+            bench->m_epochs[bench->m_epoch_count].m_offset = p - bench->m_data;
+            bench->m_epoch_count++;
+        }
+        bench->m_epochs[bench->m_epoch_count - 1].m_len = eol - bench->m_data
+            - bench->m_epochs[bench->m_epoch_count - 1].m_offset;
+
+        if (type)
+        {
+            bench->m_expected[bench->m_expected_count].m_hash = bench_hash(p, len);
+            bench->m_expected[bench->m_expected_count].m_len = len;
+            bench->m_expected_count++;
+            if (type == WL_NMEA_RMC)
+                last_rmc = bench->m_expected_count;
+        }
+        p = eol;
+    }
+    bench->m_expected_count = (last_rmc > 0) ? last_rmc : 0;
+    bench->m_epoch_start = calloc(bench->m_epoch_count, sizeof(double));
+    return (bench->m_epoch_start && (bench->m_expected_count > 0)) ? 0 : -1;
+}
+
+static void bench_location_cb(GpsLocation *location)
+{
+    BenchState *bench = &g_bench;
+    double latency;
+
+    if (bench->m_fixes < bench->m_epoch_count)
+    {
+        latency = bench_now() - bench->m_epoch_start[bench->m_fixes];
+        bench->m_latency_sum += latency;
+        if (latency > bench->m_latency_max)
+            bench->m_latency_max = latency;
+    }
+    bench->m_fixes++;
+}
+
+static void bench_status_cb(GpsStatus *status)
+{
+}
+
+static void bench_sv_status_cb(GpsSvStatus *sv_status)
+{
+}
+
+static void bench_nmea_cb(GpsUtcTime timestamp, const char *nmea, int length)
+{
+    BenchState *bench = &g_bench;
+    uint64_t hash = bench_hash(nmea, length);
+    int i;
+
+    bench->m_forwarded++;
+    for (i = bench->m_next_expected; (i < bench->m_expected_count) && (i < bench->m_next_expected + BENCH_RESYNC_LINES); i++)
+    {
+        if ((bench->m_expected[i].m_hash == hash) && (bench->m_expected[i].m_len == length))
+        {
+            bench->m_skipped += i - bench->m_next_expected;
+            bench->m_next_expected = i + 1;
+            return;
+        }
+    }
+    bench->m_unknown++;
+}
+
+typedef struct
+{
+    void (*m_start)(void *);
+    void *m_arg;
+} BenchThread;
+
+static void *bench_thread_main(void *param)
+{
+    BenchThread thread = *(BenchThread *)param;
+
+    free(param);
+    thread.m_start(thread.m_arg);
+    return NULL;
+}
+
+static pthread_t bench_create_thread(const char *name, void (*start)(void *), void *arg)
+{
+    BenchThread *thread = malloc(sizeof(BenchThread));
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    if (NULL == thread)
+        return 0;
+    thread->m_start = start;
+    thread->m_arg = arg;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, bench_thread_main, thread))
+    {
+        free(thread);
+        tid = 0;
+    }
+    pthread_attr_destroy(&attr);
+    return tid;
+}
+
+static GpsCallbacks g_bench_callbacks =
+{
+    .size = sizeof(GpsCallbacks),
+    .location_cb = bench_location_cb,
+    .status_cb = bench_status_cb,
+    .sv_status_cb = bench_sv_status_cb,
+    .nmea_cb = bench_nmea_cb,
+    .create_thread_cb = bench_create_thread,
+};
+
+/*every complete line from the HAL is an AT command and gets an "OK"*/
+static void bench_read_at(BenchState *bench, char *line, int *line_len)
+{
+    char buf[512];
+    int len = read(bench->m_master, buf, sizeof(buf));
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        if ((buf[i] != '\r') && (buf[i] != '\n'))
+        {
+            if (*line_len < 255)
+                line[(*line_len)++] = buf[i];
+            continue;
+        }
+        line[*line_len] = '\0';
+        if (!strncmp(line, "AT", 2))
+        {
+            bench->m_at_commands++;
+            if (!strcmp(line, "AT+ZGRUN=2"))
+                bench->m_running = 1;
+            else if (!strcmp(line, "AT+ZGRUN=0"))
+                bench->m_running = 0;
+            if (write(bench->m_master, "OK\r\n", 4) != 4)
+                bench->m_overruns++;
+        }
+        *line_len = 0;
+    }
+}
+
+/*
+ * Plays the receiver: epoch k starts at k/rate after AT+ZGRUN=2 and its bytes
+ * leave no faster than baud/10 per second.
+ */
+static void *bench_receiver_thread(void *param)
+{
+    BenchState *bench = (BenchState *)param;
+    double bytes_per_sec = bench->m_baud / 10.0;
+    double t0 = 0;
+    char at_line[256];
+    int at_len = 0;
+    int epoch = 0;
+    int sent = 0;
+
+    while (!bench->m_done)
+    {
+        struct pollfd pfd;
+        double now;
+
+        pfd.fd = bench->m_master;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if ((poll(&pfd, 1, 1) > 0) && (pfd.revents & POLLIN))
+            bench_read_at(bench, at_line, &at_len);
+
+        if (!bench->m_running || (epoch >= bench->m_epoch_count))
+            continue;
+
+        now = bench_now();
+        if (0 == t0)
+            t0 = now;
+        if (now < t0 + (double)epoch / bench->m_rate_hz)
+            continue;
+        if (0 == sent)
+            bench->m_epoch_start[epoch] = now;
+
+        {
+            BenchEpoch *e = &bench->m_epochs[epoch];
+            int allowed = (int)((now - bench->m_epoch_start[epoch]) * bytes_per_sec) + 1;
+            int chunk = ((allowed < e->m_len) ? allowed : e->m_len) - sent;
+
+            if (chunk > 0)
+            {
+                int written = write(bench->m_master, bench->m_data + e->m_offset + sent, chunk);
+
+                if (written < chunk)
+                    bench->m_overruns++;
+                sent += chunk;
+            }
+            if (sent >= e->m_len)
+            {
+                epoch++;
+                sent = 0;
+                if ((epoch < bench->m_epoch_count) && (now > t0 + (double)epoch / bench->m_rate_hz))
+                    bench->m_late_epochs++;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int bench_open_pty(BenchState *bench, int high_rate)
+{
+    char slave_name[64];
+    struct termios ios;
+    FILE *fp;
+    int i;
+
+    bench->m_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if ((bench->m_master < 0) || grantpt(bench->m_master) || unlockpt(bench->m_master)
+        || ptsname_r(bench->m_master, slave_name, sizeof(slave_name)))
+        return -1;
+    if (tcgetattr(bench->m_master, &ios) == 0)
+    {
+        cfmakeraw(&ios);
+        tcsetattr(bench->m_master, TCSANOW, &ios);
+    }
+
+    fp = fopen(NMEA_PORT_PATH_CONFIG, "w");
+    if (NULL == fp)
+        return -1;
+    fprintf(fp, "NMEA_PORT=%s\nNMEA_FORWARD=ALL\nBAUD_RATE=%d\n", slave_name, bench->m_baud);
+    if (high_rate)
+        fprintf(fp, "HIGH_RATE=1\n");
+    for (i = 0; i < bench->m_config_count; i++)
+        fprintf(fp, "%s\n", bench->m_config[i]);
+    fclose(fp);
+    return 0;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-r hz] [-b baud] [-L] [-c KEY=VALUE]... capture\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    extern struct hw_module_t HAL_MODULE_INFO_SYM;
+    BenchState *bench = &g_bench;
+    struct hw_device_t *device = NULL;
+    const GpsInterface *gps;
+    const WlGpsRxStatsInterface *rx_stats_if;
+    WlGpsRxStats before, after;
+    unsigned int framed, dropped, bad_checksum;
+    pthread_t receiver;
+    int high_rate = 1;
+    double start, elapsed;
+    int opt;
+
+    bench->m_rate_hz = 20;
+    bench->m_baud = 921600;
+    while ((opt = getopt(argc, argv, "r:b:Lc:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r': bench->m_rate_hz = atoi(optarg); break;
+        case 'b': bench->m_baud = atoi(optarg); break;
+        case 'L': high_rate = 0; break;
+        case 'c':
+            if (bench->m_config_count == BENCH_MAX_CONFIG)
+            {
+                bench_usage(argv[0]);
+                return 2;
+            }
+            bench->m_config[bench->m_config_count++] = optarg;
+            break;
+        default:
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((optind != argc - 1) || (bench->m_rate_hz < 1) || (bench->m_baud < 1200))
+    {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    if (bench_load_capture(bench, argv[optind]) < 0)
+    {
+        fprintf(stderr, "cannot load %s\n", argv[optind]);
+        return 1;
+    }
+    if (bench_open_pty(bench, high_rate) < 0)
+    {
+        fprintf(stderr, "cannot set up the pty: %s\n", strerror(errno));
+        return 1;
+    }
+    pthread_create(&receiver, NULL, bench_receiver_thread, bench);
+
+    if (HAL_MODULE_INFO_SYM.methods->open(&HAL_MODULE_INFO_SYM, GPS_HARDWARE_MODULE_ID, &device)
+        || (NULL == (gps = ((struct gps_device_t *)device)->get_gps_interface((struct gps_device_t *)device))))
+    {
+        fprintf(stderr, "cannot open the HAL\n");
+        return 1;
+    }
+    rx_stats_if = (const WlGpsRxStatsInterface *)gps->get_extension(WL_GPS_RX_STATS_INTERFACE);
+    if (NULL == rx_stats_if)
+    {
+        fprintf(stderr, "the HAL has no %s extension\n", WL_GPS_RX_STATS_INTERFACE);
+        return 1;
+    }
+    /*the counts go back to when the HAL was loaded*/
+    rx_stats_if->get_rx_stats(&before);
+    if (gps->init(&g_bench_callbacks))
+    {
+        fprintf(stderr, "the HAL did not init\n");
+        return 1;
+    }
+    /*start fails until the reader thread has the port open*/
+    for (opt = 0; gps->start() != 0; opt++)
+    {
+        if (opt == 20)
+        {
+            fprintf(stderr, "the HAL did not start\n");
+            return 1;
+        }
+        usleep(100 * 1000);
+    }
+
+    start = bench_now();
+    while (bench->m_fixes < bench->m_epoch_count)
+    {
+        /*give up once the replay is long over*/
+        if (bench_now() - start > (double)bench->m_epoch_count / bench->m_rate_hz + BENCH_DRAIN_MS / 1000.0)
+            break;
+        usleep(1000);
+    }
+    usleep(BENCH_DRAIN_MS * 1000);
+    elapsed = bench_now() - start;
+    gps->stop();
+    rx_stats_if->get_rx_stats(&after);
+    framed = after.m_framed - before.m_framed;
+    dropped = after.m_dropped - before.m_dropped;
+    bad_checksum = after.m_bad_checksum - before.m_bad_checksum;
+    gps->cleanup();
+    /*the HAL leaves common.close unset*/
+    free(device);
+    bench->m_done = 1;
+    pthread_join(receiver, NULL);
+
+    printf("%d epochs at %d Hz over %d baud in %.2f s, %lu late, %lu overruns\n",
+        bench->m_epoch_count, bench->m_rate_hz, bench->m_baud, elapsed,
+        bench->m_late_epochs, bench->m_overruns);
+    printf("lines: %d expected, %lu forwarded, %lu dropped, %lu not in the capture\n",
+        bench->m_expected_count, bench->m_forwarded,
+        bench->m_skipped + (bench->m_expected_count - bench->m_next_expected), bench->m_unknown);
+    /*the "OK"s to the AT commands are framed as well*/
+    printf("framer: %d lines sent (%d $P), %u framed, %u too long, %u failing the checksum\n",
+        bench->m_line_count, bench->m_proprietary_count, framed, dropped, bad_checksum);
+    printf("fixes: %d, latency from epoch start %.2f ms mean, %.2f ms max\n",
+        bench->m_fixes, bench->m_fixes ? bench->m_latency_sum * 1000 / bench->m_fixes : 0.0,
+        bench->m_latency_max * 1000);
+
+    if ((bench->m_next_expected != bench->m_expected_count) || bench->m_skipped || bench->m_unknown
+        || (bench->m_fixes < bench->m_epoch_count) || dropped || bad_checksum
+        || (framed < (unsigned int)bench->m_line_count))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,604 @@
+/*
+ * NMEA receiver simulator.
+ *
+ * Opens a pty and plays the receiver behind it: AT commands from the HAL
+ * (AT+ZGINIT, AT+ZGMODE, AT+ZGNMEA, AT+ZGRUN, AT+ZGFIXRATE, AT+ZGXTRA) are
+ * answered with "OK" after a configurable delay, or "ERROR" at a configurable
+ * rate, and while AT+ZGRUN=2 is in effect a synthetic drive around a circle
+ * is streamed as GGA, GSA, GSV, RMC and VTG epochs at 1-50Hz.
+ *
+ * Faults for stress runs: random garbage bytes inside lines, corrupted
+ * checksums, and lines cut off mid-way followed by a silent gap, the way a
+ * receiver that loses power or a loose UART looks from the host.
+ *
+ * With -m 2-4 the receiver tracks GPS, GLONASS, Galileo and BeiDou: fix
+ * sentences use the GN talker, every constellation gets its own GSA and GSV
+ * group. -p adds a proprietary sentence of the given length to every epoch.
+ *
+ * With -w the simulator writes an /etc/NMEAPORT style file naming its pty,
+ * so a host build of the HAL with -DNMEA_PORT_PATH_CONFIG='"that file"' runs
+ * wl_read_port_thread against it unmodified. With -o it writes -t seconds of
+ * epochs to a capture file instead and exits, for tools/wl_gps_rate_bench.c.
+ *
+ * The trajectory circles at -v meters per second, after standing still for
+ * the first -u seconds. AT+ZGFIXRATE=<count>,<seconds> with seconds above 0
+ * slows the epochs down to one every that many seconds. AT+ZGNMEA=<mask>
+ * sends GGA, GSA, GSV, VTG and RMC for bits 0 to 4, 0 stops the stream.
+ *
+ * Host build:
+ *   gcc -O2 tools/wl_gps_sim.c -lm -o wl_gps_sim
+ *
+ * Usage: wl_gps_sim [-w config | -o capture] [-r hz] [-s satellites]
+ *                   [-m constellations] [-p proprietary_len] [-t seconds]
+ *                   [-d at_delay_ms] [-e at_error_pct] [-n noise_pct]
+ *                   [-k checksum_pct] [-x cut_pct] [-g gap_ms] [-S seed]
+ *                   [-v speed_mps] [-u still_seconds]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_NMEA_GGA (1 << 0)
+#define SIM_NMEA_GSA (1 << 1)
+#define SIM_NMEA_GSV (1 << 2)
+#define SIM_NMEA_VTG (1 << 3)
+#define SIM_NMEA_RMC (1 << 4)
+#define SIM_NMEA_ALL (0x1f)
+
+/*per constellation*/
+#define SIM_MAX_SATELLITES  (32)
+#define SIM_MAX_SYSTEMS     (4)
+#define SIM_MAX_PROPRIETARY (4000)
+#define SIM_LINE_LEN        (SIM_MAX_PROPRIETARY + 32)
+#define SIM_AT_LEN          (1024)
+#define SIM_PENDING_REPLIES (16)
+#define SIM_EARTH_RADIUS_M  (6371008.8)
+#define SIM_PI              (3.14159265358979323846)
+#define SIM_KNOTS_PER_MPS   (1.943844)
+
+typedef struct
+{
+    int m_prn;
+    double m_azimuth;
+    double m_elevation;
+    double m_drift;
+} SimSatellite;
+
+typedef struct
+{
+    double m_due;
+    int m_error;
+} SimReply;
+
+typedef struct
+{
+    /*options*/
+    const char *m_config_path;
+    const char *m_capture_path;
+    int m_rate_hz;
+    int m_satellite_count;
+    int m_system_count;
+    int m_proprietary_len;
+    double m_duration;
+    int m_at_delay_ms;
+    int m_at_error_pct;
+    int m_noise_pct;
+    int m_checksum_pct;
+    int m_cut_pct;
+    int m_gap_ms;
+    double m_still_s;
+
+    int m_master;
+    char m_at_line[SIM_AT_LEN];
+    int m_at_len;
+    SimReply m_replies[SIM_PENDING_REPLIES];
+    int m_reply_count;
+    int m_running;
+    /*AT+ZGNMEA, SIM_NMEA_* bits*/
+    unsigned int m_nmea_types;
+    double m_silent_until;
+    /*AT+ZGFIXRATE, seconds between epochs, 0 for -r*/
+    int m_fix_interval;
+
+    /*trajectory*/
+    double m_center_lat;
+    double m_center_lon;
+    double m_radius_m;
+    double m_speed_mps;
+    time_t m_start_utc;
+    SimSatellite m_satellites[SIM_MAX_SYSTEMS * SIM_MAX_SATELLITES];
+
+    /*stats*/
+    unsigned long m_epochs;
+    unsigned long m_lines;
+    unsigned long m_bytes;
+    unsigned long m_overruns;
+    unsigned long m_at_commands;
+    unsigned long m_at_errors;
+    unsigned long m_xtra_bytes;
+    unsigned long m_noisy;
+    unsigned long m_corrupted;
+    unsigned long m_cuts;
+} SimState;
+
+typedef struct
+{
+    const char *m_talker;
+    int m_first_prn;
+    int m_system_id;
+} SimSystem;
+
+static const SimSystem g_sim_systems[SIM_MAX_SYSTEMS] =
+{
+    { "GP", 1, 1 },
+    { "GL", 65, 2 },
+    { "GA", 1, 3 },
+    { "GB", 1, 4 },
+};
+
+static volatile sig_atomic_t g_stop;
+
+static void sim_on_signal(int sig)
+{
+    g_stop = 1;
+}
+
+static double sim_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int sim_chance(int pct)
+{
+    return (pct > 0) && (rand() % 100 < pct);
+}
+
+/*non-blocking like a UART: whatever the HAL is too slow for is lost*/
+static void sim_write(SimState *sim, const char *buf, int len)
+{
+    int written = write(sim->m_master, buf, len);
+
+    if (written > 0)
+        sim->m_bytes += written;
+    if (written < len)
+        sim->m_overruns++;
+}
+
+static void sim_send_line(SimState *sim, const char *body)
+{
+    char line[SIM_LINE_LEN + 16];
+    unsigned char sum = 0;
+    const char *p;
+    int len;
+
+    for (p = body; *p; p++)
+        sum ^= (unsigned char)*p;
+    if (sim_chance(sim->m_checksum_pct))
+    {
+        sum ^= 1 + rand() % 255;
+        sim->m_corrupted++;
+    }
+    len = snprintf(line, sizeof(line), "$%s*%02X\r\n", body, sum);
+
+    if (sim_chance(sim->m_noise_pct))
+    {
+        int at = rand() % len;
+        int count = 1 + rand() % 8;
+        char noisy[sizeof(line) + 8];
+        int i;
+
+        memcpy(noisy, line, at);
+        for (i = 0; i < count; i++)
+            noisy[at + i] = (char)(rand() % 256);
+        memcpy(noisy + at + count, line + at, len - at);
+        sim_write(sim, noisy, len + count);
+        sim->m_noisy++;
+    }
+    else if (sim_chance(sim->m_cut_pct))
+    {
+        sim_write(sim, line, 1 + rand() % (len - 1));
+        sim->m_silent_until = sim_now() + sim->m_gap_ms / 1000.0;
+        sim->m_cuts++;
+        return;
+    }
+    else
+    {
+        sim_write(sim, line, len);
+    }
+    sim->m_lines++;
+}
+
+static void sim_format_angle(char *out, size_t size, double deg, int lon)
+{
+    double a = fabs(deg);
+    int whole = (int)a;
+    double minutes = (a - whole) * 60.0;
+
+    snprintf(out, size, lon ? "%03d%07.4f,%c" : "%02d%07.4f,%c", whole, minutes,
+        lon ? (deg < 0 ? 'W' : 'E') : (deg < 0 ? 'S' : 'N'));
+}
+
+static void sim_init_satellites(SimState *sim)
+{
+    int i;
+
+    for (i = 0; i < sim->m_system_count * sim->m_satellite_count; i++)
+    {
+        SimSatellite *sat = &sim->m_satellites[i];
+
+        sat->m_prn = g_sim_systems[i / sim->m_satellite_count].m_first_prn + i % sim->m_satellite_count;
+        sat->m_azimuth = rand() % 360;
+        sat->m_elevation = 5 + rand() % 80;
+        sat->m_drift = ((rand() % 200) - 100) / 1000.0;
+    }
+}
+
+/*GSA and GSV group of one constellation*/
+static void sim_send_system(SimState *sim, int system, double t)
+{
+    char body[SIM_LINE_LEN];
+    char prns[64];
+    const char *talker = g_sim_systems[system].m_talker;
+    SimSatellite *sats = &sim->m_satellites[system * sim->m_satellite_count];
+    int used = sim->m_satellite_count < 12 ? sim->m_satellite_count : 12;
+    int groups = (sim->m_satellite_count + 3) / 4;
+    int len = 0;
+    int i, g;
+
+    if (sim->m_nmea_types & SIM_NMEA_GSA)
+    {
+        prns[0] = '\0';
+        for (i = 0; i < 12; i++)
+        {
+            if (i < used)
+                len += snprintf(prns + len, sizeof(prns) - len, "%02d,", sats[i].m_prn);
+            else
+                len += snprintf(prns + len, sizeof(prns) - len, ",");
+        }
+        /*NMEA 4.11 appends the system ID when GN sentences mix constellations*/
+        if (sim->m_system_count > 1)
+            snprintf(body, sizeof(body), "GNGSA,A,3,%s1.6,0.9,1.3,%d", prns, g_sim_systems[system].m_system_id);
+        else
+            snprintf(body, sizeof(body), "%sGSA,A,3,%s1.6,0.9,1.3", talker, prns);
+        sim_send_line(sim, body);
+    }
+
+    for (g = 0; (sim->m_nmea_types & SIM_NMEA_GSV) && (g < groups); g++)
+    {
+        len = snprintf(body, sizeof(body), "%sGSV,%d,%d,%02d", talker, groups, g + 1, sim->m_satellite_count);
+        for (i = g * 4; (i < g * 4 + 4) && (i < sim->m_satellite_count); i++)
+        {
+            SimSatellite *sat = &sats[i];
+            double az = fmod(sat->m_azimuth + sat->m_drift * t + 360.0, 360.0);
+            double el = sat->m_elevation + 5.0 * sin(t / 600.0 + i);
+
+            len += snprintf(body + len, sizeof(body) - len, ",%02d,%02d,%03d,%02d", sat->m_prn,
+                (int)el, (int)az, 20 + (int)(el / 3));
+        }
+        sim_send_line(sim, body);
+    }
+}
+
+/*one epoch, t seconds into the run*/
+static void sim_send_epoch(SimState *sim, double t)
+{
+    char body[SIM_LINE_LEN];
+    char lat_text[24], lon_text[24];
+    char hms[16], dmy[16];
+    const char *talker = (sim->m_system_count > 1) ? "GN" : "GP";
+    time_t utc_sec = sim->m_start_utc + (time_t)t;
+    struct tm utc;
+    int moving = (t >= sim->m_still_s);
+    double angle = moving ? sim->m_speed_mps * (t - sim->m_still_s) / sim->m_radius_m : 0.0;
+    double lat = sim->m_center_lat + (sim->m_radius_m * cos(angle) / SIM_EARTH_RADIUS_M) * 180.0 / SIM_PI;
+    double lon = sim->m_center_lon + (sim->m_radius_m * sin(angle) /
+                 (SIM_EARTH_RADIUS_M * cos(sim->m_center_lat * SIM_PI / 180.0))) * 180.0 / SIM_PI;
+    double course = fmod(90.0 + angle * 180.0 / SIM_PI + 360.0, 360.0);
+    double knots = moving ? sim->m_speed_mps * SIM_KNOTS_PER_MPS : 0.0;
+    int used = sim->m_system_count * sim->m_satellite_count;
+    int i;
+
+    gmtime_r(&utc_sec, &utc);
+    snprintf(hms, sizeof(hms), "%02d%02d%06.3f", utc.tm_hour, utc.tm_min, utc.tm_sec + fmod(t, 1.0));
+    strftime(dmy, sizeof(dmy), "%d%m%y", &utc);
+    sim_format_angle(lat_text, sizeof(lat_text), lat, 0);
+    sim_format_angle(lon_text, sizeof(lon_text), lon, 1);
+
+    snprintf(body, sizeof(body), "%sGGA,%s,%s,%s,1,%02d,0.9,%.1f,M,8.0,M,,", talker, hms, lat_text, lon_text,
+        used < 12 ? used : 12, 40.0 + 5.0 * sin(angle));
+    if (sim->m_nmea_types & SIM_NMEA_GGA)
+        sim_send_line(sim, body);
+
+    for (i = 0; i < sim->m_system_count; i++)
+        sim_send_system(sim, i, t);
+
+    if (sim->m_proprietary_len > 0)
+    {
+        int len = snprintf(body, sizeof(body), "PWLNK,RAW,%lu,", sim->m_epochs);
+
+        /*a raw measurement dump as far as the HAL is concerned*/
+        while (len < sim->m_proprietary_len)
+            body[len++] = "0123456789ABCDEF"[rand() % 16];
+        body[len] = '\0';
+        sim_send_line(sim, body);
+    }
+
+    snprintf(body, sizeof(body), "%sRMC,%s,A,%s,%s,%.2f,%.2f,%s,,,A", talker, hms, lat_text, lon_text,
+        knots, course, dmy);
+    if (sim->m_nmea_types & SIM_NMEA_RMC)
+        sim_send_line(sim, body);
+
+    snprintf(body, sizeof(body), "%sVTG,%.2f,T,,M,%.2f,N,%.2f,K,A", talker, course, knots,
+        knots / SIM_KNOTS_PER_MPS * 3.6);
+    if (sim->m_nmea_types & SIM_NMEA_VTG)
+        sim_send_line(sim, body);
+
+    sim->m_epochs++;
+}
+
+static void sim_handle_at(SimState *sim, const char *cmd)
+{
+    SimReply *reply;
+
+    if (strncmp(cmd, "AT", 2))
+        return;
+
+    sim->m_at_commands++;
+    if (!strcmp(cmd, "AT+ZGRUN=2"))
+        sim->m_running = 1;
+    else if (!strcmp(cmd, "AT+ZGRUN=0"))
+        sim->m_running = 0;
+    else if (!strncmp(cmd, "AT+ZGNMEA=", 10))
+        sim->m_nmea_types = (unsigned int)atoi(cmd + 10) & SIM_NMEA_ALL;
+    else if (!strncmp(cmd, "AT+ZGFIXRATE=", 13))
+    {
+        const char *interval = strchr(cmd, ',');
+
+        sim->m_fix_interval = interval ? atoi(interval + 1) : 0;
+    }
+    else if (!strncmp(cmd, "AT+ZGXTRA=", 10))
+    {
+        const char *hex = strrchr(cmd, ',');
+
+        if (hex)
+            sim->m_xtra_bytes += strlen(hex + 1) / 2;
+    }
+
+    if (sim->m_reply_count == SIM_PENDING_REPLIES)
+        return;
+
+    reply = &sim->m_replies[sim->m_reply_count++];
+    reply->m_due = sim_now() + sim->m_at_delay_ms / 1000.0;
+    reply->m_error = sim_chance(sim->m_at_error_pct);
+}
+
+static void sim_read_at(SimState *sim)
+{
+    char buf[512];
+    int len = read(sim->m_master, buf, sizeof(buf));
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        if ((buf[i] == '\r') || (buf[i] == '\n'))
+        {
+            sim->m_at_line[sim->m_at_len] = '\0';
+            if (sim->m_at_len > 0)
+                sim_handle_at(sim, sim->m_at_line);
+            sim->m_at_len = 0;
+        }
+        else if (sim->m_at_len < SIM_AT_LEN - 1)
+        {
+            sim->m_at_line[sim->m_at_len++] = buf[i];
+        }
+    }
+}
+
+static void sim_send_replies(SimState *sim, double now)
+{
+    int i = 0;
+
+    /*replies stay in order, a slow one holds back the ones behind it*/
+    while ((i < sim->m_reply_count) && (sim->m_replies[i].m_due <= now))
+    {
+        if (sim->m_replies[i].m_error)
+        {
+            sim_write(sim, "ERROR\r\n", 7);
+            sim->m_at_errors++;
+        }
+        else
+        {
+            sim_write(sim, "OK\r\n", 4);
+        }
+        i++;
+    }
+    memmove(sim->m_replies, &sim->m_replies[i], (sim->m_reply_count - i) * sizeof(SimReply));
+    sim->m_reply_count -= i;
+}
+
+static int sim_open_pty(SimState *sim, char *slave_name, size_t size)
+{
+    struct termios ios;
+
+    sim->m_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if ((sim->m_master < 0) || grantpt(sim->m_master) || unlockpt(sim->m_master)
+        || ptsname_r(sim->m_master, slave_name, size))
+        return -1;
+
+    /*no echo of the AT commands back to the HAL before it configures the port*/
+    if (tcgetattr(sim->m_master, &ios) == 0)
+    {
+        cfmakeraw(&ios);
+        tcsetattr(sim->m_master, TCSANOW, &ios);
+    }
+    return 0;
+}
+
+static void sim_usage(const char *prog)
+{
+    fprintf(stderr,
+        "Usage: %s [-w config | -o capture] [-r hz] [-s satellites]\n"
+        "          [-m constellations] [-p proprietary_len] [-t seconds]\n"
+        "          [-d at_delay_ms] [-e at_error_pct] [-n noise_pct]\n"
+        "          [-k checksum_pct] [-x cut_pct] [-g gap_ms] [-S seed]\n"
+        "          [-v speed_mps] [-u still_seconds]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    SimState sim;
+    char slave_name[64];
+    double start, next_epoch, end;
+    unsigned int seed = (unsigned int)time(NULL);
+    int opt;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.m_rate_hz = 1;
+    sim.m_satellite_count = 10;
+    sim.m_system_count = 1;
+    sim.m_gap_ms = 1000;
+    sim.m_nmea_types = SIM_NMEA_ALL;
+    sim.m_center_lat = 31.2;
+    sim.m_center_lon = 121.5;
+    sim.m_radius_m = 2000.0;
+    sim.m_speed_mps = 15.0;
+
+    while ((opt = getopt(argc, argv, "w:o:r:s:m:p:t:d:e:n:k:x:g:S:v:u:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'w': sim.m_config_path = optarg; break;
+        case 'o': sim.m_capture_path = optarg; break;
+        case 'r': sim.m_rate_hz = atoi(optarg); break;
+        case 's': sim.m_satellite_count = atoi(optarg); break;
+        case 'm': sim.m_system_count = atoi(optarg); break;
+        case 'p': sim.m_proprietary_len = atoi(optarg); break;
+        case 't': sim.m_duration = atof(optarg); break;
+        case 'd': sim.m_at_delay_ms = atoi(optarg); break;
+        case 'e': sim.m_at_error_pct = atoi(optarg); break;
+        case 'n': sim.m_noise_pct = atoi(optarg); break;
+        case 'k': sim.m_checksum_pct = atoi(optarg); break;
+        case 'x': sim.m_cut_pct = atoi(optarg); break;
+        case 'g': sim.m_gap_ms = atoi(optarg); break;
+        case 'S': seed = (unsigned int)strtoul(optarg, NULL, 0); break;
+        case 'v': sim.m_speed_mps = atof(optarg); break;
+        case 'u': sim.m_still_s = atof(optarg); break;
+        default:
+            sim_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((sim.m_rate_hz < 1) || (sim.m_rate_hz > 50)
+        || (sim.m_satellite_count < 1) || (sim.m_satellite_count > SIM_MAX_SATELLITES)
+        || (sim.m_system_count < 1) || (sim.m_system_count > SIM_MAX_SYSTEMS)
+        || (sim.m_proprietary_len < 0) || (sim.m_proprietary_len > SIM_MAX_PROPRIETARY)
+        || (sim.m_capture_path && !(sim.m_duration > 0)))
+    {
+        sim_usage(argv[0]);
+        return 2;
+    }
+
+    srand(seed);
+    sim_init_satellites(&sim);
+    sim.m_start_utc = time(NULL);
+
+    if (sim.m_capture_path)
+    {
+        int epoch_count = (int)(sim.m_duration * sim.m_rate_hz);
+        int i;
+
+        sim.m_master = open(sim.m_capture_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (sim.m_master < 0)
+        {
+            fprintf(stderr, "cannot write %s: %s\n", sim.m_capture_path, strerror(errno));
+            return 1;
+        }
+        for (i = 0; i < epoch_count; i++)
+            sim_send_epoch(&sim, (double)i / sim.m_rate_hz);
+        fprintf(stderr, "epochs %lu lines %lu bytes %lu\n", sim.m_epochs, sim.m_lines, sim.m_bytes);
+        close(sim.m_master);
+        return 0;
+    }
+
+    if (sim_open_pty(&sim, slave_name, sizeof(slave_name)) < 0)
+    {
+        fprintf(stderr, "cannot open a pty: %s\n", strerror(errno));
+        return 1;
+    }
+    printf("%s\n", slave_name);
+    fflush(stdout);
+
+    if (sim.m_config_path)
+    {
+        FILE *fp = fopen(sim.m_config_path, "w");
+
+        if (NULL == fp)
+        {
+            fprintf(stderr, "cannot write %s: %s\n", sim.m_config_path, strerror(errno));
+            return 1;
+        }
+        fprintf(fp, "NMEA_PORT=%s\n", slave_name);
+        fclose(fp);
+    }
+
+    signal(SIGINT, sim_on_signal);
+    signal(SIGTERM, sim_on_signal);
+
+    start = sim_now();
+    next_epoch = start;
+    end = (sim.m_duration > 0) ? start + sim.m_duration : 0;
+    while (!g_stop && ((end == 0) || (sim_now() < end)))
+    {
+        struct pollfd pfd;
+        double now = sim_now();
+        double wake = next_epoch;
+        int timeout_ms;
+
+        if ((sim.m_reply_count > 0) && (sim.m_replies[0].m_due < wake))
+            wake = sim.m_replies[0].m_due;
+        timeout_ms = (wake > now) ? (int)((wake - now) * 1000) + 1 : 0;
+
+        pfd.fd = sim.m_master;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        /*POLLHUP only means nobody has the slave open yet*/
+        if ((poll(&pfd, 1, timeout_ms) > 0) && (pfd.revents & POLLIN))
+            sim_read_at(&sim);
+
+        now = sim_now();
+        sim_send_replies(&sim, now);
+
+        if (now >= next_epoch)
+        {
+            double period = (sim.m_fix_interval > 0) ? sim.m_fix_interval : 1.0 / sim.m_rate_hz;
+
+            if (sim.m_running && sim.m_nmea_types && (now >= sim.m_silent_until))
+                sim_send_epoch(&sim, next_epoch - start);
+            next_epoch += period;
+            /*do not burst to catch up after a stall*/
+            if (next_epoch < now)
+                next_epoch = now + period;
+        }
+    }
+
+    fprintf(stderr, "epochs %lu lines %lu bytes %lu overruns %lu\n"
+        "at %lu (errors %lu) xtra bytes %lu\n"
+        "noisy %lu corrupted %lu cut %lu\n",
+        sim.m_epochs, sim.m_lines, sim.m_bytes, sim.m_overruns,
+        sim.m_at_commands, sim.m_at_errors, sim.m_xtra_bytes,
+        sim.m_noisy, sim.m_corrupted, sim.m_cuts);
+    close(sim.m_master);
+    return 0;
+}
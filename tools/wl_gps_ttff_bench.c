@@ -0,0 +1,687 @@
+/*
+ * Time to first fix and session latency benchmark.
+ *
+ * Links the HAL in and plays the receiver behind a pty, then runs scripted
+ * sessions through the GpsInterface and times every step of them:
+ *
+ *   init         wl_gps_init
+ *   start        wl_gps_start, from the first call until one succeeds; a
+ *                start right after init fails until the reader has the port
+ *   at_sequence  the receiver's view of start: first AT line in to the "OK"
+ *                of AT+ZGRUN=2 out
+ *   ttff         first start call to the first location_cb
+ *   fix_latency  the first epoch with a fix fully written to its location_cb,
+ *                the part of the time to first fix that is the HAL's
+ *   stop         wl_gps_stop
+ *   cleanup      wl_gps_cleanup
+ *
+ * The HAL can not delete aiding data, so the three scenarios put the start
+ * into the state the name stands for on both sides, and the receiver sends
+ * epochs without a fix for as long as that start takes it to acquire:
+ *
+ *   cold  every cycle is init, start, fix, stop, cleanup, so the threads,
+ *         the port and the receive buffer are set up again; -C ms to acquire
+ *   warm  one init, then start, fix, stop cycles -i ms apart; -W ms
+ *   hot   as warm, the receiver keeps its fix; -H ms, 0 by default
+ *
+ * Epochs (GGA, GSA, RMC) come every 1/rate seconds from AT+ZGRUN=2 on, so the
+ * time to first fix includes the wait for the first epoch after acquisition
+ * like it does on a real receiver. Every AT command is answered with "OK"
+ * -d ms after it arrives.
+ *
+ * The result is one CSV line per scenario and step, in milliseconds:
+ *   scenario,metric,count,min,mean,p50,p90,p99,max
+ * With -B a previous result is read back as the baseline, and the run fails
+ * when any p50 or p90 grew by more than -x percent and 1ms. It also fails
+ * when a start, stop or fix did not happen.
+ *
+ * The HAL reads its config from NMEA_PORT_PATH_CONFIG, which the benchmark
+ * writes; both must be built with the same path:
+ *   gcc -O2 -pthread -DNMEA_PORT_PATH_CONFIG='"/tmp/wl_gps_ttff_bench.conf"' \
+ *       -Iwl_gps -I$AOSP/hardware/libhardware/include \
+ *       -I$AOSP/system/core/include tools/wl_gps_ttff_bench.c \
+ *       wl_gps/wl_gps.c wl_gps/wl_nmea.c wl_gps/wl_geofence.c wl_gps/wl_uring.c \
+ *       wl_gps/wl_trace.c wl_gps/wl_history.c -lm \
+ *       -o wl_gps_ttff_bench
+ *
+ * Usage: wl_gps_ttff_bench [-n cycles] [-r hz] [-C cold_ms] [-W warm_ms] [-H hot_ms]
+ *                          [-i idle_ms] [-d at_delay_ms] [-s scenarios]
+ *                          [-B baseline.csv] [-x percent] [-c KEY=VALUE]...
+ *   -s picks the scenarios, any of "cwh"
+ *   -c adds a line to the HAL config, READ_MODE=THROUGHPUT for instance
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <hardware/gps.h>
+
+#ifndef NMEA_PORT_PATH_CONFIG
+#define NMEA_PORT_PATH_CONFIG "/tmp/wl_gps_ttff_bench.conf"
+#endif
+/*how long a fix may take beyond the acquisition before the cycle counts as failed*/
+#define BENCH_FIX_TIMEOUT_MS (5000)
+/*start keeps failing until the reader thread has the port open*/
+#define BENCH_START_TIMEOUT_MS (5000)
+#define BENCH_START_RETRY_US (1000)
+#define BENCH_MAX_CONFIG (16)
+#define BENCH_MAX_REPLIES (16)
+#define BENCH_MAX_BASELINE (64)
+/*growth that is never a regression, timer and scheduler noise on a host*/
+#define BENCH_NOISE_MS (1.0)
+
+enum
+{
+    BENCH_INIT,
+    BENCH_START,
+    BENCH_AT_SEQUENCE,
+    BENCH_TTFF,
+    BENCH_FIX_LATENCY,
+    BENCH_STOP,
+    BENCH_CLEANUP,
+    BENCH_METRICS
+};
+
+static const char *g_bench_metrics[BENCH_METRICS] =
+{
+    "init", "start", "at_sequence", "ttff", "fix_latency", "stop", "cleanup"
+};
+
+typedef struct
+{
+    const char *m_name;
+    char m_key;
+    /*init and cleanup around every cycle, not just around the scenario*/
+    int m_cycle_init;
+    int m_acquire_ms;
+} BenchScenario;
+
+typedef struct
+{
+    double *m_ms;
+    int m_count;
+} BenchSamples;
+
+typedef struct
+{
+    char m_scenario[16];
+    char m_metric[16];
+    double m_p50;
+    double m_p90;
+} BenchBaseline;
+
+typedef struct
+{
+    int m_master;
+    int m_rate_hz;
+    int m_at_delay_ms;
+    volatile int m_done;
+
+    /*set by main before each start, read by the receiver thread*/
+    volatile int m_acquire_ms;
+
+    /*written by the receiver thread*/
+    volatile int m_running;
+    volatile double m_at_first;
+    volatile double m_at_run;
+    volatile double m_first_fix_written;
+    unsigned long m_at_commands;
+    unsigned long m_overruns;
+
+    /*written by the HAL's delivery thread*/
+    volatile double m_first_location;
+    unsigned long m_fixes;
+} BenchState;
+
+static BenchState g_bench;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_location_cb(GpsLocation *location)
+{
+    BenchState *bench = &g_bench;
+
+    if (0 == bench->m_first_location)
+        bench->m_first_location = bench_now();
+    bench->m_fixes++;
+}
+
+static void bench_status_cb(GpsStatus *status)
+{
+}
+
+typedef struct
+{
+    void (*m_start)(void *);
+    void *m_arg;
+} BenchThread;
+
+static void *bench_thread_main(void *param)
+{
+    BenchThread thread = *(BenchThread *)param;
+
+    free(param);
+    thread.m_start(thread.m_arg);
+    return NULL;
+}
+
+static pthread_t bench_create_thread(const char *name, void (*start)(void *), void *arg)
+{
+    BenchThread *thread = malloc(sizeof(BenchThread));
+    pthread_attr_t attr;
+    pthread_t tid;
+
+    if (NULL == thread)
+        return 0;
+    thread->m_start = start;
+    thread->m_arg = arg;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&tid, &attr, bench_thread_main, thread))
+    {
+        free(thread);
+        tid = 0;
+    }
+    pthread_attr_destroy(&attr);
+    return tid;
+}
+
+/*only fixes are asked for, the way an app with a location listener runs the HAL*/
+static GpsCallbacks g_bench_callbacks =
+{
+    .size = sizeof(GpsCallbacks),
+    .location_cb = bench_location_cb,
+    .status_cb = bench_status_cb,
+    .create_thread_cb = bench_create_thread,
+};
+
+/*appends "$body*XX\r\n"*/
+static int bench_sentence(char *out, int size, const char *body)
+{
+    unsigned char sum = 0;
+    const char *p;
+
+    for (p = body; *p; p++)
+        sum ^= (unsigned char)*p;
+    return snprintf(out, size, "$%s*%02X\r\n", body, sum);
+}
+
+static int bench_epoch(char *out, int size, int epoch, int rate_hz, int fixed)
+{
+    char body[160];
+    int ms = epoch * 1000 / rate_hz;
+    int sec = ms / 1000;
+    char utc[16];
+    int len = 0;
+
+    snprintf(utc, sizeof(utc), "%02d%02d%02d.%02d", (sec / 3600) % 24, (sec / 60) % 60, sec % 60,
+        (ms % 1000) / 10);
+    if (fixed)
+    {
+        snprintf(body, sizeof(body), "GPGGA,%s,3107.4260,N,12121.6530,E,1,08,0.9,12.0,M,8.0,M,,", utc);
+        len += bench_sentence(out + len, size - len, body);
+        len += bench_sentence(out + len, size - len, "GPGSA,A,3,01,03,06,09,14,17,19,22,,,,,1.6,0.9,1.3");
+        snprintf(body, sizeof(body), "GPRMC,%s,A,3107.4260,N,12121.6530,E,0.0,0.0,191026,,,A", utc);
+        len += bench_sentence(out + len, size - len, body);
+    }
+    else
+    {
+        snprintf(body, sizeof(body), "GPGGA,%s,,,,,0,00,99.9,,M,,M,,", utc);
+        len += bench_sentence(out + len, size - len, body);
+        len += bench_sentence(out + len, size - len, "GPGSA,A,1,,,,,,,,,,,,,99.9,99.9,99.9");
+        snprintf(body, sizeof(body), "GPRMC,%s,V,,,,,,,191026,,,N", utc);
+        len += bench_sentence(out + len, size - len, body);
+    }
+    return len;
+}
+
+/*every complete line from the HAL is an AT command, its "OK" is due at_delay_ms later*/
+static void bench_read_at(BenchState *bench, char *line, int *line_len, double *due, int *pending)
+{
+    char buf[512];
+    int len = read(bench->m_master, buf, sizeof(buf));
+    double now = bench_now();
+    int i;
+
+    for (i = 0; i < len; i++)
+    {
+        if ((buf[i] != '\r') && (buf[i] != '\n'))
+        {
+            if (*line_len < 255)
+                line[(*line_len)++] = buf[i];
+            continue;
+        }
+        line[*line_len] = '\0';
+        if (!strncmp(line, "AT", 2) && (*pending < BENCH_MAX_REPLIES))
+        {
+            bench->m_at_commands++;
+            if (0 == bench->m_at_first)
+                bench->m_at_first = now;
+            /*the run state changes with the answer, not with the command*/
+            due[*pending] = now + bench->m_at_delay_ms / 1000.0;
+            if (!strcmp(line, "AT+ZGRUN=2"))
+                due[*pending] = -due[*pending];
+            else if (!strcmp(line, "AT+ZGRUN=0"))
+                bench->m_running = 0;
+            (*pending)++;
+        }
+        *line_len = 0;
+    }
+}
+
+/*
+ * Plays the receiver: answers AT commands, and from the "OK" of AT+ZGRUN=2
+ * on sends an epoch every 1/rate seconds, with a fix once acquire_ms passed.
+ */
+static void *bench_receiver_thread(void *param)
+{
+    BenchState *bench = (BenchState *)param;
+    double due[BENCH_MAX_REPLIES];
+    int pending = 0;
+    char at_line[256];
+    int at_len = 0;
+    double t0 = 0;
+    double acquired = 0;
+    int epoch = 0;
+
+    while (!bench->m_done)
+    {
+        struct pollfd pfd;
+        double now;
+        int i;
+
+        pfd.fd = bench->m_master;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, 1) > 0)
+        {
+            if (pfd.revents & POLLIN)
+                bench_read_at(bench, at_line, &at_len, due, &pending);
+            /*nobody has the slave open between cold cycles*/
+            else if (pfd.revents & POLLHUP)
+                usleep(1000);
+        }
+
+        now = bench_now();
+        while ((pending > 0) && (now >= (due[0] < 0 ? -due[0] : due[0])))
+        {
+            if (write(bench->m_master, "OK\r\n", 4) != 4)
+                bench->m_overruns++;
+            if (due[0] < 0)
+            {
+                bench->m_at_run = now;
+                bench->m_running = 1;
+                t0 = now;
+                acquired = now + bench->m_acquire_ms / 1000.0;
+                epoch = 0;
+            }
+            for (i = 1; i < pending; i++)
+                due[i - 1] = due[i];
+            pending--;
+        }
+
+        if (bench->m_running && (now >= t0 + (double)epoch / bench->m_rate_hz))
+        {
+            char buf[512];
+            int fixed = (now >= acquired);
+            int len = bench_epoch(buf, sizeof(buf), epoch, bench->m_rate_hz, fixed);
+
+            if (write(bench->m_master, buf, len) != len)
+                bench->m_overruns++;
+            if (fixed && (0 == bench->m_first_fix_written))
+                bench->m_first_fix_written = bench_now();
+            epoch++;
+        }
+    }
+    return NULL;
+}
+
+static int bench_open_pty(BenchState *bench, const char **config, int config_count)
+{
+    char slave_name[64];
+    struct termios ios;
+    FILE *fp;
+    int i;
+
+    bench->m_master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if ((bench->m_master < 0) || grantpt(bench->m_master) || unlockpt(bench->m_master)
+        || ptsname_r(bench->m_master, slave_name, sizeof(slave_name)))
+        return -1;
+    if (tcgetattr(bench->m_master, &ios) == 0)
+    {
+        cfmakeraw(&ios);
+        tcsetattr(bench->m_master, TCSANOW, &ios);
+    }
+
+    fp = fopen(NMEA_PORT_PATH_CONFIG, "w");
+    if (NULL == fp)
+        return -1;
+    fprintf(fp, "NMEA_PORT=%s\n", slave_name);
+    for (i = 0; i < config_count; i++)
+        fprintf(fp, "%s\n", config[i]);
+    fclose(fp);
+    return 0;
+}
+
+static void bench_add(BenchSamples *samples, double seconds)
+{
+    samples->m_ms[samples->m_count++] = seconds * 1000;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*nearest rank*/
+static double bench_percentile(const double *sorted, int count, int percent)
+{
+    int rank = (percent * count + 99) / 100;
+
+    return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+static int bench_load_baseline(const char *path, BenchBaseline *baseline, int max)
+{
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    int count = 0;
+
+    if (NULL == fp)
+        return -1;
+    while ((count < max) && fgets(line, sizeof(line), fp))
+    {
+        BenchBaseline *b = &baseline[count];
+        int n;
+        double min, mean;
+
+        /*scenario,metric,count,min,mean,p50,p90,...; the header does not scan*/
+        if (sscanf(line, "%15[^,],%15[^,],%d,%lf,%lf,%lf,%lf", b->m_scenario, b->m_metric, &n,
+                &min, &mean, &b->m_p50, &b->m_p90) == 7)
+            count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+/*prints the line of one metric, 1 when it regressed against the baseline*/
+static int bench_report(const char *scenario, int metric, BenchSamples *samples,
+            const BenchBaseline *baseline, int baseline_count, double percent)
+{
+    const char *name = g_bench_metrics[metric];
+    double p50, p90, sum = 0;
+    int i;
+
+    if (0 == samples->m_count)
+        return 0;
+    qsort(samples->m_ms, samples->m_count, sizeof(double), bench_compare);
+    for (i = 0; i < samples->m_count; i++)
+        sum += samples->m_ms[i];
+    p50 = bench_percentile(samples->m_ms, samples->m_count, 50);
+    p90 = bench_percentile(samples->m_ms, samples->m_count, 90);
+    printf("%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", scenario, name, samples->m_count,
+        samples->m_ms[0], sum / samples->m_count, p50, p90,
+        bench_percentile(samples->m_ms, samples->m_count, 99), samples->m_ms[samples->m_count - 1]);
+
+    for (i = 0; i < baseline_count; i++)
+    {
+        const BenchBaseline *b = &baseline[i];
+
+        if (strcmp(b->m_scenario, scenario) || strcmp(b->m_metric, name))
+            continue;
+        if ((p50 > b->m_p50 * (1 + percent / 100) + BENCH_NOISE_MS)
+            || (p90 > b->m_p90 * (1 + percent / 100) + BENCH_NOISE_MS))
+        {
+            fprintf(stderr, "REGRESSION %s %s: p50 %.3f -> %.3f ms, p90 %.3f -> %.3f ms\n",
+                scenario, name, b->m_p50, p50, b->m_p90, p90);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*start until it succeeds, 0 or -1 when it never did*/
+static int bench_start(const GpsInterface *gps, BenchSamples *samples)
+{
+    BenchState *bench = &g_bench;
+    double begin;
+
+    bench->m_at_first = 0;
+    bench->m_at_run = 0;
+    bench->m_first_fix_written = 0;
+    bench->m_first_location = 0;
+    begin = bench_now();
+    while (gps->start() != 0)
+    {
+        if (bench_now() - begin > BENCH_START_TIMEOUT_MS / 1000.0)
+            return -1;
+        usleep(BENCH_START_RETRY_US);
+        /*only the attempt that went through counts as the AT sequence*/
+        bench->m_at_first = 0;
+    }
+    bench_add(&samples[BENCH_START], bench_now() - begin);
+    if (bench->m_at_first && bench->m_at_run)
+        bench_add(&samples[BENCH_AT_SEQUENCE], bench->m_at_run - bench->m_at_first);
+
+    while (0 == bench->m_first_location)
+    {
+        if (bench_now() - begin > (bench->m_acquire_ms + BENCH_FIX_TIMEOUT_MS) / 1000.0)
+            return -1;
+        usleep(1000);
+    }
+    bench_add(&samples[BENCH_TTFF], bench->m_first_location - begin);
+    if (bench->m_first_fix_written)
+        bench_add(&samples[BENCH_FIX_LATENCY], bench->m_first_location - bench->m_first_fix_written);
+    return 0;
+}
+
+static int bench_timed_init(const GpsInterface *gps, BenchSamples *samples)
+{
+    double begin = bench_now();
+
+    if (gps->init(&g_bench_callbacks))
+        return -1;
+    bench_add(&samples[BENCH_INIT], bench_now() - begin);
+    return 0;
+}
+
+static void bench_timed_cleanup(const GpsInterface *gps, BenchSamples *samples)
+{
+    double begin = bench_now();
+
+    gps->cleanup();
+    bench_add(&samples[BENCH_CLEANUP], bench_now() - begin);
+}
+
+/*the number of cycles that failed*/
+static int bench_scenario(const GpsInterface *gps, const BenchScenario *scenario, int cycles,
+            int idle_ms, BenchSamples *samples)
+{
+    BenchState *bench = &g_bench;
+    int failed = 0;
+    int i;
+
+    bench->m_acquire_ms = scenario->m_acquire_ms;
+    if (!scenario->m_cycle_init && bench_timed_init(gps, samples))
+        return cycles;
+
+    for (i = 0; i < cycles; i++)
+    {
+        double begin;
+
+        if (scenario->m_cycle_init && bench_timed_init(gps, samples))
+        {
+            failed++;
+            continue;
+        }
+        if (bench_start(gps, samples))
+        {
+            fprintf(stderr, "%s cycle %d: no %s\n", scenario->m_name, i,
+                bench->m_at_run ? "fix" : "start");
+            failed++;
+        }
+
+        begin = bench_now();
+        if (gps->stop() == 0)
+            bench_add(&samples[BENCH_STOP], bench_now() - begin);
+        else
+        {
+            fprintf(stderr, "%s cycle %d: stop failed\n", scenario->m_name, i);
+            failed++;
+        }
+
+        if (scenario->m_cycle_init)
+            bench_timed_cleanup(gps, samples);
+        else if (i + 1 < cycles)
+            usleep(idle_ms * 1000);
+    }
+
+    if (!scenario->m_cycle_init)
+        bench_timed_cleanup(gps, samples);
+    return failed;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n cycles] [-r hz] [-C cold_ms] [-W warm_ms] [-H hot_ms]\n"
+        "       [-i idle_ms] [-d at_delay_ms] [-s scenarios] [-B baseline.csv] [-x percent]\n"
+        "       [-c KEY=VALUE]...\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    extern struct hw_module_t HAL_MODULE_INFO_SYM;
+    BenchState *bench = &g_bench;
+    BenchScenario scenarios[] =
+    {
+        { "cold", 'c', 1, 1500 },
+        { "warm", 'w', 0, 500 },
+        { "hot", 'h', 0, 0 },
+    };
+    int scenario_count = sizeof(scenarios) / sizeof(scenarios[0]);
+    BenchBaseline baseline[BENCH_MAX_BASELINE];
+    int baseline_count = 0;
+    const char *baseline_path = NULL;
+    double percent = 25;
+    const char *config[BENCH_MAX_CONFIG];
+    int config_count = 0;
+    const char *wanted = "cwh";
+    struct hw_device_t *device = NULL;
+    const GpsInterface *gps;
+    pthread_t receiver;
+    int cycles = 10;
+    int idle_ms = 200;
+    int failed = 0;
+    int regressed = 0;
+    int opt;
+    int i, m;
+
+    bench->m_rate_hz = 10;
+    bench->m_at_delay_ms = 2;
+    while ((opt = getopt(argc, argv, "n:r:C:W:H:i:d:s:B:x:c:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': cycles = atoi(optarg); break;
+        case 'r': bench->m_rate_hz = atoi(optarg); break;
+        case 'C': scenarios[0].m_acquire_ms = atoi(optarg); break;
+        case 'W': scenarios[1].m_acquire_ms = atoi(optarg); break;
+        case 'H': scenarios[2].m_acquire_ms = atoi(optarg); break;
+        case 'i': idle_ms = atoi(optarg); break;
+        case 'd': bench->m_at_delay_ms = atoi(optarg); break;
+        case 's': wanted = optarg; break;
+        case 'B': baseline_path = optarg; break;
+        case 'x': percent = atof(optarg); break;
+        case 'c':
+            if (config_count == BENCH_MAX_CONFIG)
+            {
+                bench_usage(argv[0]);
+                return 2;
+            }
+            config[config_count++] = optarg;
+            break;
+        default:
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((optind != argc) || (cycles < 1) || (bench->m_rate_hz < 1) || (bench->m_rate_hz > 50)
+        || (idle_ms < 0) || (bench->m_at_delay_ms < 0) || (percent < 0))
+    {
+        bench_usage(argv[0]);
+        return 2;
+    }
+    if (baseline_path)
+    {
+        baseline_count = bench_load_baseline(baseline_path, baseline, BENCH_MAX_BASELINE);
+        if (baseline_count <= 0)
+        {
+            fprintf(stderr, "cannot load a baseline from %s\n", baseline_path);
+            return 1;
+        }
+    }
+
+    if (bench_open_pty(bench, config, config_count) < 0)
+    {
+        fprintf(stderr, "cannot set up the pty: %s\n", strerror(errno));
+        return 1;
+    }
+    pthread_create(&receiver, NULL, bench_receiver_thread, bench);
+
+    if (HAL_MODULE_INFO_SYM.methods->open(&HAL_MODULE_INFO_SYM, GPS_HARDWARE_MODULE_ID, &device)
+        || (NULL == (gps = ((struct gps_device_t *)device)->get_gps_interface((struct gps_device_t *)device))))
+    {
+        fprintf(stderr, "cannot open the HAL\n");
+        return 1;
+    }
+
+    printf("scenario,metric,count,min,mean,p50,p90,p99,max\n");
+    for (i = 0; i < scenario_count; i++)
+    {
+        BenchSamples samples[BENCH_METRICS];
+
+        if (NULL == strchr(wanted, scenarios[i].m_key))
+            continue;
+        for (m = 0; m < BENCH_METRICS; m++)
+        {
+            /*init and cleanup once per cycle at most, and once more around the scenario*/
+            samples[m].m_ms = calloc(cycles + 1, sizeof(double));
+            samples[m].m_count = 0;
+        }
+
+        failed += bench_scenario(gps, &scenarios[i], cycles, idle_ms, samples);
+        for (m = 0; m < BENCH_METRICS; m++)
+        {
+            regressed += bench_report(scenarios[i].m_name, m, &samples[m], baseline, baseline_count,
+                percent);
+            free(samples[m].m_ms);
+        }
+        fflush(stdout);
+    }
+
+    /*the HAL leaves common.close unset*/
+    free(device);
+    bench->m_done = 1;
+    pthread_join(receiver, NULL);
+
+    fprintf(stderr, "%lu AT commands, %lu fixes, %lu overruns, %d cycles failed, %d metrics regressed\n",
+        bench->m_at_commands, bench->m_fixes, bench->m_overruns, failed, regressed);
+    return (failed || regressed) ? 1 : 0;
+}
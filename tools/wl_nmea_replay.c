@@ -0,0 +1,552 @@
+/*
+ * Offline NMEA log processor.
+ *
+ * Replays recorded NMEA logs through the HAL parser (wl_gps/wl_nmea.c) on all
+ * cores and prints every fix the HAL would have reported, in file order, as
+ * CSV: timestamp,latitude,longitude,altitude,speed,bearing,accuracy
+ *
+ * Each log is mmapped and cut into chunks at line boundaries. Every worker
+ * thread owns a queue of chunks and steals from the others when it runs dry.
+ * A chunk is parsed speculatively from a fresh parser state; the output
+ * thread then replays its head from the real state left by the previous
+ * chunk until both runs reach the same state at an RMC, so fixes that depend
+ * on the previous epoch come out exactly as a single sequential pass would
+ * produce them.
+ *
+ * With -C each log is instead parsed in one pass into FixColumns
+ * (wl_fix_columns.h), fixes and satellites alike, and summarized: the number
+ * of fixes and satellite rows, the length of the track and, one line per
+ * non-empty dB-Hz bin, the SNR histogram of every satellite reported:
+ *   log,fixes,satellites,track_m
+ *   snr_dbhz,count
+ *
+ * Host build:
+ *   gcc -O2 -pthread -Iwl_gps -I$AOSP/hardware/libhardware/include \
+ *       -I$AOSP/system/core/include tools/wl_nmea_replay.c wl_gps/wl_nmea.c \
+ *       wl_gps/wl_fix_columns.c -lm -o wl_nmea_replay
+ *
+ * Usage: wl_nmea_replay [-j threads] [-c chunk_kb] [-C] log...
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "wl_nmea.h"
+#include "wl_fix_columns.h"
+
+#define REPLAY_DEFAULT_CHUNK_KB (16 * 1024)
+/*RMC sentences at which a chunk's speculative state is kept for the resync*/
+#define REPLAY_SYNC_POINTS (8)
+/*chunks a worker may run ahead of the output, per worker*/
+#define REPLAY_WINDOW_PER_THREAD (4)
+
+typedef struct
+{
+    GpsLocation m_loc;
+    /*the fix came out of the line ending here*/
+    const char *m_line_end;
+} ReplayFix;
+
+typedef struct
+{
+    const char *m_line_end;
+    NmeaParseState m_state;
+} ReplaySyncPoint;
+
+typedef struct
+{
+    ReplayFix *m_fixes;
+    int m_count;
+    int m_cap;
+    const char *m_cur_line_end;
+} ReplayFixList;
+
+typedef struct
+{
+    const char *m_beg;
+    const char *m_end;
+    ReplayFixList m_fixes;
+    ReplaySyncPoint m_sync[REPLAY_SYNC_POINTS];
+    int m_sync_count;
+    NmeaParseState m_final;
+    int m_done;
+} ReplayChunk;
+
+typedef struct
+{
+    pthread_mutex_t m_lock;
+    int *m_items;
+    int m_head;
+    int m_tail;
+} ReplayDeque;
+
+typedef struct
+{
+    ReplayChunk *m_chunks;
+    int m_chunk_count;
+    ReplayDeque *m_deques;
+    int m_thread_count;
+    const NmeaParseState *m_fresh;
+    pthread_mutex_t m_lock;
+    pthread_cond_t m_cond;
+    int m_printed;
+    int m_window;
+} ReplayJob;
+
+typedef struct
+{
+    ReplayJob *m_job;
+    int m_index;
+} ReplayWorker;
+
+static void replay_on_location(void *user, GpsLocation *location)
+{
+    ReplayFixList *list = (ReplayFixList *)user;
+
+    if (list->m_count == list->m_cap)
+    {
+        list->m_cap = list->m_cap ? list->m_cap * 2 : 256;
+        list->m_fixes = realloc(list->m_fixes, list->m_cap * sizeof(ReplayFix));
+        if (NULL == list->m_fixes)
+        {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+
+    list->m_fixes[list->m_count].m_loc = *location;
+    list->m_fixes[list->m_count].m_line_end = list->m_cur_line_end;
+    list->m_count++;
+}
+
+static int replay_is_rmc(const char *line, int len)
+{
+    return (len > 6) && (line[0] == '$') && !memcmp(line + 3, "RMC", 3);
+}
+
+/*
+ * Feeds the lines of [beg, end) to the parser. When chunk is given, the state
+ * after each of its first RMC sentences is kept as a sync point.
+ */
+static void replay_parse_range(NmeaParseState *state, ReplayFixList *fixes,
+            const char *beg, const char *end, ReplayChunk *chunk)
+{
+    NmeaParseCallbacks callbacks;
+    const char *p = beg;
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.location_cb = replay_on_location;
+    callbacks.user = fixes;
+
+    while (p < end)
+    {
+        const char *eol = memchr(p, '\n', end - p);
+        const char *next = eol ? eol + 1 : end;
+        int len = (eol ? eol : end) - p;
+
+        if ((len > 0) && (p[len - 1] == '\r'))
+            len--;
+
+        if (len > 0)
+        {
+            fixes->m_cur_line_end = next;
+            wl_parse_nmea_line(state, &callbacks, p, len);
+
+            if (chunk && (chunk->m_sync_count < REPLAY_SYNC_POINTS) && replay_is_rmc(p, len))
+            {
+                chunk->m_sync[chunk->m_sync_count].m_line_end = next;
+                chunk->m_sync[chunk->m_sync_count].m_state = *state;
+                chunk->m_sync_count++;
+            }
+        }
+
+        p = next;
+    }
+}
+
+/*
+ * Redoes the head of a speculatively parsed chunk from the state the previous
+ * chunk really ended in, up to the first sync point where both runs agree.
+ * Comparing whole structs may report a difference in padding only; that
+ * costs a longer replay, never a wrong result.
+ */
+static void replay_resync(ReplayChunk *chunk, const NmeaParseState *incoming)
+{
+    NmeaParseState state = *incoming;
+    ReplayFixList redo;
+    const char *p = chunk->m_beg;
+    int i, keep;
+
+    memset(&redo, 0, sizeof(redo));
+
+    for (i = 0; i < chunk->m_sync_count; i++)
+    {
+        replay_parse_range(&state, &redo, p, chunk->m_sync[i].m_line_end, NULL);
+        p = chunk->m_sync[i].m_line_end;
+
+        if (0 == memcmp(&state, &chunk->m_sync[i].m_state, sizeof(state)))
+            break;
+    }
+
+    if (i == chunk->m_sync_count)
+    {
+        /*never converged, the whole chunk depends on what came before*/
+        replay_parse_range(&state, &redo, p, chunk->m_end, NULL);
+        chunk->m_final = state;
+        p = chunk->m_end;
+    }
+
+    /*speculative fixes after the sync point stand as they are*/
+    for (keep = 0; keep < chunk->m_fixes.m_count; keep++)
+    {
+        if (chunk->m_fixes.m_fixes[keep].m_line_end > p)
+            break;
+    }
+
+    for (i = keep; i < chunk->m_fixes.m_count; i++)
+    {
+        redo.m_cur_line_end = chunk->m_fixes.m_fixes[i].m_line_end;
+        replay_on_location(&redo, &chunk->m_fixes.m_fixes[i].m_loc);
+    }
+
+    free(chunk->m_fixes.m_fixes);
+    chunk->m_fixes = redo;
+}
+
+/*
+ * Owners and thieves both take the lowest pending chunk, which keeps all
+ * workers close to the output position.
+ */
+static int replay_take_chunk(ReplayJob *job, int self)
+{
+    int i;
+
+    for (i = 0; i < job->m_thread_count; i++)
+    {
+        ReplayDeque *deque = &job->m_deques[(self + i) % job->m_thread_count];
+        int index = -1;
+
+        pthread_mutex_lock(&deque->m_lock);
+        if (deque->m_head < deque->m_tail)
+            index = deque->m_items[deque->m_head++];
+        pthread_mutex_unlock(&deque->m_lock);
+
+        if (index >= 0)
+            return index;
+    }
+
+    return -1;
+}
+
+static void *replay_worker(void *param)
+{
+    ReplayWorker *worker = (ReplayWorker *)param;
+    ReplayJob *job = worker->m_job;
+    int index;
+
+    while ((index = replay_take_chunk(job, worker->m_index)) >= 0)
+    {
+        ReplayChunk *chunk = &job->m_chunks[index];
+        NmeaParseState state = *job->m_fresh;
+
+        pthread_mutex_lock(&job->m_lock);
+        while (index >= job->m_printed + job->m_window)
+            pthread_cond_wait(&job->m_cond, &job->m_lock);
+        pthread_mutex_unlock(&job->m_lock);
+
+        replay_parse_range(&state, &chunk->m_fixes, chunk->m_beg, chunk->m_end, chunk);
+        chunk->m_final = state;
+
+        pthread_mutex_lock(&job->m_lock);
+        chunk->m_done = 1;
+        pthread_cond_broadcast(&job->m_cond);
+        pthread_mutex_unlock(&job->m_lock);
+    }
+
+    return NULL;
+}
+
+static void replay_print_fixes(const ReplayFixList *fixes)
+{
+    int i;
+
+    for (i = 0; i < fixes->m_count; i++)
+    {
+        const GpsLocation *loc = &fixes->m_fixes[i].m_loc;
+
+        printf("%lld,%.7f,%.7f,%.2f,%.2f,%.2f,%.2f\n", (long long)loc->timestamp,
+            loc->latitude, loc->longitude, loc->altitude, loc->speed, loc->bearing, loc->accuracy);
+    }
+}
+
+static int replay_split(const char *data, size_t size, size_t chunk_size, ReplayChunk **chunks_out)
+{
+    ReplayChunk *chunks = NULL;
+    const char *p = data;
+    const char *end = data + size;
+    int count = 0;
+
+    while (p < end)
+    {
+        const char *cut = (size_t)(end - p) > chunk_size ? p + chunk_size : end;
+
+        if (cut < end)
+        {
+            const char *eol = memchr(cut, '\n', end - cut);
+            cut = eol ? eol + 1 : end;
+        }
+
+        chunks = realloc(chunks, (count + 1) * sizeof(ReplayChunk));
+        if (NULL == chunks)
+            return -1;
+
+        memset(&chunks[count], 0, sizeof(ReplayChunk));
+        chunks[count].m_beg = p;
+        chunks[count].m_end = cut;
+        count++;
+        p = cut;
+    }
+
+    *chunks_out = chunks;
+    return count;
+}
+
+static int replay_file(const char *path, int thread_count, size_t chunk_size, const NmeaParseState *fresh)
+{
+    ReplayJob job;
+    ReplayWorker *workers;
+    pthread_t *threads;
+    struct stat st;
+    char *data;
+    int fd, i, k;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if ((fstat(fd, &st) < 0) || (0 == st.st_size))
+    {
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+    {
+        fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    memset(&job, 0, sizeof(job));
+    job.m_chunk_count = replay_split(data, st.st_size, chunk_size, &job.m_chunks);
+    if (job.m_chunk_count < 0)
+    {
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    job.m_thread_count = thread_count;
+    job.m_fresh = fresh;
+    job.m_window = thread_count * REPLAY_WINDOW_PER_THREAD;
+    pthread_mutex_init(&job.m_lock, NULL);
+    pthread_cond_init(&job.m_cond, NULL);
+
+    /*deal the chunks round-robin so every worker starts near the front*/
+    job.m_deques = calloc(thread_count, sizeof(ReplayDeque));
+    workers = calloc(thread_count, sizeof(ReplayWorker));
+    threads = calloc(thread_count, sizeof(pthread_t));
+    for (i = 0; i < thread_count; i++)
+    {
+        pthread_mutex_init(&job.m_deques[i].m_lock, NULL);
+        job.m_deques[i].m_items = malloc((job.m_chunk_count / thread_count + 1) * sizeof(int));
+    }
+    for (k = 0; k < job.m_chunk_count; k++)
+    {
+        ReplayDeque *deque = &job.m_deques[k % thread_count];
+        deque->m_items[deque->m_tail++] = k;
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        workers[i].m_job = &job;
+        workers[i].m_index = i;
+        pthread_create(&threads[i], NULL, replay_worker, &workers[i]);
+    }
+
+    for (k = 0; k < job.m_chunk_count; k++)
+    {
+        ReplayChunk *chunk = &job.m_chunks[k];
+        const NmeaParseState *incoming = k ? &job.m_chunks[k - 1].m_final : fresh;
+
+        pthread_mutex_lock(&job.m_lock);
+        while (!chunk->m_done)
+            pthread_cond_wait(&job.m_cond, &job.m_lock);
+        pthread_mutex_unlock(&job.m_lock);
+
+        if (memcmp(incoming, fresh, sizeof(NmeaParseState)))
+            replay_resync(chunk, incoming);
+
+        replay_print_fixes(&chunk->m_fixes);
+        free(chunk->m_fixes.m_fixes);
+        chunk->m_fixes.m_fixes = NULL;
+
+        pthread_mutex_lock(&job.m_lock);
+        job.m_printed = k + 1;
+        pthread_cond_broadcast(&job.m_cond);
+        pthread_mutex_unlock(&job.m_lock);
+    }
+
+    for (i = 0; i < thread_count; i++)
+    {
+        pthread_join(threads[i], NULL);
+        pthread_mutex_destroy(&job.m_deques[i].m_lock);
+        free(job.m_deques[i].m_items);
+    }
+
+    pthread_mutex_destroy(&job.m_lock);
+    pthread_cond_destroy(&job.m_cond);
+    free(job.m_deques);
+    free(workers);
+    free(threads);
+    free(job.m_chunks);
+    munmap(data, st.st_size);
+    return 0;
+}
+
+/*the whole log in one pass, so every fix and SV status lands in file order*/
+static int replay_columns(const char *path, const NmeaParseState *fresh)
+{
+    NmeaParseState state = *fresh;
+    NmeaParseCallbacks callbacks;
+    FixColumns columns;
+    uint32_t hist[WL_SNR_HISTOGRAM_BINS];
+    struct stat st;
+    const char *p, *end;
+    char *data;
+    int fd, bin;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if ((fstat(fd, &st) < 0) || (0 == st.st_size))
+    {
+        close(fd);
+        return 0;
+    }
+
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+    {
+        fprintf(stderr, "%s: mmap: %s\n", path, strerror(errno));
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    wl_fix_columns_init(&columns);
+    memset(&callbacks, 0, sizeof(callbacks));
+    wl_fix_columns_set_callbacks(&columns, &callbacks);
+
+    p = data;
+    end = data + st.st_size;
+    while (p < end)
+    {
+        const char *eol = memchr(p, '\n', end - p);
+        const char *next = eol ? eol + 1 : end;
+        int len = (eol ? eol : end) - p;
+
+        if ((len > 0) && (p[len - 1] == '\r'))
+            len--;
+        if (len > 0)
+            wl_parse_nmea_line(&state, &callbacks, p, len);
+        p = next;
+    }
+    munmap(data, st.st_size);
+
+    memset(hist, 0, sizeof(hist));
+    wl_fix_columns_snr_histogram(columns.m_snr, columns.m_sv_count, hist);
+    printf("log,fixes,satellites,track_m\n");
+    printf("%s,%d,%d,%.1f\n", path, columns.m_count, columns.m_sv_count,
+        wl_fix_columns_track_length(columns.m_latitude, columns.m_longitude, columns.m_count));
+    printf("snr_dbhz,count\n");
+    for (bin = 0; bin < WL_SNR_HISTOGRAM_BINS; bin++)
+    {
+        if (hist[bin])
+            printf("%d,%u\n", bin, hist[bin]);
+    }
+
+    wl_fix_columns_free(&columns);
+    return 0;
+}
+
+static void replay_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-j threads] [-c chunk_kb] [-C] log...\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static char out_buf[1 << 20];
+    NmeaParseState fresh;
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t chunk_size = (size_t)REPLAY_DEFAULT_CHUNK_KB * 1024;
+    int columns = 0;
+    int opt, ret = 0;
+
+    while ((opt = getopt(argc, argv, "j:c:Ch")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            thread_count = atol(optarg);
+            break;
+        case 'c':
+            chunk_size = (size_t)atol(optarg) * 1024;
+            break;
+        case 'C':
+            columns = 1;
+            break;
+        default:
+            replay_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if ((optind >= argc) || (thread_count < 1) || (0 == chunk_size))
+    {
+        replay_usage(argv[0]);
+        return 2;
+    }
+
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+    wl_reset_parse_state(&fresh);
+
+    for (; optind < argc; optind++)
+    {
+        if (columns)
+        {
+            if (replay_columns(argv[optind], &fresh) < 0)
+                ret = 1;
+        }
+        else if (replay_file(argv[optind], (int)thread_count, chunk_size, &fresh) < 0)
+            ret = 1;
+    }
+
+    fflush(stdout);
+    return ret;
+}
@@ -0,0 +1,318 @@
+/*
+ * NMEA framing benchmark.
+ *
+ * Plays a capture (tools/wl_gps_sim.c -o, or a log of a real receiver) in
+ * read-sized pieces through the two ways the buffer thread could take it
+ * apart, all on one thread:
+ *
+ *   search: the pieces are appended to a buffer, every line is found with
+ *           strstr from where the last one ended, copied out and handed to
+ *           wl_parse_nmea_line, which splits it again
+ *   stream: the pieces go through wl_nmea_stream_feed, which frames, splits
+ *           and checks each byte as it comes, and wl_parse_nmea_sentence
+ *
+ * Each is timed framing only and framing plus parsing, with every callback
+ * set. Both must find the same sentences and report the same fixes. Both
+ * reject a line with a '\r' inside it, and one spliced onto the head of
+ * another. The only way they part is framing: the search ends lines at
+ * "\r\n" alone, so a capture with noise bytes (-n) that hold a stray '\n'
+ * gives it fewer, longer lines than the stream.
+ *
+ * With -m both parse through an NmeaMemo, and how many GSA and GSV
+ * sentences it spared a decode is printed; run with and without it to see
+ * what the memo saves on a capture.
+ *
+ * Host build:
+ *   gcc -O2 -Iwl_gps -I$AOSP/hardware/libhardware/include \
+ *       -I$AOSP/system/core/include tools/wl_nmea_stream_bench.c \
+ *       wl_gps/wl_nmea.c -lm -o wl_nmea_stream_bench
+ *
+ * Usage: wl_nmea_stream_bench [-b read_bytes] [-n passes] [-l max_line] [-m] capture
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wl_nmea.h"
+
+/*what a tty read hands over on recent kernels*/
+#define BENCH_DEFAULT_READ (64)
+#define BENCH_DEFAULT_MAX_LINE (256)
+
+typedef struct
+{
+    unsigned long m_lines;
+    unsigned long m_locations;
+    unsigned long m_sv_status;
+    unsigned long m_nmea;
+    /*sum of the fixes, so a different decode shows*/
+    double m_lat_sum;
+    unsigned int m_memo_hits;
+    unsigned int m_memo_misses;
+} BenchCounts;
+
+/*-m, the parse state of each pass gets a fresh memo*/
+static int g_bench_memo;
+static NmeaMemo g_memo;
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench_location(void *user, GpsLocation *location)
+{
+    BenchCounts *counts = (BenchCounts *)user;
+
+    counts->m_locations++;
+    counts->m_lat_sum += location->latitude;
+}
+
+static void bench_sv_status(void *user, GpsSvStatus *sv_status)
+{
+    ((BenchCounts *)user)->m_sv_status++;
+}
+
+static void bench_nmea(void *user, GpsUtcTime timestamp, const char *nmea, int length)
+{
+    ((BenchCounts *)user)->m_nmea++;
+}
+
+/*
+ * The search framer as the HAL had it: lines end at "\r\n", the buffer is
+ * NUL terminated for strstr and its tail moved to the front before each
+ * append. A tail that outgrows the buffer is thrown away, and with it the
+ * line its remainder ends.
+ */
+static void bench_search(const char *data, long size, int read_bytes, int max_line, int parse,
+            BenchCounts *counts)
+{
+    char *buf = malloc(max_line * 2 + read_bytes + 1);
+    char *info = malloc(max_line + 1);
+    NmeaParseState state;
+    NmeaParseCallbacks callbacks;
+    int len = 0;
+    int start = 0;
+    int lost = 0;
+    long pos;
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.location_cb = bench_location;
+    callbacks.sv_status_cb = bench_sv_status;
+    callbacks.nmea_cb = bench_nmea;
+    callbacks.nmea_mask = WL_NMEA_ALL;
+    callbacks.user = counts;
+    wl_reset_parse_state(&state);
+    if (g_bench_memo)
+        wl_attach_parse_memo(&state, &g_memo);
+
+    for (pos = 0; pos < size; pos += read_bytes)
+    {
+        int piece = (size - pos < read_bytes) ? size - pos : read_bytes;
+        char *end;
+
+        memmove(buf, buf + start, len - start);
+        len -= start;
+        start = 0;
+        if (len > max_line * 2)
+        {
+            len = 0;
+            lost = 1;
+        }
+        memcpy(buf + len, data + pos, piece);
+        len += piece;
+        buf[len] = '\0';
+
+        while ((end = strstr(buf + start, "\r\n")) != NULL)
+        {
+            int info_len = end - (buf + start);
+
+            if (lost)
+            {
+                lost = 0;
+            }
+            else if (info_len <= max_line)
+            {
+                memcpy(info, buf + start, info_len);
+                info[info_len] = '\0';
+                counts->m_lines++;
+                if (parse)
+                    wl_parse_nmea_line(&state, &callbacks, info, info_len);
+            }
+            start = end + 2 - buf;
+        }
+    }
+    counts->m_memo_hits = g_memo.m_hits;
+    counts->m_memo_misses = g_memo.m_misses;
+    free(info);
+    free(buf);
+}
+
+static void bench_stream(const char *data, long size, int read_bytes, int max_line, int parse,
+            BenchCounts *counts)
+{
+    char *line = malloc(max_line + 1);
+    NmeaStream stream;
+    NmeaSentence sentence;
+    NmeaParseState state;
+    NmeaParseCallbacks callbacks;
+    long pos;
+
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.location_cb = bench_location;
+    callbacks.sv_status_cb = bench_sv_status;
+    callbacks.nmea_cb = bench_nmea;
+    callbacks.nmea_mask = WL_NMEA_ALL;
+    callbacks.user = counts;
+    wl_reset_parse_state(&state);
+    if (g_bench_memo)
+        wl_attach_parse_memo(&state, &g_memo);
+    wl_nmea_stream_init(&stream, line, max_line);
+
+    for (pos = 0; pos < size; pos += read_bytes)
+    {
+        const char *piece = data + pos;
+        int left = (size - pos < read_bytes) ? size - pos : read_bytes;
+
+        while (left > 0)
+        {
+            int taken;
+
+            if (wl_nmea_stream_feed(&stream, piece, left, &taken, &sentence) == WL_NMEA_STREAM_SENTENCE)
+            {
+                counts->m_lines++;
+                if (parse)
+                    wl_parse_nmea_sentence(&state, &callbacks, &sentence);
+            }
+            piece += taken;
+            left -= taken;
+        }
+    }
+    counts->m_memo_hits = g_memo.m_hits;
+    counts->m_memo_misses = g_memo.m_misses;
+    free(line);
+}
+
+typedef void (*BenchPath)(const char *data, long size, int read_bytes, int max_line, int parse,
+            BenchCounts *counts);
+
+/*best of the passes, in ns per line*/
+static double bench_run(BenchPath path, const char *data, long size, int read_bytes, int max_line,
+            int parse, int passes, BenchCounts *counts)
+{
+    double best = 0;
+    int i;
+
+    for (i = 0; i < passes; i++)
+    {
+        double start;
+        double elapsed;
+
+        memset(counts, 0, sizeof(*counts));
+        start = bench_now_ns();
+        path(data, size, read_bytes, max_line, parse, counts);
+        elapsed = bench_now_ns() - start;
+        if ((0 == i) || (elapsed < best))
+            best = elapsed;
+    }
+    return counts->m_lines ? best / counts->m_lines : 0;
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-b read_bytes] [-n passes] [-l max_line] [-m] capture\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    BenchCounts search, stream;
+    double search_ns, stream_ns;
+    int read_bytes = BENCH_DEFAULT_READ;
+    int max_line = BENCH_DEFAULT_MAX_LINE;
+    int passes = 20;
+    char *data;
+    long size;
+    FILE *fp;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:n:l:m")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            read_bytes = atoi(optarg);
+            break;
+        case 'n':
+            passes = atoi(optarg);
+            break;
+        case 'l':
+            max_line = atoi(optarg);
+            break;
+        case 'm':
+            g_bench_memo = 1;
+            break;
+        default:
+            bench_usage(argv[0]);
+            return 2;
+        }
+    }
+    if ((optind != argc - 1) || (read_bytes <= 0) || (passes <= 0) || (max_line < 16))
+    {
+        bench_usage(argv[0]);
+        return 2;
+    }
+
+    fp = fopen(argv[optind], "rb");
+    if (NULL == fp)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    data = malloc(size > 0 ? size : 1);
+    if ((NULL == data) || (fread(data, 1, size, fp) != (size_t)size))
+    {
+        fprintf(stderr, "%s: can not read\n", argv[optind]);
+        return 1;
+    }
+    fclose(fp);
+
+    printf("%ld bytes in %d byte reads, best of %d passes\n", size, read_bytes, passes);
+
+    search_ns = bench_run(bench_search, data, size, read_bytes, max_line, 0, passes, &search);
+    stream_ns = bench_run(bench_stream, data, size, read_bytes, max_line, 0, passes, &stream);
+    printf("frame only:  search %.1f ns/line, stream %.1f ns/line, %lu lines, %.2fx\n",
+        search_ns, stream_ns, search.m_lines, stream_ns > 0 ? search_ns / stream_ns : 0);
+
+    search_ns = bench_run(bench_search, data, size, read_bytes, max_line, 1, passes, &search);
+    stream_ns = bench_run(bench_stream, data, size, read_bytes, max_line, 1, passes, &stream);
+    printf("frame+parse: search %.1f ns/line, stream %.1f ns/line, %lu fixes, %.2fx\n",
+        search_ns, stream_ns, search.m_locations, stream_ns > 0 ? search_ns / stream_ns : 0);
+    printf("stream: %.1f MB/s framed and parsed\n",
+        stream_ns > 0 ? size / (stream_ns * stream.m_lines) * 1e3 : 0);
+    if (g_bench_memo && (stream.m_memo_hits + stream.m_memo_misses))
+        printf("memo: %u GSA/GSV hits, %u misses, %.1f%% not decoded again\n",
+            stream.m_memo_hits, stream.m_memo_misses,
+            100.0 * stream.m_memo_hits / (stream.m_memo_hits + stream.m_memo_misses));
+
+    free(data);
+
+    if ((search.m_lines != stream.m_lines) || (search.m_locations != stream.m_locations)
+        || (search.m_sv_status != stream.m_sv_status) || (search.m_nmea != stream.m_nmea)
+        || (search.m_lat_sum != stream.m_lat_sum))
+    {
+        fprintf(stderr, "MISMATCH: search %lu lines %lu fixes %lu sv %lu nmea, "
+            "stream %lu lines %lu fixes %lu sv %lu nmea\n",
+            search.m_lines, search.m_locations, search.m_sv_status, search.m_nmea,
+            stream.m_lines, stream.m_locations, stream.m_sv_status, stream.m_nmea);
+        return 1;
+    }
+    return 0;
+}
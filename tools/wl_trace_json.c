@@ -0,0 +1,258 @@
+/*
+ * HAL trace converter.
+ *
+ * Turns the span dump a WL_GPS_TRACE build of the HAL writes to TRACE_FILE
+ * (wl_gps/wl_trace.c) into Chrome trace JSON, which chrome://tracing and
+ * the Perfetto UI both open. Every HAL thread becomes one track. A summary
+ * of each span's count, mean and longest duration goes to stderr.
+ *
+ * An end whose begin already dropped out of its thread's ring is left out,
+ * so the oldest spans of a busy thread may be missing but never unbalanced.
+ *
+ * Host build:
+ *   gcc -O2 -Iwl_gps tools/wl_trace_json.c -o wl_trace_json
+ *
+ * Usage: wl_trace_json [-o out.json] dump
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "wl_trace.h"
+
+/*deeper nesting than the HAL produces, spans past it are not summarised*/
+#define TRACE_MAX_DEPTH (64)
+#define TRACE_MAX_SPANS (256)
+#define TRACE_MAX_NAME (64)
+
+typedef struct
+{
+    char m_name[TRACE_MAX_NAME];
+    unsigned long m_count;
+    double m_total_us;
+    double m_max_us;
+} TraceSpanStats;
+
+typedef struct
+{
+    int m_span;
+    uint64_t m_begin_ns;
+} TraceOpen;
+
+static void trace_json_string(FILE *out, const char *str)
+{
+    fputc('"', out);
+    for (; *str; str++)
+    {
+        if ((*str == '"') || (*str == '\\'))
+            fputc('\\', out);
+        if ((unsigned char)*str >= 0x20)
+            fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+static int trace_read_name(FILE *fp, char *name)
+{
+    int c;
+    int len = 0;
+
+    while ((c = fgetc(fp)) != EOF)
+    {
+        if (c == '\0')
+        {
+            name[len] = '\0';
+            return 0;
+        }
+        if (len < TRACE_MAX_NAME - 1)
+            name[len++] = c;
+    }
+    return -1;
+}
+
+static void trace_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-o out.json] dump\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    WlTraceFileHeader header;
+    WlTraceFileThread thread;
+    WlTraceEvent *events = NULL;
+    TraceSpanStats spans[TRACE_MAX_SPANS];
+    TraceOpen open_spans[TRACE_MAX_DEPTH];
+    const char *out_path = NULL;
+    FILE *fp;
+    FILE *out = stdout;
+    long events_pos;
+    uint64_t base_ns = UINT64_MAX;
+    unsigned long written = 0;
+    unsigned long unmatched = 0;
+    int first = 1;
+    int opt;
+    uint32_t t, i;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            out_path = optarg;
+            break;
+        default:
+            trace_usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        trace_usage(argv[0]);
+        return 2;
+    }
+
+    fp = fopen(argv[optind], "rb");
+    if (NULL == fp)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    if ((fread(&header, sizeof(header), 1, fp) != 1)
+        || memcmp(header.m_magic, WL_TRACE_MAGIC, sizeof(header.m_magic))
+        || (header.m_span_count > TRACE_MAX_SPANS))
+    {
+        fprintf(stderr, "%s: not a HAL trace dump\n", argv[optind]);
+        return 1;
+    }
+
+    memset(spans, 0, sizeof(spans));
+    for (i = 0; i < header.m_span_count; i++)
+    {
+        if (trace_read_name(fp, spans[i].m_name) < 0)
+        {
+            fprintf(stderr, "%s: truncated\n", argv[optind]);
+            return 1;
+        }
+    }
+
+    /*a first pass for the earliest event, so times start near zero*/
+    events_pos = ftell(fp);
+    for (t = 0; t < header.m_thread_count; t++)
+    {
+        WlTraceEvent event;
+
+        if (fread(&thread, sizeof(thread), 1, fp) != 1)
+            break;
+        if ((thread.m_event_count > 0) && (fread(&event, sizeof(event), 1, fp) == 1))
+        {
+            if (event.m_time_ns < base_ns)
+                base_ns = event.m_time_ns;
+            fseek(fp, (long)(thread.m_event_count - 1) * sizeof(event), SEEK_CUR);
+        }
+    }
+    fseek(fp, events_pos, SEEK_SET);
+
+    if (out_path)
+    {
+        out = fopen(out_path, "w");
+        if (NULL == out)
+        {
+            perror(out_path);
+            return 1;
+        }
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (t = 0; t < header.m_thread_count; t++)
+    {
+        int depth = 0;
+
+        if (fread(&thread, sizeof(thread), 1, fp) != 1)
+        {
+            fprintf(stderr, "%s: truncated\n", argv[optind]);
+            break;
+        }
+        thread.m_name[WL_TRACE_NAME_LEN - 1] = '\0';
+        free(events);
+        events = malloc(sizeof(WlTraceEvent) * (thread.m_event_count ? thread.m_event_count : 1));
+        if ((NULL == events)
+            || (fread(events, sizeof(WlTraceEvent), thread.m_event_count, fp) != thread.m_event_count))
+        {
+            fprintf(stderr, "%s: truncated\n", argv[optind]);
+            break;
+        }
+
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+            first ? "" : ",\n", thread.m_tid);
+        trace_json_string(out, thread.m_name);
+        fprintf(out, "}}");
+        first = 0;
+
+        for (i = 0; i < thread.m_event_count; i++)
+        {
+            WlTraceEvent *event = &events[i];
+            double ts_us = (event->m_time_ns - base_ns) / 1000.0;
+
+            if (event->m_span >= header.m_span_count)
+                continue;
+
+            if (event->m_phase == 'E')
+            {
+                if (0 == depth)
+                {
+                    unmatched++;
+                    continue;
+                }
+                depth--;
+                if (depth < TRACE_MAX_DEPTH)
+                {
+                    TraceSpanStats *stats = &spans[open_spans[depth].m_span];
+                    double us = (event->m_time_ns - open_spans[depth].m_begin_ns) / 1000.0;
+
+                    stats->m_count++;
+                    stats->m_total_us += us;
+                    if (us > stats->m_max_us)
+                        stats->m_max_us = us;
+                }
+                fprintf(out, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", thread.m_tid, ts_us);
+            }
+            else
+            {
+                if (depth < TRACE_MAX_DEPTH)
+                {
+                    open_spans[depth].m_span = event->m_span;
+                    open_spans[depth].m_begin_ns = event->m_time_ns;
+                }
+                depth++;
+                fprintf(out, ",\n{\"name\":");
+                trace_json_string(out, spans[event->m_span].m_name);
+                fprintf(out, ",\"cat\":\"wl_gps\",\"ph\":\"B\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                    "\"args\":{\"arg\":%u}}", thread.m_tid, ts_us, event->m_arg);
+            }
+            written++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    free(events);
+    fclose(fp);
+    if ((out != stdout) && (fclose(out) != 0))
+    {
+        perror(out_path);
+        return 1;
+    }
+
+    fprintf(stderr, "%u threads, %lu events, %lu ends without a begin left out\n",
+        header.m_thread_count, written, unmatched);
+    fprintf(stderr, "%-16s %10s %12s %12s\n", "span", "count", "mean us", "max us");
+    for (i = 0; i < header.m_span_count; i++)
+    {
+        if (0 == spans[i].m_count)
+            continue;
+        fprintf(stderr, "%-16s %10lu %12.1f %12.1f\n", spans[i].m_name, spans[i].m_count,
+            spans[i].m_total_us / spans[i].m_count, spans[i].m_max_us);
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+LOCAL_PATH := $(call my-dir)
+
+# The GPS HAL, loaded as hw/gps.default.so. Every .c the HAL links against
+# goes in LOCAL_SRC_FILES; wl_fix_columns.c is only used by the tools.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gps.default
+LOCAL_MODULE_TAGS := optional
+# LOCAL_MODULE_RELATIVE_PATH only exists from 5.0 on, hal.sh still builds 4.x
+LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
+
+LOCAL_SRC_FILES := \
+	wl_gps.c \
+	wl_nmea.c \
+	wl_geofence.c \
+	wl_uring.c \
+	wl_trace.c \
+	wl_history.c
+
+LOCAL_CFLAGS := -Wall -Wno-unused-parameter
+# -DWL_GPS_TRACE records thread spans for tools/wl_trace_json,
+# -DWL_GPS_TRACE_NMEA logs every sentence; both for bring-up builds only
+
+LOCAL_SHARED_LIBRARIES := liblog
+
+include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,353 @@
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "wl_log.h"
+#include "wl_fix_columns.h"
+
+#define WL_COLUMN_ALIGN      (64)
+#define WL_COLUMN_MIN_CAP    (256)
+#define WL_EARTH_RADIUS_M    (6371008.8)
+#define WL_DEG_TO_RAD        (3.14159265358979323846 / 180.0)
+
+/*
+ * Past these the fast path's polynomials lose precision, such pairs are
+ * redone with libm. Consecutive fixes never get near either bound.
+ */
+#define WL_FAST_MAX_DLON     (180.0)
+#define WL_FAST_MAX_HALF_CHORD (0.1)
+
+void wl_fix_columns_init(FixColumns *columns)
+{
+    memset(columns, 0, sizeof(*columns));
+}
+
+void wl_fix_columns_free(FixColumns *columns)
+{
+    free(columns->m_timestamp);
+    free(columns->m_latitude);
+    free(columns->m_longitude);
+    free(columns->m_altitude);
+    free(columns->m_speed);
+    free(columns->m_bearing);
+    free(columns->m_sv_epoch);
+    free(columns->m_prn);
+    free(columns->m_snr);
+    free(columns->m_elevation);
+    free(columns->m_azimuth);
+    wl_fix_columns_init(columns);
+}
+
+/*swaps *column for an aligned copy with room for cap rows, leaves it alone on failure*/
+static int wl_grow_column(void **column, size_t elem_size, int count, int cap)
+{
+    void *grown = NULL;
+
+    if (posix_memalign(&grown, WL_COLUMN_ALIGN, elem_size * cap) != 0)
+        return -1;
+
+    if (count > 0)
+        memcpy(grown, *column, elem_size * count);
+    free(*column);
+    *column = grown;
+    return 0;
+}
+
+static int wl_next_cap(int cap, int need)
+{
+    int next = (cap > 0) ? cap : WL_COLUMN_MIN_CAP;
+
+    while (next < need)
+        next *= 2;
+    return next;
+}
+
+static int wl_reserve_fixes(FixColumns *columns, int need)
+{
+    int cap;
+
+    if (need <= columns->m_cap)
+        return 0;
+
+    cap = wl_next_cap(columns->m_cap, need);
+    if ((wl_grow_column((void **)&columns->m_timestamp, sizeof(int64_t), columns->m_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_latitude, sizeof(double), columns->m_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_longitude, sizeof(double), columns->m_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_altitude, sizeof(double), columns->m_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_speed, sizeof(float), columns->m_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_bearing, sizeof(float), columns->m_count, cap) < 0))
+    {
+        LOGE("[wl_reserve_fixes]:out of memory for %d fixes", cap);
+        return -1;
+    }
+    columns->m_cap = cap;
+    return 0;
+}
+
+static int wl_reserve_svs(FixColumns *columns, int need)
+{
+    int cap;
+
+    if (need <= columns->m_sv_cap)
+        return 0;
+
+    cap = wl_next_cap(columns->m_sv_cap, need);
+    if ((wl_grow_column((void **)&columns->m_sv_epoch, sizeof(int32_t), columns->m_sv_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_prn, sizeof(int32_t), columns->m_sv_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_snr, sizeof(float), columns->m_sv_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_elevation, sizeof(float), columns->m_sv_count, cap) < 0) ||
+        (wl_grow_column((void **)&columns->m_azimuth, sizeof(float), columns->m_sv_count, cap) < 0))
+    {
+        LOGE("[wl_reserve_svs]:out of memory for %d satellites", cap);
+        return -1;
+    }
+    columns->m_sv_cap = cap;
+    return 0;
+}
+
+int wl_fix_columns_add_location(FixColumns *columns, const GpsLocation *location)
+{
+    int row = columns->m_count;
+
+    if (wl_reserve_fixes(columns, row + 1) < 0)
+        return -1;
+
+    columns->m_timestamp[row] = location->timestamp;
+    columns->m_latitude[row] = location->latitude;
+    columns->m_longitude[row] = location->longitude;
+    columns->m_altitude[row] = location->altitude;
+    columns->m_speed[row] = location->speed;
+    columns->m_bearing[row] = location->bearing;
+    columns->m_count = row + 1;
+    return 0;
+}
+
+int wl_fix_columns_add_sv_status(FixColumns *columns, const GpsSvStatus *sv_status)
+{
+    int num_svs = sv_status->num_svs;
+    int row = columns->m_sv_count;
+    int i;
+
+    if (num_svs > GPS_MAX_SVS)
+        num_svs = GPS_MAX_SVS;
+    if (num_svs <= 0)
+        return 0;
+    if (wl_reserve_svs(columns, row + num_svs) < 0)
+        return -1;
+
+    for (i = 0; i < num_svs; i++, row++)
+    {
+        const GpsSvInfo *sv = &sv_status->sv_list[i];
+
+        columns->m_sv_epoch[row] = columns->m_count;
+        columns->m_prn[row] = sv->prn;
+        columns->m_snr[row] = sv->snr;
+        columns->m_elevation[row] = sv->elevation;
+        columns->m_azimuth[row] = sv->azimuth;
+    }
+    columns->m_sv_count = row;
+    return 0;
+}
+
+static void wl_fix_columns_location_cb(void *user, GpsLocation *location)
+{
+    wl_fix_columns_add_location((FixColumns *)user, location);
+}
+
+static void wl_fix_columns_sv_status_cb(void *user, GpsSvStatus *sv_status)
+{
+    wl_fix_columns_add_sv_status((FixColumns *)user, sv_status);
+}
+
+void wl_fix_columns_set_callbacks(FixColumns *columns, NmeaParseCallbacks *callbacks)
+{
+    callbacks->location_cb = wl_fix_columns_location_cb;
+    callbacks->sv_status_cb = wl_fix_columns_sv_status_cb;
+    callbacks->user = columns;
+}
+
+/*central angle between two points, in radians*/
+static double wl_central_angle(double lat1, double lon1, double lat2, double lon2)
+{
+    double sin_dlat = sin((lat2 - lat1) * (WL_DEG_TO_RAD / 2));
+    double sin_dlon = sin((lon2 - lon1) * (WL_DEG_TO_RAD / 2));
+    double a = sin_dlat * sin_dlat +
+               cos(lat1 * WL_DEG_TO_RAD) * cos(lat2 * WL_DEG_TO_RAD) * sin_dlon * sin_dlon;
+
+    if (a > 1.0)
+        a = 1.0;
+    return 2 * asin(sqrt(a));
+}
+
+double wl_fix_columns_track_length_scalar(const double *latitude, const double *longitude, int count)
+{
+    double total = 0;
+    int i;
+
+    for (i = 0; i + 1 < count; i++)
+        total += wl_central_angle(latitude[i], longitude[i], latitude[i + 1], longitude[i + 1]);
+    return total * WL_EARTH_RADIUS_M;
+}
+
+#if defined(__GNUC__)
+/*
+ * Two pairs per step in GCC vector types, which become SSE2 on x86 and
+ * NEON on arm64. sin, cos and asin are Taylor polynomials, exact to double
+ * precision inside |x| <= pi/2 and, for asin, x <= 0.1.
+ */
+typedef double WlV2df __attribute__((vector_size(16)));
+
+#define WL_V2(c) ((WlV2df){ (c), (c) })
+
+static inline WlV2df wl_v2_sin(WlV2df x)
+{
+    WlV2df x2 = x * x;
+    WlV2df p = WL_V2(-1.0 / 121645100408832000.0);
+
+    p = p * x2 + WL_V2(1.0 / 355687428096000.0);
+    p = p * x2 + WL_V2(-1.0 / 1307674368000.0);
+    p = p * x2 + WL_V2(1.0 / 6227020800.0);
+    p = p * x2 + WL_V2(-1.0 / 39916800.0);
+    p = p * x2 + WL_V2(1.0 / 362880.0);
+    p = p * x2 + WL_V2(-1.0 / 5040.0);
+    p = p * x2 + WL_V2(1.0 / 120.0);
+    p = p * x2 + WL_V2(-1.0 / 6.0);
+    return x + x * x2 * p;
+}
+
+static inline WlV2df wl_v2_cos(WlV2df x)
+{
+    WlV2df x2 = x * x;
+    WlV2df p = WL_V2(1.0 / 2432902008176640000.0);
+
+    p = p * x2 + WL_V2(-1.0 / 6402373705728000.0);
+    p = p * x2 + WL_V2(1.0 / 20922789888000.0);
+    p = p * x2 + WL_V2(-1.0 / 87178291200.0);
+    p = p * x2 + WL_V2(1.0 / 479001600.0);
+    p = p * x2 + WL_V2(-1.0 / 3628800.0);
+    p = p * x2 + WL_V2(1.0 / 40320.0);
+    p = p * x2 + WL_V2(-1.0 / 720.0);
+    p = p * x2 + WL_V2(1.0 / 24.0);
+    p = p * x2 + WL_V2(-1.0 / 2.0);
+    return WL_V2(1.0) + x2 * p;
+}
+
+static inline WlV2df wl_v2_asin(WlV2df x)
+{
+    WlV2df x2 = x * x;
+    WlV2df p = WL_V2(6435.0 / 557056.0);
+
+    p = p * x2 + WL_V2(143.0 / 10240.0);
+    p = p * x2 + WL_V2(231.0 / 13312.0);
+    p = p * x2 + WL_V2(63.0 / 2816.0);
+    p = p * x2 + WL_V2(35.0 / 1152.0);
+    p = p * x2 + WL_V2(5.0 / 112.0);
+    p = p * x2 + WL_V2(3.0 / 40.0);
+    p = p * x2 + WL_V2(1.0 / 6.0);
+    return x + x * x2 * p;
+}
+
+double wl_fix_columns_track_length(const double *latitude, const double *longitude, int count)
+{
+    WlV2df sum = WL_V2(0.0);
+    double total;
+    int i = 0;
+
+    for (; i + 2 < count; i += 2)
+    {
+        WlV2df lat1 = { latitude[i], latitude[i + 1] };
+        WlV2df lat2 = { latitude[i + 1], latitude[i + 2] };
+        WlV2df dlon = { longitude[i + 1] - longitude[i], longitude[i + 2] - longitude[i + 1] };
+        WlV2df sin_dlat = wl_v2_sin((lat2 - lat1) * WL_V2(WL_DEG_TO_RAD / 2));
+        WlV2df sin_dlon = wl_v2_sin(dlon * WL_V2(WL_DEG_TO_RAD / 2));
+        WlV2df a = sin_dlat * sin_dlat +
+                   wl_v2_cos(lat1 * WL_V2(WL_DEG_TO_RAD)) * wl_v2_cos(lat2 * WL_V2(WL_DEG_TO_RAD)) *
+                   sin_dlon * sin_dlon;
+        WlV2df h = { sqrt(a[0]), sqrt(a[1]) };
+        WlV2df angle = WL_V2(2.0) * wl_v2_asin(h);
+
+        /*antimeridian crossings and jumps over ~1200 km*/
+        if ((fabs(dlon[0]) > WL_FAST_MAX_DLON) || (h[0] > WL_FAST_MAX_HALF_CHORD))
+            angle[0] = wl_central_angle(latitude[i], longitude[i], latitude[i + 1], longitude[i + 1]);
+        if ((fabs(dlon[1]) > WL_FAST_MAX_DLON) || (h[1] > WL_FAST_MAX_HALF_CHORD))
+            angle[1] = wl_central_angle(latitude[i + 1], longitude[i + 1], latitude[i + 2], longitude[i + 2]);
+        sum += angle;
+    }
+
+    total = sum[0] + sum[1];
+    for (; i + 1 < count; i++)
+        total += wl_central_angle(latitude[i], longitude[i], latitude[i + 1], longitude[i + 1]);
+    return total * WL_EARTH_RADIUS_M;
+}
+#else
+double wl_fix_columns_track_length(const double *latitude, const double *longitude, int count)
+{
+    return wl_fix_columns_track_length_scalar(latitude, longitude, count);
+}
+#endif
+
+static inline int wl_snr_bin(float snr)
+{
+    /*written so NaN lands in bin 0*/
+    if (!(snr > 0))
+        return 0;
+    if (snr >= WL_SNR_HISTOGRAM_BINS - 1)
+        return WL_SNR_HISTOGRAM_BINS - 1;
+    return (int)snr;
+}
+
+void wl_fix_columns_snr_histogram_scalar(const float *snr, int count,
+            uint32_t hist[WL_SNR_HISTOGRAM_BINS])
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        hist[wl_snr_bin(snr[i])]++;
+}
+
+#if defined(__GNUC__)
+typedef float WlV4sf __attribute__((vector_size(16)));
+typedef int32_t WlV4si __attribute__((vector_size(16)));
+
+/*
+ * Four lanes are clamped at once and counted into four private histograms,
+ * so back to back samples in the same bin don't wait on each other's store.
+ */
+void wl_fix_columns_snr_histogram(const float *snr, int count, uint32_t hist[WL_SNR_HISTOGRAM_BINS])
+{
+    uint32_t lanes[4][WL_SNR_HISTOGRAM_BINS];
+    const WlV4sf lo = { 0, 0, 0, 0 };
+    const WlV4sf hi = { WL_SNR_HISTOGRAM_BINS - 1, WL_SNR_HISTOGRAM_BINS - 1,
+                        WL_SNR_HISTOGRAM_BINS - 1, WL_SNR_HISTOGRAM_BINS - 1 };
+    int i = 0;
+    int bin;
+
+    memset(lanes, 0, sizeof(lanes));
+    for (; i + 4 <= count; i += 4)
+    {
+        WlV4sf v;
+        WlV4si above, below;
+
+        memcpy(&v, &snr[i], sizeof(v));
+        /*all ones where out of range, NaN compares false both ways*/
+        above = (v >= hi);
+        below = ~(v > lo);
+        v = (WlV4sf)(((WlV4si)v & ~above & ~below) | ((WlV4si)hi & above));
+
+        lanes[0][(int)v[0]]++;
+        lanes[1][(int)v[1]]++;
+        lanes[2][(int)v[2]]++;
+        lanes[3][(int)v[3]]++;
+    }
+    for (; i < count; i++)
+        lanes[0][wl_snr_bin(snr[i])]++;
+
+    for (bin = 0; bin < WL_SNR_HISTOGRAM_BINS; bin++)
+        hist[bin] += lanes[0][bin] + lanes[1][bin] + lanes[2][bin] + lanes[3][bin];
+}
+#else
+void wl_fix_columns_snr_histogram(const float *snr, int count, uint32_t hist[WL_SNR_HISTOGRAM_BINS])
+{
+    wl_fix_columns_snr_histogram_scalar(snr, count, hist);
+}
+#endif
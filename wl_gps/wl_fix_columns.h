@@ -0,0 +1,66 @@
+#ifndef WL_FIX_COLUMNS_H
+#define WL_FIX_COLUMNS_H
+
+#include <stdint.h>
+
+#include "wl_nmea.h"
+
+#define WL_SNR_HISTOGRAM_BINS (64)
+
+/*
+ * Fixes and satellites reported by wl_parse_nmea_line, stored column by
+ * column so analytics can stream through one field at a time. Every column
+ * is 64-byte aligned and grows on demand.
+ */
+typedef struct
+{
+    int m_count;
+    int m_cap;
+    int64_t *m_timestamp;
+    double *m_latitude;
+    double *m_longitude;
+    double *m_altitude;
+    float *m_speed;
+    float *m_bearing;
+
+    /*one row per satellite of every SV status report*/
+    int m_sv_count;
+    int m_sv_cap;
+    /*fix count when the report came in, i.e. the next fix's index*/
+    int32_t *m_sv_epoch;
+    int32_t *m_prn;
+    float *m_snr;
+    float *m_elevation;
+    float *m_azimuth;
+} FixColumns;
+
+void wl_fix_columns_init(FixColumns *columns);
+void wl_fix_columns_free(FixColumns *columns);
+
+/*
+ * Points the parser's location and SV status reports at columns.
+ * nmea_cb is left untouched.
+ */
+void wl_fix_columns_set_callbacks(FixColumns *columns, NmeaParseCallbacks *callbacks);
+
+int wl_fix_columns_add_location(FixColumns *columns, const GpsLocation *location);
+int wl_fix_columns_add_sv_status(FixColumns *columns, const GpsSvStatus *sv_status);
+
+/*great-circle length in meters of the track through count fixes*/
+double wl_fix_columns_track_length(const double *latitude, const double *longitude, int count);
+
+/*
+ * Adds count SNR values to hist, one bin per dB-Hz. Negative values land in
+ * the first bin, values past the end in the last one.
+ */
+void wl_fix_columns_snr_histogram(const float *snr, int count, uint32_t hist[WL_SNR_HISTOGRAM_BINS]);
+
+/*
+ * Both of the above one pair or one value at a time with libm, the reference
+ * the vector versions are checked against (tools/wl_fix_columns_bench.c).
+ */
+double wl_fix_columns_track_length_scalar(const double *latitude, const double *longitude, int count);
+void wl_fix_columns_snr_histogram_scalar(const float *snr, int count,
+            uint32_t hist[WL_SNR_HISTOGRAM_BINS]);
+
+#endif
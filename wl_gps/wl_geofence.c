@@ -0,0 +1,590 @@
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "wl_log.h"
+#include "wl_geofence.h"
+
+/*0.02 degree cells are about 2.2km tall, a typical fence covers one to four*/
+#define WL_GEOFENCE_CELL_DEG    (0.02)
+#define WL_GEOFENCE_GRID_ROWS   (9000)
+#define WL_GEOFENCE_GRID_COLS   (18000)
+/*fences spanning more cells than this are checked on every fix instead*/
+#define WL_GEOFENCE_MAX_CELLS   (64)
+#define WL_METERS_PER_DEG       (111195.08)
+#define WL_DEG_TO_RAD           (3.14159265358979323846 / 180.0)
+
+#define WL_HASH_EMPTY           (INT64_MIN)
+
+enum
+{
+    WL_FENCE_UNKNOWN = 0,
+    WL_FENCE_INSIDE,
+    WL_FENCE_OUTSIDE,
+};
+
+static void wl_hash_free(WlHash *hash)
+{
+    free(hash->m_entries);
+    memset(hash, 0, sizeof(*hash));
+}
+
+static unsigned int wl_hash_home(const WlHash *hash, int64_t key)
+{
+    return (unsigned int)(((uint64_t)key * 0x9E3779B97F4A7C15ULL) >> 32) & (hash->m_cap - 1);
+}
+
+static int wl_hash_find(const WlHash *hash, int64_t key)
+{
+    unsigned int i;
+
+    if (hash->m_cap == 0)
+        return -1;
+
+    for (i = wl_hash_home(hash, key); hash->m_entries[i].m_key != WL_HASH_EMPTY; i = (i + 1) & (hash->m_cap - 1))
+    {
+        if (hash->m_entries[i].m_key == key)
+            return hash->m_entries[i].m_value;
+    }
+    return -1;
+}
+
+static int wl_hash_resize(WlHash *hash, int cap)
+{
+    WlHashEntry *old = hash->m_entries;
+    int old_cap = hash->m_cap;
+    int i;
+
+    hash->m_entries = malloc(sizeof(WlHashEntry) * cap);
+    if (hash->m_entries == NULL)
+    {
+        hash->m_entries = old;
+        return -1;
+    }
+    for (i = 0; i < cap; i++)
+        hash->m_entries[i].m_key = WL_HASH_EMPTY;
+    hash->m_cap = cap;
+
+    for (i = 0; i < old_cap; i++)
+    {
+        unsigned int j;
+
+        if (old[i].m_key == WL_HASH_EMPTY)
+            continue;
+        for (j = wl_hash_home(hash, old[i].m_key); hash->m_entries[j].m_key != WL_HASH_EMPTY; j = (j + 1) & (cap - 1))
+            ;
+        hash->m_entries[j] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+/*key must not be in the map yet*/
+static int wl_hash_insert(WlHash *hash, int64_t key, int value)
+{
+    unsigned int i;
+
+    /*stay at most half full so probe runs stay short*/
+    if ((hash->m_count + 1) * 2 > hash->m_cap)
+    {
+        if (wl_hash_resize(hash, hash->m_cap ? hash->m_cap * 2 : 64) < 0)
+            return -1;
+    }
+
+    for (i = wl_hash_home(hash, key); hash->m_entries[i].m_key != WL_HASH_EMPTY; i = (i + 1) & (hash->m_cap - 1))
+        ;
+    hash->m_entries[i].m_key = key;
+    hash->m_entries[i].m_value = value;
+    hash->m_count++;
+    return 0;
+}
+
+static void wl_hash_remove(WlHash *hash, int64_t key)
+{
+    unsigned int mask = hash->m_cap - 1;
+    unsigned int i, j;
+
+    if (hash->m_cap == 0)
+        return;
+
+    for (i = wl_hash_home(hash, key); hash->m_entries[i].m_key != key; i = (i + 1) & mask)
+    {
+        if (hash->m_entries[i].m_key == WL_HASH_EMPTY)
+            return;
+    }
+
+    /*pull later members of the probe run back instead of leaving a tombstone*/
+    for (j = (i + 1) & mask; hash->m_entries[j].m_key != WL_HASH_EMPTY; j = (j + 1) & mask)
+    {
+        unsigned int home = wl_hash_home(hash, hash->m_entries[j].m_key);
+
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            hash->m_entries[i] = hash->m_entries[j];
+            i = j;
+        }
+    }
+    hash->m_entries[i].m_key = WL_HASH_EMPTY;
+    hash->m_count--;
+}
+
+static int wl_grow_ints(int **array, int *cap, int need)
+{
+    int *grown;
+    int next;
+
+    if (need <= *cap)
+        return 0;
+
+    next = *cap ? *cap * 2 : 16;
+    while (next < need)
+        next *= 2;
+    grown = realloc(*array, sizeof(int) * next);
+    if (grown == NULL)
+        return -1;
+    *array = grown;
+    *cap = next;
+    return 0;
+}
+
+void wl_geofence_engine_init(WlGeofenceEngine *engine)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->m_free_head = -1;
+}
+
+void wl_geofence_engine_free(WlGeofenceEngine *engine)
+{
+    int i;
+
+    for (i = 0; i < engine->m_cell_count; i++)
+        free(engine->m_cells[i].m_slots);
+    free(engine->m_cells);
+    free(engine->m_fences);
+    free(engine->m_large);
+    free(engine->m_tracked);
+    wl_hash_free(&engine->m_ids);
+    wl_hash_free(&engine->m_cell_index);
+    wl_geofence_engine_init(engine);
+}
+
+static int wl_cell_row(double latitude)
+{
+    int row = (int)floor((latitude + 90.0) / WL_GEOFENCE_CELL_DEG);
+
+    if (row < 0)
+        return 0;
+    if (row >= WL_GEOFENCE_GRID_ROWS)
+        return WL_GEOFENCE_GRID_ROWS - 1;
+    return row;
+}
+
+static int wl_cell_col(double longitude)
+{
+    int col = (int)floor((longitude + 180.0) / WL_GEOFENCE_CELL_DEG) % WL_GEOFENCE_GRID_COLS;
+
+    return (col < 0) ? col + WL_GEOFENCE_GRID_COLS : col;
+}
+
+static int64_t wl_cell_key(int row, int col)
+{
+    return (int64_t)row * WL_GEOFENCE_GRID_COLS + col;
+}
+
+static int wl_fence_cols(const WlGeofence *fence)
+{
+    return (fence->m_cell_x1 - fence->m_cell_x0 + WL_GEOFENCE_GRID_COLS) % WL_GEOFENCE_GRID_COLS + 1;
+}
+
+static int wl_cell_add_slot(WlGeofenceEngine *engine, int64_t key, int slot)
+{
+    WlGeofenceCell *cell;
+    int index = wl_hash_find(&engine->m_cell_index, key);
+
+    if (index < 0)
+    {
+        if (engine->m_cell_count == engine->m_cell_cap)
+        {
+            int cap = engine->m_cell_cap ? engine->m_cell_cap * 2 : 64;
+            WlGeofenceCell *grown = realloc(engine->m_cells, sizeof(WlGeofenceCell) * cap);
+
+            if (grown == NULL)
+                return -1;
+            engine->m_cells = grown;
+            engine->m_cell_cap = cap;
+        }
+        index = engine->m_cell_count;
+        if (wl_hash_insert(&engine->m_cell_index, key, index) < 0)
+            return -1;
+        memset(&engine->m_cells[index], 0, sizeof(WlGeofenceCell));
+        engine->m_cell_count++;
+    }
+
+    cell = &engine->m_cells[index];
+    if (wl_grow_ints(&cell->m_slots, &cell->m_cap, cell->m_count + 1) < 0)
+        return -1;
+    cell->m_slots[cell->m_count++] = slot;
+    return 0;
+}
+
+/*empty cells are kept, a fence coming back to the same area reuses them*/
+static void wl_cell_remove_slot(WlGeofenceEngine *engine, int64_t key, int slot)
+{
+    WlGeofenceCell *cell;
+    int index = wl_hash_find(&engine->m_cell_index, key);
+    int i;
+
+    if (index < 0)
+        return;
+
+    cell = &engine->m_cells[index];
+    for (i = 0; i < cell->m_count; i++)
+    {
+        if (cell->m_slots[i] == slot)
+        {
+            cell->m_slots[i] = cell->m_slots[--cell->m_count];
+            return;
+        }
+    }
+}
+
+static void wl_unlink_fence(WlGeofenceEngine *engine, int slot)
+{
+    WlGeofence *fence = &engine->m_fences[slot];
+    int row, i;
+
+    if (fence->m_large_pos >= 0)
+    {
+        int moved = engine->m_large[--engine->m_large_count];
+
+        engine->m_large[fence->m_large_pos] = moved;
+        engine->m_fences[moved].m_large_pos = fence->m_large_pos;
+        fence->m_large_pos = -1;
+        return;
+    }
+
+    for (row = fence->m_cell_y0; row <= fence->m_cell_y1; row++)
+    {
+        for (i = 0; i < wl_fence_cols(fence); i++)
+            wl_cell_remove_slot(engine, wl_cell_key(row, (fence->m_cell_x0 + i) % WL_GEOFENCE_GRID_COLS), slot);
+    }
+}
+
+/*puts the fence in every cell its bounding box touches, or in the large list*/
+static int wl_link_fence(WlGeofenceEngine *engine, int slot, double radius_meters)
+{
+    WlGeofence *fence = &engine->m_fences[slot];
+    double dlat = radius_meters / WL_METERS_PER_DEG;
+    double lat0 = fence->m_latitude - dlat;
+    double lat1 = fence->m_latitude + dlat;
+    double cos_edge = cos(fmax(fabs(lat0), fabs(lat1)) * WL_DEG_TO_RAD);
+    double dlon;
+    int row, i;
+
+    fence->m_large_pos = -1;
+    if ((lat0 > -90.0) && (lat1 < 90.0) && (cos_edge > 1e-6))
+    {
+        dlon = dlat / cos_edge;
+        fence->m_cell_y0 = wl_cell_row(lat0);
+        fence->m_cell_y1 = wl_cell_row(lat1);
+        fence->m_cell_x0 = wl_cell_col(fence->m_longitude - dlon);
+        fence->m_cell_x1 = wl_cell_col(fence->m_longitude + dlon);
+
+        if ((dlon < 180.0) &&
+            ((fence->m_cell_y1 - fence->m_cell_y0 + 1) * wl_fence_cols(fence) <= WL_GEOFENCE_MAX_CELLS))
+        {
+            for (row = fence->m_cell_y0; row <= fence->m_cell_y1; row++)
+            {
+                for (i = 0; i < wl_fence_cols(fence); i++)
+                {
+                    int64_t key = wl_cell_key(row, (fence->m_cell_x0 + i) % WL_GEOFENCE_GRID_COLS);
+
+                    if (wl_cell_add_slot(engine, key, slot) < 0)
+                    {
+                        /*back out of the cells added so far, removing a missing slot is harmless*/
+                        fence->m_cell_y1 = row;
+                        wl_unlink_fence(engine, slot);
+                        return -1;
+                    }
+                }
+            }
+            return 0;
+        }
+    }
+
+    if (wl_grow_ints(&engine->m_large, &engine->m_large_cap, engine->m_large_count + 1) < 0)
+        return -1;
+    fence->m_large_pos = engine->m_large_count;
+    engine->m_large[engine->m_large_count++] = slot;
+    return 0;
+}
+
+static int wl_track_fence(WlGeofenceEngine *engine, int slot)
+{
+    WlGeofence *fence = &engine->m_fences[slot];
+
+    if (fence->m_tracked_pos >= 0)
+        return 0;
+    if (wl_grow_ints(&engine->m_tracked, &engine->m_tracked_cap, engine->m_tracked_count + 1) < 0)
+        return -1;
+    fence->m_tracked_pos = engine->m_tracked_count;
+    engine->m_tracked[engine->m_tracked_count++] = slot;
+    return 0;
+}
+
+static void wl_untrack_fence(WlGeofenceEngine *engine, int slot)
+{
+    WlGeofence *fence = &engine->m_fences[slot];
+    int moved;
+
+    if (fence->m_tracked_pos < 0)
+        return;
+    moved = engine->m_tracked[--engine->m_tracked_count];
+    engine->m_tracked[fence->m_tracked_pos] = moved;
+    engine->m_fences[moved].m_tracked_pos = fence->m_tracked_pos;
+    fence->m_tracked_pos = -1;
+}
+
+static int wl_find_slot(WlGeofenceEngine *engine, int32_t geofence_id)
+{
+    return wl_hash_find(&engine->m_ids, geofence_id);
+}
+
+static int wl_alloc_slot(WlGeofenceEngine *engine)
+{
+    int slot = engine->m_free_head;
+
+    if (slot >= 0)
+    {
+        engine->m_free_head = engine->m_fences[slot].m_next_free;
+        return slot;
+    }
+
+    if (engine->m_fence_count == engine->m_fence_cap)
+    {
+        int cap = engine->m_fence_cap ? engine->m_fence_cap * 2 : 64;
+        WlGeofence *grown = realloc(engine->m_fences, sizeof(WlGeofence) * cap);
+
+        if (grown == NULL)
+            return -1;
+        engine->m_fences = grown;
+        engine->m_fence_cap = cap;
+    }
+    return engine->m_fence_count++;
+}
+
+static void wl_free_slot(WlGeofenceEngine *engine, int slot)
+{
+    engine->m_fences[slot].m_in_use = 0;
+    engine->m_fences[slot].m_next_free = engine->m_free_head;
+    engine->m_free_head = slot;
+}
+
+int wl_geofence_add(WlGeofenceEngine *engine, int32_t geofence_id, double latitude,
+            double longitude, double radius_meters, int last_transition, int monitor_transitions)
+{
+    WlGeofence *fence;
+    int slot;
+
+    if (monitor_transitions & ~(GPS_GEOFENCE_ENTERED | GPS_GEOFENCE_EXITED | GPS_GEOFENCE_UNCERTAIN))
+        return GPS_GEOFENCE_ERROR_INVALID_TRANSITION;
+    if ((last_transition != GPS_GEOFENCE_ENTERED) && (last_transition != GPS_GEOFENCE_EXITED)
+        && (last_transition != GPS_GEOFENCE_UNCERTAIN))
+        return GPS_GEOFENCE_ERROR_INVALID_TRANSITION;
+    if (!(radius_meters > 0) || !(fabs(latitude) <= 90.0) || !(fabs(longitude) <= 180.0))
+        return GPS_GEOFENCE_ERROR_GENERIC;
+    if (wl_find_slot(engine, geofence_id) >= 0)
+        return GPS_GEOFENCE_ERROR_ID_EXISTS;
+    if (engine->m_ids.m_count >= WL_GEOFENCE_MAX)
+        return GPS_GEOFENCE_ERROR_TOO_MANY_GEOFENCES;
+
+    slot = wl_alloc_slot(engine);
+    if (slot < 0)
+        return GPS_GEOFENCE_ERROR_GENERIC;
+
+    fence = &engine->m_fences[slot];
+    memset(fence, 0, sizeof(*fence));
+    fence->m_id = geofence_id;
+    fence->m_in_use = 1;
+    fence->m_monitor = monitor_transitions;
+    fence->m_latitude = latitude;
+    fence->m_longitude = longitude;
+    fence->m_cos_latitude = cos(latitude * WL_DEG_TO_RAD);
+    fence->m_radius_sq = radius_meters * radius_meters;
+    fence->m_tracked_pos = -1;
+    fence->m_large_pos = -1;
+    if (last_transition == GPS_GEOFENCE_ENTERED)
+        fence->m_state = WL_FENCE_INSIDE;
+    else if (last_transition == GPS_GEOFENCE_EXITED)
+        fence->m_state = WL_FENCE_OUTSIDE;
+    else
+        fence->m_state = WL_FENCE_UNKNOWN;
+
+    if (wl_link_fence(engine, slot, radius_meters) < 0)
+    {
+        wl_free_slot(engine, slot);
+        return GPS_GEOFENCE_ERROR_GENERIC;
+    }
+    if (((fence->m_state != WL_FENCE_OUTSIDE) && (wl_track_fence(engine, slot) < 0))
+        || (wl_hash_insert(&engine->m_ids, geofence_id, slot) < 0))
+    {
+        wl_untrack_fence(engine, slot);
+        wl_unlink_fence(engine, slot);
+        wl_free_slot(engine, slot);
+        return GPS_GEOFENCE_ERROR_GENERIC;
+    }
+    return GPS_GEOFENCE_OPERATION_SUCCESS;
+}
+
+int wl_geofence_remove(WlGeofenceEngine *engine, int32_t geofence_id)
+{
+    int slot = wl_find_slot(engine, geofence_id);
+
+    if (slot < 0)
+        return GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+
+    wl_untrack_fence(engine, slot);
+    wl_unlink_fence(engine, slot);
+    wl_hash_remove(&engine->m_ids, geofence_id);
+    wl_free_slot(engine, slot);
+    return GPS_GEOFENCE_OPERATION_SUCCESS;
+}
+
+int wl_geofence_pause(WlGeofenceEngine *engine, int32_t geofence_id)
+{
+    int slot = wl_find_slot(engine, geofence_id);
+
+    if (slot < 0)
+        return GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+
+    engine->m_fences[slot].m_paused = 1;
+    return GPS_GEOFENCE_OPERATION_SUCCESS;
+}
+
+int wl_geofence_resume(WlGeofenceEngine *engine, int32_t geofence_id, int monitor_transitions)
+{
+    int slot = wl_find_slot(engine, geofence_id);
+
+    if (slot < 0)
+        return GPS_GEOFENCE_ERROR_ID_UNKNOWN;
+    if (monitor_transitions & ~(GPS_GEOFENCE_ENTERED | GPS_GEOFENCE_EXITED | GPS_GEOFENCE_UNCERTAIN))
+        return GPS_GEOFENCE_ERROR_INVALID_TRANSITION;
+
+    engine->m_fences[slot].m_paused = 0;
+    engine->m_fences[slot].m_monitor = monitor_transitions;
+    return GPS_GEOFENCE_OPERATION_SUCCESS;
+}
+
+static void wl_set_fence_state(WlGeofenceEngine *engine, int slot, unsigned char state,
+            GpsLocation *location, wl_geofence_report report, void *user)
+{
+    WlGeofence *fence = &engine->m_fences[slot];
+    int32_t transition;
+
+    if (fence->m_state == state)
+        return;
+
+    fence->m_state = state;
+    if (state == WL_FENCE_OUTSIDE)
+    {
+        wl_untrack_fence(engine, slot);
+        transition = GPS_GEOFENCE_EXITED;
+    }
+    else
+    {
+        /*an untracked fence would miss its exit, better to check it once too often*/
+        if (wl_track_fence(engine, slot) < 0)
+            LOGE("[wl_set_fence_state]:cannot track geofence %d", fence->m_id);
+        transition = (state == WL_FENCE_INSIDE) ? GPS_GEOFENCE_ENTERED : GPS_GEOFENCE_UNCERTAIN;
+    }
+
+    if (fence->m_monitor & transition)
+        report(user, fence->m_id, location, transition);
+}
+
+/*
+ * Flat-earth distance around the fence center; good to well under a meter
+ * for any fence small enough to live in the grid.
+ */
+static void wl_test_fence(WlGeofenceEngine *engine, int slot, GpsLocation *location,
+            wl_geofence_report report, void *user)
+{
+    WlGeofence *fence = &engine->m_fences[slot];
+    double dlon, dx, dy;
+
+    if (fence->m_seen == engine->m_epoch)
+        return;
+    fence->m_seen = engine->m_epoch;
+    if (fence->m_paused)
+        return;
+
+    engine->m_last_tested++;
+    dlon = location->longitude - fence->m_longitude;
+    if (dlon > 180.0)
+        dlon -= 360.0;
+    else if (dlon < -180.0)
+        dlon += 360.0;
+    dx = dlon * WL_METERS_PER_DEG * fence->m_cos_latitude;
+    dy = (location->latitude - fence->m_latitude) * WL_METERS_PER_DEG;
+
+    wl_set_fence_state(engine, slot, (dx * dx + dy * dy <= fence->m_radius_sq) ? WL_FENCE_INSIDE : WL_FENCE_OUTSIDE,
+        location, report, user);
+}
+
+void wl_geofence_check_fix(WlGeofenceEngine *engine, GpsLocation *location,
+            wl_geofence_report report, void *user)
+{
+    int index, i;
+
+    engine->m_last_tested = 0;
+    if (++engine->m_epoch == 0)
+    {
+        /*wrapped, forget every stale mark*/
+        for (i = 0; i < engine->m_fence_count; i++)
+            engine->m_fences[i].m_seen = 0;
+        engine->m_epoch = 1;
+    }
+
+    index = wl_hash_find(&engine->m_cell_index,
+        wl_cell_key(wl_cell_row(location->latitude), wl_cell_col(location->longitude)));
+    if (index >= 0)
+    {
+        WlGeofenceCell *cell = &engine->m_cells[index];
+
+        for (i = 0; i < cell->m_count; i++)
+            wl_test_fence(engine, cell->m_slots[i], location, report, user);
+    }
+
+    for (i = 0; i < engine->m_large_count; i++)
+        wl_test_fence(engine, engine->m_large[i], location, report, user);
+
+    /*
+     * Whatever is still tracked and was not in the fix's cell has the fix
+     * outside its bounding box. Walk backwards, leaving swaps in the part
+     * already done.
+     */
+    for (i = engine->m_tracked_count - 1; i >= 0; i--)
+    {
+        int slot = engine->m_tracked[i];
+        WlGeofence *fence = &engine->m_fences[slot];
+
+        if ((fence->m_seen == engine->m_epoch) || fence->m_paused)
+            continue;
+        fence->m_seen = engine->m_epoch;
+        wl_set_fence_state(engine, slot, WL_FENCE_OUTSIDE, location, report, user);
+    }
+}
+
+void wl_geofence_fix_lost(WlGeofenceEngine *engine, GpsLocation *last_location,
+            wl_geofence_report report, void *user)
+{
+    int slot;
+
+    for (slot = 0; slot < engine->m_fence_count; slot++)
+    {
+        WlGeofence *fence = &engine->m_fences[slot];
+
+        if (fence->m_in_use && !fence->m_paused)
+            wl_set_fence_state(engine, slot, WL_FENCE_UNKNOWN, last_location, report, user);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef WL_GEOFENCE_H
+#define WL_GEOFENCE_H
+
+#include <stdint.h>
+#include <hardware/gps.h>
+
+/*most fences one engine accepts before GPS_GEOFENCE_ERROR_TOO_MANY_GEOFENCES*/
+#define WL_GEOFENCE_MAX (65536)
+
+typedef struct
+{
+    int64_t m_key;
+    int m_value;
+} WlHashEntry;
+
+/*open addressing map from a 64-bit key to an int, m_cap is a power of two*/
+typedef struct
+{
+    WlHashEntry *m_entries;
+    int m_cap;
+    int m_count;
+} WlHash;
+
+typedef struct
+{
+    int *m_slots;
+    int m_count;
+    int m_cap;
+} WlGeofenceCell;
+
+typedef struct
+{
+    int32_t m_id;
+    unsigned char m_in_use;
+    unsigned char m_paused;
+    unsigned char m_state;
+    int m_monitor;
+    double m_latitude;
+    double m_longitude;
+    double m_cos_latitude;
+    double m_radius_sq;
+    /*grid cells covering the fence, or m_large_pos in the always-checked list*/
+    int m_cell_y0;
+    int m_cell_y1;
+    int m_cell_x0;
+    int m_cell_x1;
+    int m_large_pos;
+    /*position in the tracked list, -1 when the fence is known to be outside*/
+    int m_tracked_pos;
+    unsigned int m_seen;
+    /*next free slot while m_in_use is 0*/
+    int m_next_free;
+} WlGeofence;
+
+/*
+ * Circular fences bucketed into a uniform lat/lon grid. A fix is only tested
+ * against the fences of its own cell, the few fences too big for the grid
+ * and the fences it was not known to be outside of. The engine does no
+ * locking of its own.
+ */
+typedef struct
+{
+    WlGeofence *m_fences;
+    int m_fence_count;
+    int m_fence_cap;
+    int m_free_head;
+    WlHash m_ids;
+    WlHash m_cell_index;
+    WlGeofenceCell *m_cells;
+    int m_cell_count;
+    int m_cell_cap;
+    int *m_large;
+    int m_large_count;
+    int m_large_cap;
+    int *m_tracked;
+    int m_tracked_count;
+    int m_tracked_cap;
+    unsigned int m_epoch;
+    /*fences tested by the last wl_geofence_check_fix*/
+    int m_last_tested;
+} WlGeofenceEngine;
+
+typedef void (*wl_geofence_report)(void *user, int32_t geofence_id, GpsLocation *location,
+            int32_t transition);
+
+void wl_geofence_engine_init(WlGeofenceEngine *engine);
+void wl_geofence_engine_free(WlGeofenceEngine *engine);
+
+/*the following return GPS_GEOFENCE_OPERATION_SUCCESS or a GPS_GEOFENCE_ERROR_* code*/
+int wl_geofence_add(WlGeofenceEngine *engine, int32_t geofence_id, double latitude,
+            double longitude, double radius_meters, int last_transition, int monitor_transitions);
+int wl_geofence_remove(WlGeofenceEngine *engine, int32_t geofence_id);
+int wl_geofence_pause(WlGeofenceEngine *engine, int32_t geofence_id);
+int wl_geofence_resume(WlGeofenceEngine *engine, int32_t geofence_id, int monitor_transitions);
+
+/*reports every monitored transition the fix causes*/
+void wl_geofence_check_fix(WlGeofenceEngine *engine, GpsLocation *location,
+            wl_geofence_report report, void *user);
+
+/*
+ * No more fixes are coming for now; every fence goes uncertain and the next
+ * fix decides again.
+ */
+void wl_geofence_fix_lost(WlGeofenceEngine *engine, GpsLocation *last_location,
+            wl_geofence_report report, void *user);
+
+#endif
@@ -1,10 +1,20 @@
 #include <errno.h>
 #include <pthread.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sched.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <math.h>
 #include <time.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/serial.h>
 #include <linux/socket.h>
 #include <linux/un.h>
 #include <hardware/gps.h>
@@ -14,21 +24,109 @@
 #include <stdlib.h>
 
 #include "wl_log.h"
+#include "wl_nmea.h"
+#include "wl_geofence.h"
+#include "wl_uring.h"
+#include "wl_trace.h"
+#include "wl_history.h"
+#include "wl_subscription.h"
+#include "wl_wakeups.h"
+#include "wl_rx_stats.h"
 
 #define DRIVER_VERSION "WELINK_GPS_V1.0.0B01"
+/*host test builds point this at a file of their own*/
+#ifndef NMEA_PORT_PATH_CONFIG
 #define NMEA_PORT_PATH_CONFIG "/etc/NMEAPORT"
+#endif
+/*receive buffer and longest line by default, RX_BUFFER and MAX_LINE override*/
 #define LEN_GPS_BUF (1024)
 #define LEN_GPS_INFO (128)
-#define  MAX_NMEA_INFO_SEG  (20)
+/*what HIGH_RATE=1 starts from, sized for 20Hz multi-GNSS at 921600 baud*/
+#define WL_HIGH_RATE_BUF (16384)
+#define WL_HIGH_RATE_LINE (4096)
+#define WL_HIGH_RATE_BAUD (921600)
+#define WL_DEFAULT_BAUD (115200)
+#define WL_MAX_RX_BUFFER (1024 * 1024)
+/*NMEA 0183 allows 82, anything shorter would drop standard sentences*/
+#define WL_MIN_LINE (82)
+/*READ_MODE=THROUGHPUT lets this much of a burst build up before reading it*/
+#define WL_THROUGHPUT_BATCH_MS (10)
+/*READ_BACKEND=IO_URING: SQ entries, and how long stopping waits for the ring*/
+#define WL_URING_ENTRIES (8)
+#define WL_URING_DRAIN_MS (500)
+#define WL_NMEA_BATCH_BYTES (8192)
+#define WL_NMEA_BATCH_LINES (128)
+/*reads whose arrival time the receive buffer remembers, for STALE_MS*/
+#define WL_RX_ARRIVALS (64)
+/*epochs the delivery thread may fall behind by before new ones are dropped*/
+#define WL_NMEA_QUEUE_LEN (4)
+#define WL_CONFIG_PORT_LEN (64)
+/*ADAPTIVE_RATE defaults, and the still fixes in a row it slows down after*/
+#define WL_ADAPTIVE_IDLE_S (5)
+#define WL_ADAPTIVE_STILL_SPEED (0.5)
+#define WL_ADAPTIVE_STILL_RADIUS (10.0)
+#define WL_ADAPTIVE_TURN (15.0)
+#define WL_ADAPTIVE_STILL_FIXES (5)
+/*weight of the newest fix in the motion's running mean and variance*/
+#define WL_MOTION_ALPHA (0.25)
+/*flat-earth distances for the delivery filter*/
+#define WL_METERS_PER_DEG (111195.08)
+#define WL_DEG_TO_RAD (3.14159265358979323846 / 180.0)
+#define WL_CACHELINE_SIZE (64)
+#define WL_CACHELINE_ALIGNED __attribute__((aligned(WL_CACHELINE_SIZE)))
 
 #define ATCMD_ZGINIT (1)
 #define ATCMD_ZGMODE_3 (2)
-#define ATCMD_ZGNMEA_31 (3)
+/*AT+ZGNMEA=<WL_NMEA_* types>, built by wl_send_nmea_types*/
+#define ATCMD_ZGNMEA (3)
 #define ATCMD_ZGNMEA_0 (4)
 #define ATCMD_ZGRUN_0 (5)
 #define ATCMD_ZGRUN_2 (6)
 #define ATCMD_ZGFIXRATE_65535 (7)
 #define ATCMD_ZGFIXRATE_1 (8)
+/*one chunk of XTRA data, the line is built by the injector*/
+#define ATCMD_ZGXTRA (9)
+/*AT+ZGFIXRATE=65535,<seconds>, built by wl_send_fix_rate*/
+#define ATCMD_ZGFIXRATE (10)
+
+/*receiver settings the HAL tracks, each ATCMD_* above sets one of them*/
+enum
+{
+    WL_RX_INIT = 0,
+    WL_RX_MODE,
+    WL_RX_FIXRATE,
+    WL_RX_NMEA,
+    WL_RX_RUN,
+    WL_RX_SETTING_COUNT
+};
+/*not acknowledged since the port was opened, the command has to go out*/
+#define WL_RX_UNKNOWN (-1)
+/*WL_RX_FIXRATE is the interval of continuous fixes in seconds, or this*/
+#define WL_FIXRATE_SINGLE (-2)
+
+/*how long cleanup waits for the HAL threads before giving up on them*/
+#define WL_THREAD_EXIT_TIMEOUT_MS (1000)
+#define WL_PORT_REOPEN_DELAY_MS (2000)
+/*the old code gave the receiver 30 polls of 200ms to answer*/
+#define WL_ATCMD_TIMEOUT_MS (6000)
+/*a settings thread's AT command may wait its turn and then its answer*/
+#define WL_RX_SETTING_EXIT_TIMEOUT_MS (2 * WL_ATCMD_TIMEOUT_MS + 1000)
+/*XTRA bytes per AT+ZGXTRA line, sent hex encoded*/
+#define WL_XTRA_CHUNK_SIZE (256)
+/*longest AT line, an AT+ZGXTRA chunk*/
+#define WL_AT_LINE_LEN (48 + WL_XTRA_CHUNK_SIZE * 2)
+
+/*what each operation queued on the reader's ring is tagged with*/
+enum
+{
+    WL_URING_PORT_READ = 1,
+    WL_URING_PORT_POLL,
+    WL_URING_PORT_BATCH,
+    WL_URING_WAKEUP,
+    WL_URING_AT_WRITE,
+    WL_URING_CANCEL,
+    WL_URING_DRAIN,
+};
 
 //
 static int wl_gps_init(GpsCallbacks* callbacks);
@@ -45,57 +143,416 @@ static int wl_open_gps(const struct hw_module_t* module, char const* name,
         struct hw_device_t** device);
 static int wl_gps_xtra_init(GpsXtraCallbacks* callbacks);
 static int wl_gps_xtra_inject_xtra_data(char* data, int length);
+static void wl_gps_geofence_init(GpsGeofenceCallbacks* callbacks);
+static void wl_gps_add_geofence_area(int32_t geofence_id, double latitude, double longitude,
+            double radius_meters, int last_transition, int monitor_transitions,
+            int notification_responsiveness_ms, int unknown_timer_ms);
+static void wl_gps_pause_geofence(int32_t geofence_id);
+static void wl_gps_resume_geofence(int32_t geofence_id, int monitor_transitions);
+static void wl_gps_remove_geofence_area(int32_t geofence_id);
+static int wl_gps_history_get_range(GpsUtcTime from, GpsUtcTime to, GpsUtcTime step,
+            GpsLocation *out, int max);
+static int wl_gps_history_get_last(GpsLocation *out, int max);
+static int wl_gps_history_get_span(GpsUtcTime *oldest, GpsUtcTime *newest);
+static void wl_gps_set_sv_status_wanted(int wanted);
+static void wl_gps_set_nmea_wanted(unsigned int types);
+static void wl_gps_get_wakeups(WlGpsWakeups *wakeups);
+static void wl_gps_get_rx_stats(WlGpsRxStats *stats);
 static void wl_read_port_thread(void *param);
-
-
+static void wl_xtra_inject_thread(void *param);
+static void wl_deliver_thread(void *param);
+static void wl_rx_setting_thread(void *param);
+static void wl_wake_thread(int evt_fd);
+static int64_t wl_now_ns(void);
+
+
+/*
+ * Bytes read from the port, m_size long plus a NUL. Bytes before m_start
+ * went through the buffer thread's NMEA stream; the reader moves the rest to
+ * the front when it runs out of room.
+ */
 typedef struct
 {
     int len;
-    char m_buf[LEN_GPS_BUF+1];
+    int m_start;
+    int m_size;
+    char *m_buf;
 } gps_info_buf;
 
-typedef struct 
+/*one read into the receive buffer: where it ended in the byte stream, and when*/
+typedef struct
 {
-    const char * m_beg;
-    const char * m_end;
-} Charseg;
+    uint32_t m_end;
+    int64_t m_ns;
+} WlRxArrival;
 
-typedef struct 
+/*the forwarded sentences of one epoch, each NUL terminated, back to back*/
+typedef struct
 {
+    GpsUtcTime m_timestamp;
     int m_count;
-    Charseg m_segs[ MAX_NMEA_INFO_SEG ];
-} NmeaInfoSegs;
+    int m_used;
+    short m_len[WL_NMEA_BATCH_LINES];
+    char m_data[WL_NMEA_BATCH_BYTES];
+} WlNmeaBatch;
 
-typedef struct
+/*the HAL threads READER_SCHED, PARSER_SCHED and DELIVER_SCHED apply to*/
+enum
 {
-    int m_year;
-    int m_month;
-    int m_day;
-    int m_sub;
-} UtcInfo;
+    WL_THREAD_READER = 0,
+    WL_THREAD_PARSER,
+    WL_THREAD_DELIVER,
+    WL_THREAD_POLICY_COUNT
+};
 
 typedef struct
 {
+    /*m_policy is only applied when set, the thread keeps what it inherited otherwise*/
+    unsigned char m_sched_set;
+    /*SCHED_FIFO or SCHED_RR at m_priority, or SCHED_OTHER at m_nice*/
+    int m_policy;
+    int m_priority;
+    int m_nice;
+    /*bit n for CPU n, 0 leaves the affinity alone*/
+    uint64_t m_cpus;
+} WlThreadPolicy;
+
+/*
+ * Wakeup to run time of a thread, from the moment another thread rang its
+ * eventfd until it returned from the wait.
+ */
+typedef struct
+{
+    uint64_t m_total_us;
     unsigned int m_count;
-    int m_number[32];
-} UsingSatellitesInfo;
-
-static gps_info_buf *g_gps_info_buf = NULL;
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static int g_nmea_fd = -1;
-static GpsCallbacks *p_java_layer_callback = NULL;
-static GpsXtraCallbacks* p_java_layer_xtra_callbacks = NULL;
-static unsigned char g_is_internal_initialized = 0;
-static GpsStatusValue g_cur_gps_status = GPS_STATUS_NONE;
-static pthread_t g_read_port_thread;
-static pthread_t g_read_buff_thread;
-static pthread_t g_test;
-static unsigned char g_need_reading_nmea = 0;
-static UtcInfo g_utc_info;
-static UsingSatellitesInfo g_satellites_info;
-static unsigned char g_sv_status_flag = 0;
-static GpsSvStatus g_sv_status_info;
-static unsigned char g_cur_atcmd = 0;
+    unsigned int m_max_us;
+} WlWakeLatency;
+
+/*what NMEA_PORT_PATH_CONFIG says, one KEY=VALUE per line*/
+typedef struct
+{
+    char m_nmea_port[WL_CONFIG_PORT_LEN];
+    /*NMEA_FORWARD, the WL_NMEA_* types handed to nmea_cb*/
+    unsigned int m_nmea_forward;
+    /*HIGH_RATE=1 changes the defaults of the three below*/
+    unsigned char m_high_rate;
+    /*BAUD_RATE*/
+    int m_baud_rate;
+    /*RX_BUFFER, bytes read ahead of the parser*/
+    int m_rx_buffer;
+    /*MAX_LINE, longer lines are dropped whole*/
+    int m_max_line;
+    /*
+     * READ_MODE=LATENCY reads bytes as soon as they arrive. THROUGHPUT waits
+     * READ_BATCH_MS after the port turns readable so one read takes the whole
+     * burst, at that much extra latency. VMIN and VTIME go to termios as
+     * they are; recent kernels hand tty reads over in 64 byte pieces, which
+     * caps what a big VMIN can batch.
+     */
+    unsigned char m_read_throughput;
+    int m_read_batch_ms;
+    int m_vmin;
+    int m_vtime;
+    /*LOW_LATENCY=1 asks the UART driver for ASYNC_LOW_LATENCY*/
+    unsigned char m_low_latency;
+    /*
+     * READ_BACKEND=IO_URING keeps a read queued on the port all the time and
+     * sends AT commands on the same ring, one syscall per read instead of a
+     * poll and a read. Falls back to POLL when the kernel has no io_uring.
+     */
+    unsigned char m_io_uring;
+    /*TRACE_FILE, where wl_gps_stop dumps the spans of a WL_GPS_TRACE build*/
+    char m_trace_file[WL_CONFIG_PORT_LEN];
+    /*
+     * Delivery filter, on when any of these is set. A fix only goes to
+     * location_cb when it is FILTER_DISTANCE meters from the last one that
+     * did, turned FILTER_BEARING degrees, changed speed by FILTER_SPEED m/s,
+     * or FILTER_HEARTBEAT_MS passed since. Geofences still see every fix.
+     */
+    unsigned char m_filter;
+    double m_filter_distance;
+    double m_filter_bearing;
+    double m_filter_speed;
+    int m_filter_heartbeat_ms;
+    /*
+     * <THREAD>_SCHED is FIFO:<priority>, RR:<priority>, NICE:<nice> or OTHER
+     * and <THREAD>_CPUS a list like 0,2-3, for READER, PARSER and DELIVER.
+     * MLOCK=1 locks the context and the buffers those threads touch. All of
+     * it needs CAP_SYS_NICE or CAP_IPC_LOCK, what the kernel refuses is
+     * logged and left as it was.
+     */
+    WlThreadPolicy m_thread_policy[WL_THREAD_POLICY_COUNT];
+    unsigned char m_mlock;
+    /*
+     * STALE_MS, 0 for off. An epoch whose first line sits in the receive
+     * buffer with bytes at least this much younger already behind it is
+     * shed: forwarded to nmea_cb as it is but not decoded, so a parser that
+     * fell behind goes straight to the freshest fix.
+     */
+    int m_stale_ms;
+    /*
+     * ADAPTIVE_RATE=1 slows the receiver to a fix every ADAPTIVE_IDLE_S
+     * seconds once it has been still for a few fixes: slower than
+     * ADAPTIVE_STILL_SPEED m/s and wandering less than ADAPTIVE_STILL_RADIUS
+     * meters. The first fix that moves, or turns ADAPTIVE_TURN degrees, goes
+     * back to the rate the session asked for; never faster than that.
+     */
+    unsigned char m_adaptive_rate;
+    int m_adaptive_idle_s;
+    double m_adaptive_still_speed;
+    double m_adaptive_still_radius;
+    double m_adaptive_turn;
+    /*HISTORY_LEN, fixes kept for WL_GPS_HISTORY_INTERFACE, 86400 is a day at 1Hz*/
+    int m_history_len;
+} WlGpsConfig;
+
+/*
+ * All runtime state of one receiver. Fields are grouped by the thread that
+ * writes them and every group starts on its own cache line, so the reader
+ * and the parser never write to a line they do not share on purpose.
+ */
+typedef struct
+{
+    /*written by init/start/stop/cleanup, read by every thread*/
+    GpsCallbacks *m_callbacks;
+    GpsXtraCallbacks *m_xtra_callbacks;
+    unsigned char m_is_internal_initialized;
+    volatile unsigned char m_need_reading_nmea;
+    GpsStatusValue m_cur_gps_status;
+    /*set by start, the delivery filter passes the session's first fix*/
+    volatile unsigned char m_filter_restart;
+    /*
+     * From set_position_mode: seconds between fixes, 0 for as fast as the
+     * receiver goes, and whether only one fix is wanted. Start sets
+     * m_rate_restart for the adaptive rate to begin over.
+     */
+    int m_session_interval_s;
+    unsigned char m_session_single;
+    volatile unsigned char m_rate_restart;
+    /*
+     * AT command in flight, cleared by the buffer thread when "OK" or "ERROR"
+     * comes back; m_atcmd_error tells which.
+     */
+    volatile unsigned char m_cur_atcmd;
+    unsigned char m_atcmd_error;
+    pthread_mutex_t m_atcmd_mutex;
+    pthread_cond_t m_atcmd_cond;
+    /*
+     * What the receiver last answered "OK" to, guarded by m_atcmd_mutex. A
+     * command that would set what is already there is not sent. Opening the
+     * port forgets it all and bumps m_rx_epoch, so an answer to a command
+     * sent before that is not recorded.
+     */
+    int m_rx_state[WL_RX_SETTING_COUNT];
+    unsigned int m_rx_epoch;
+    unsigned int m_atcmds_sent;
+    unsigned int m_atcmds_skipped;
+    /*
+     * The reader's ring takes AT writes while m_uring_active. The line is
+     * copied to m_at_write_buf, which stays busy until the write completes
+     * even if the sender has given up on the answer by then.
+     */
+    unsigned char m_uring_active;
+    unsigned char m_at_write_busy;
+    int m_at_write_len;
+    char m_at_write_buf[WL_AT_LINE_LEN];
+    pthread_t m_read_port_thread;
+    pthread_t m_read_buff_thread;
+    pthread_t m_deliver_thread;
+    /*
+     * Each HAL thread sleeps on its own eventfd; the reader rings the buffer
+     * thread when bytes arrive, the buffer thread rings the reader when it frees
+     * room in a full buffer and the delivery thread when it has news for the
+     * framework, and cleanup rings all of them.
+     */
+    int m_read_port_evt;
+    int m_read_buff_evt;
+    int m_deliver_evt;
+    /*number of HAL threads created and not yet returned*/
+    int m_thread_count;
+    pthread_mutex_t m_thread_mutex;
+    pthread_cond_t m_thread_cond;
+    /*wakeup counters sampled when the last session stopped*/
+    unsigned int m_idle_reader_wakeups;
+    unsigned int m_idle_parser_wakeups;
+    unsigned int m_idle_deliver_wakeups;
+    /*read by the reader thread when it starts*/
+    WlGpsConfig m_config;
+
+    /*written by the reader thread*/
+    int m_nmea_fd WL_CACHELINE_ALIGNED;
+    unsigned int m_reader_wakeups;
+    /*for the syscalls per line logged at stop*/
+    unsigned int m_reader_syscalls;
+    unsigned int m_reader_reads;
+    unsigned int m_reader_bytes;
+    WlUring m_uring;
+
+    /*handed over from the reader to the buffer thread, guarded by m_mutex*/
+    pthread_mutex_t m_mutex WL_CACHELINE_ALIGNED;
+    unsigned char m_read_port_waiting;
+    /*the buffer thread found no whole line and sleeps until the reader rings*/
+    unsigned char m_read_buff_waiting;
+    gps_info_buf m_gps_info_buf;
+    /*bytes appended so far, and the latest reads' arrival for STALE_MS*/
+    uint32_t m_rx_total;
+    unsigned int m_rx_arrival_count;
+    WlRxArrival m_rx_arrivals[WL_RX_ARRIVALS];
+    /*CLOCK_MONOTONIC ns when the reader rang the buffer thread, 0 once it ran*/
+    int64_t m_parser_woken_ns;
+
+    /*written by the buffer thread*/
+    unsigned int m_parser_wakeups WL_CACHELINE_ALIGNED;
+    WlWakeLatency m_parser_latency;
+    NmeaParseCallbacks m_parse_callbacks;
+    NmeaParseState m_parse;
+    /*GSA and GSV decoded lately, kept from init to cleanup*/
+    NmeaMemo m_nmea_memo;
+    /*queue slot the current epoch's sentences go to, NULL when none is taken*/
+    WlNmeaBatch *m_nmea_filling;
+    unsigned int m_nmea_dropped;
+    /*lines the framer threw away for being too long, or for their checksum*/
+    unsigned int m_lines_dropped;
+    unsigned int m_lines_bad_checksum;
+    /*lines with more than WL_NMEA_MAX_FIELDS fields, split only that far*/
+    unsigned int m_lines_fields_cut;
+    unsigned int m_lines_framed;
+    /*a sentence of the current epoch was taken, the next RMC closes it*/
+    unsigned char m_epoch_open;
+    unsigned int m_epochs_shed;
+
+    /*
+     * Handed from the buffer thread to the delivery thread, guarded by
+     * m_deliver_mutex. A location or SV status not yet delivered is simply
+     * replaced by the next one; NMEA sentences queue up in order, one batch
+     * per epoch. The buffer thread fills the slot after the last committed
+     * batch without the lock, the delivery thread owns the committed ones.
+     */
+    pthread_mutex_t m_deliver_mutex WL_CACHELINE_ALIGNED;
+    /*m_deliver_evt was rung and the delivery thread has not gone idle since*/
+    unsigned char m_deliver_signalled;
+    /*CLOCK_MONOTONIC ns of that ring, for the delivery thread's latency*/
+    int64_t m_deliver_woken_ns;
+    unsigned char m_location_ready;
+    unsigned char m_sv_status_ready;
+    GpsLocation m_location_slot;
+    GpsSvStatus m_sv_status_slot;
+    int m_nmea_head;
+    int m_nmea_count;
+    WlNmeaBatch m_nmea_queue[WL_NMEA_QUEUE_LEN];
+    unsigned int m_location_coalesced;
+    unsigned int m_sv_status_coalesced;
+
+    /*written by the delivery thread, the last fix the filter let through*/
+    GpsLocation m_filter_last WL_CACHELINE_ALIGNED;
+    double m_filter_cos_lat;
+    /*CLOCK_MONOTONIC when it was delivered, fix timestamps are only seconds*/
+    int64_t m_filter_last_ms;
+    unsigned char m_filter_have_last;
+    unsigned int m_fixes_delivered;
+    unsigned int m_fixes_filtered;
+    unsigned int m_deliver_wakeups;
+    WlWakeLatency m_deliver_latency;
+    /*
+     * The adaptive rate's view of the motion: where the device came to rest,
+     * and a running mean and variance of the fixes' offset from there.
+     */
+    double m_motion_lat;
+    double m_motion_lon;
+    double m_motion_cos_lat;
+    double m_motion_east;
+    double m_motion_north;
+    double m_motion_var;
+    float m_motion_bearing;
+    unsigned char m_motion_have;
+    int m_still_fixes;
+    /*time and lines framed at the session's rate [0] and slowed down [1]*/
+    int64_t m_rate_mark_ms;
+    unsigned int m_rate_mark_lines;
+    int64_t m_rate_ms[2];
+    unsigned int m_rate_lines[2];
+
+    /*
+     * Receiver settings changed during a session, guarded by
+     * m_rx_setting_mutex. The settings thread runs while one that is wanted
+     * differs from the one applied. The fix rate in seconds comes from the
+     * delivery thread, the WL_NMEA_* types from framework threads as
+     * listeners and geofences come and go. From the moment stop begins
+     * m_session_ending keeps the thread from sending anything more, and
+     * m_rx_setting_cond tells stop it is gone.
+     */
+    pthread_mutex_t m_rx_setting_mutex WL_CACHELINE_ALIGNED;
+    pthread_cond_t m_rx_setting_cond;
+    unsigned char m_rx_setting_running;
+    unsigned char m_session_ending;
+    int m_rate_wanted;
+    int m_rate_applied;
+    unsigned int m_rate_changes;
+    unsigned int m_rate_failed;
+    /*WL_GPS_SUBSCRIPTION_INTERFACE, a registered callback is listened to until told otherwise*/
+    unsigned char m_sv_status_listened;
+    unsigned int m_nmea_listened;
+    unsigned int m_nmea_wanted;
+    unsigned int m_nmea_applied;
+    unsigned int m_nmea_changes;
+    unsigned int m_nmea_failed;
+
+    /*
+     * Geofences, guarded by m_geofence_mutex. Added and removed from framework
+     * threads, checked against every fix on the delivery thread, and made
+     * uncertain by stop, cleanup or the reader thread giving up on the port.
+     */
+    pthread_mutex_t m_geofence_mutex WL_CACHELINE_ALIGNED;
+    GpsGeofenceCallbacks *m_geofence_callbacks;
+    unsigned char m_geofence_available;
+    GpsLocation m_geofence_last_fix;
+    WlGeofenceEngine m_geofence;
+
+    /*
+     * XTRA data handed from inject_xtra_data to the injector thread, guarded
+     * by m_xtra_mutex. A newer blob replaces one that is still pending.
+     */
+    pthread_mutex_t m_xtra_mutex WL_CACHELINE_ALIGNED;
+    char *m_xtra_pending;
+    int m_xtra_pending_len;
+    unsigned char m_xtra_running;
+    unsigned int m_xtra_injected;
+    unsigned int m_xtra_failed;
+
+    /*
+     * Fixes kept for WL_GPS_HISTORY_INTERFACE, guarded by m_history_mutex.
+     * Added by the delivery thread, queried from any thread. Sized by the
+     * reader from HISTORY_LEN and kept across sessions.
+     */
+    pthread_mutex_t m_history_mutex WL_CACHELINE_ALIGNED;
+    WlHistory m_history;
+} WlGpsContext;
+
+static void wl_update_nmea_wanted(WlGpsContext *ctx);
+
+/*the framework drives a single receiver through the context-free GpsInterface*/
+static WlGpsContext g_gps_ctx =
+{
+    .m_read_port_evt = -1,
+    .m_read_buff_evt = -1,
+    .m_deliver_evt = -1,
+    .m_thread_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .m_atcmd_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .m_atcmd_cond = PTHREAD_COND_INITIALIZER,
+    .m_thread_cond = PTHREAD_COND_INITIALIZER,
+    .m_nmea_fd = -1,
+    .m_uring = { .m_fd = -1 },
+    .m_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .m_deliver_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .m_geofence_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .m_xtra_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .m_rx_setting_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .m_rx_setting_cond = PTHREAD_COND_INITIALIZER,
+    .m_sv_status_listened = 1,
+    .m_nmea_listened = WL_NMEA_ALL,
+    .m_history_mutex = PTHREAD_MUTEX_INITIALIZER,
+    .m_geofence = { .m_free_head = -1 },
+};
 
 static const GpsInterface  wl_GpsInterface = 
 {
@@ -162,6 +619,43 @@ static const GpsXtraInterface wl_GpsXtraInterface =
     wl_gps_xtra_inject_xtra_data
 };
 
+static const GpsGeofencingInterface wl_GpsGeofencingInterface =
+{
+    sizeof(GpsGeofencingInterface),
+    wl_gps_geofence_init,
+    wl_gps_add_geofence_area,
+    wl_gps_pause_geofence,
+    wl_gps_resume_geofence,
+    wl_gps_remove_geofence_area
+};
+
+static const WlGpsHistoryInterface wl_GpsHistoryInterface =
+{
+    sizeof(WlGpsHistoryInterface),
+    wl_gps_history_get_range,
+    wl_gps_history_get_last,
+    wl_gps_history_get_span
+};
+
+static const WlGpsSubscriptionInterface wl_GpsSubscriptionInterface =
+{
+    sizeof(WlGpsSubscriptionInterface),
+    wl_gps_set_sv_status_wanted,
+    wl_gps_set_nmea_wanted
+};
+
+static const WlGpsWakeupsInterface wl_GpsWakeupsInterface =
+{
+    sizeof(WlGpsWakeupsInterface),
+    wl_gps_get_wakeups
+};
+
+static const WlGpsRxStatsInterface wl_GpsRxStatsInterface =
+{
+    sizeof(WlGpsRxStatsInterface),
+    wl_gps_get_rx_stats
+};
+
 
 static struct hw_module_methods_t wl_gps_module_methods = 
 {
@@ -179,853 +673,2341 @@ struct hw_module_t HAL_MODULE_INFO_SYM =
     .methods = &wl_gps_module_methods,
 };
 
-static int wl_calc_utc_sub()
+
+static void wl_report_cur_state(WlGpsContext *ctx, GpsStatusValue status)
 {
-    time_t         now = time(NULL);
-    struct tm      tm_local;
-    struct tm      tm_utc;
-    long           time_local, time_utc;
+    GpsStatus gps_stat;
+
+    gps_stat.size = sizeof(GpsStatus);
+    gps_stat.status = status;
+    
+    ctx->m_callbacks->status_cb(&gps_stat);
+    return;
+}
 
-    gmtime_r( &now, &tm_utc );
-    localtime_r( &now, &tm_local );
+static void wl_report_geofence_transition(void *user, int32_t geofence_id, GpsLocation *location,
+            int32_t transition)
+{
+    WlGpsContext *ctx = (WlGpsContext *)user;
 
-    time_local = tm_local.tm_sec +
-                 60*(tm_local.tm_min +
-                 60*(tm_local.tm_hour +
-                 24*(tm_local.tm_yday +
-                 365*tm_local.tm_year)));
+    ctx->m_geofence_callbacks->geofence_transition_callback(geofence_id, location, transition,
+        location->timestamp);
+}
 
-    time_utc = tm_utc.tm_sec +
-               60*(tm_utc.tm_min +
-               60*(tm_utc.tm_hour +
-               24*(tm_utc.tm_yday +
-               365*tm_utc.tm_year)));
-    return time_local - time_utc;
+/*
+ * The framework callbacks run under m_geofence_mutex; they only post to the
+ * location provider's handler, so they never call back into us.
+ */
+static void wl_check_geofences(WlGpsContext *ctx, GpsLocation *location)
+{
+    pthread_mutex_lock(&ctx->m_geofence_mutex);
+    ctx->m_geofence_last_fix = *location;
+    if (!ctx->m_geofence_available)
+    {
+        ctx->m_geofence_available = 1;
+        ctx->m_geofence_callbacks->geofence_status_callback(GPS_GEOFENCE_AVAILABLE, location);
+    }
+    wl_geofence_check_fix(&ctx->m_geofence, location, wl_report_geofence_transition, ctx);
+    pthread_mutex_unlock(&ctx->m_geofence_mutex);
 }
 
-static int wl_get_all_segments_from_buf( NmeaInfoSegs *seg, const char *line_buf, int line_len)
+/*fixes stopped coming, every fence is uncertain until the next one*/
+static void wl_lose_geofence_fixes(WlGpsContext *ctx)
 {
-    int    count = 0;
-    char *p = line_buf;
-    char *line_end = line_buf+line_len;
+    if (NULL == ctx->m_geofence_callbacks)
+        return;
 
-    if ((p[0] != '$') || (p[line_len-3] != '*'))
+    pthread_mutex_lock(&ctx->m_geofence_mutex);
+    if (ctx->m_geofence_available)
     {
-    	LOGD("p[%d]:%c",(line_len-3),p[line_len-3]);
-        LOGD("Line format not correct");
-        return 0;
+        ctx->m_geofence_available = 0;
+        wl_geofence_fix_lost(&ctx->m_geofence, &ctx->m_geofence_last_fix,
+            wl_report_geofence_transition, ctx);
+        ctx->m_geofence_callbacks->geofence_status_callback(GPS_GEOFENCE_UNAVAILABLE,
+            &ctx->m_geofence_last_fix);
+    }
+    pthread_mutex_unlock(&ctx->m_geofence_mutex);
+}
+
+/*
+ * The parser's reports only land in the delivery slots; the framework is
+ * called from wl_deliver_thread, so a slow callback never holds up parsing.
+ * Called with m_deliver_mutex held.
+ */
+static void wl_signal_delivery(WlGpsContext *ctx)
+{
+    if (!ctx->m_deliver_signalled)
+    {
+        ctx->m_deliver_signalled = 1;
+        __atomic_store_n(&ctx->m_deliver_woken_ns, wl_now_ns(), __ATOMIC_RELEASE);
+        wl_wake_thread(ctx->m_deliver_evt);
     }
+}
+
+static void wl_report_location(void *user, GpsLocation *location)
+{
+    WlGpsContext *ctx = (WlGpsContext *)user;
+
+    pthread_mutex_lock(&ctx->m_deliver_mutex);
+    if (ctx->m_location_ready)
+        ctx->m_location_coalesced++;
+    ctx->m_location_slot = *location;
+    ctx->m_location_ready = 1;
+    wl_signal_delivery(ctx);
+    pthread_mutex_unlock(&ctx->m_deliver_mutex);
+}
+
+static void wl_report_sv_status(void *user, GpsSvStatus *sv_status)
+{
+    WlGpsContext *ctx = (WlGpsContext *)user;
+
+    pthread_mutex_lock(&ctx->m_deliver_mutex);
+    if (ctx->m_sv_status_ready)
+        ctx->m_sv_status_coalesced++;
+    ctx->m_sv_status_slot = *sv_status;
+    ctx->m_sv_status_ready = 1;
+    wl_signal_delivery(ctx);
+    pthread_mutex_unlock(&ctx->m_deliver_mutex);
+}
+
+/*hands the batch being filled over to the delivery thread*/
+static void wl_commit_nmea_batch(WlGpsContext *ctx)
+{
+    if ((NULL == ctx->m_nmea_filling) || (0 == ctx->m_nmea_filling->m_count))
+        return;
+
+    pthread_mutex_lock(&ctx->m_deliver_mutex);
+    ctx->m_nmea_count++;
+    wl_signal_delivery(ctx);
+    pthread_mutex_unlock(&ctx->m_deliver_mutex);
+    ctx->m_nmea_filling = NULL;
+}
 
-    p++;
-    line_end -= 3;
+/*
+ * Sentences are only copied into the current epoch's batch here; the whole
+ * batch goes out in one go once the RMC closes the epoch, or earlier if it
+ * fills up.
+ */
+static void wl_report_nmea(void *user, GpsUtcTime timestamp, const char *nmea, int length)
+{
+    WlGpsContext *ctx = (WlGpsContext *)user;
+    WlNmeaBatch *batch = ctx->m_nmea_filling;
+
+    /*MAX_LINE may be longer than a whole batch*/
+    if (length > WL_NMEA_BATCH_BYTES - 1)
+        length = WL_NMEA_BATCH_BYTES - 1;
+
+    if (batch && ((batch->m_count == WL_NMEA_BATCH_LINES)
+        || (batch->m_used + length + 1 > WL_NMEA_BATCH_BYTES)))
+    {
+        wl_commit_nmea_batch(ctx);
+        batch = NULL;
+    }
 
-    while (p < line_end) 
+    if (NULL == batch)
     {
-        const char*  q = p;
+        pthread_mutex_lock(&ctx->m_deliver_mutex);
+        if (ctx->m_nmea_count < WL_NMEA_QUEUE_LEN)
+            batch = &ctx->m_nmea_queue[(ctx->m_nmea_head + ctx->m_nmea_count) % WL_NMEA_QUEUE_LEN];
+        pthread_mutex_unlock(&ctx->m_deliver_mutex);
 
-        q = memchr(p, ',', line_end-p);
-        if (q == NULL)
-            q = line_end;
-        
-        if (q >= p) 
+        if (NULL == batch)
         {
-            if (count < MAX_NMEA_INFO_SEG) 
-            {
-                seg->m_segs[count].m_beg = p;
-                seg->m_segs[count].m_end = q;
-                count += 1;
-            }
+            ctx->m_nmea_dropped++;
+            return;
         }
-        
-        if (q < line_end)
-            q += 1;
+        batch->m_timestamp = timestamp;
+        batch->m_count = 0;
+        batch->m_used = 0;
+        ctx->m_nmea_filling = batch;
+    }
+
+    memcpy(&batch->m_data[batch->m_used], nmea, length);
+    batch->m_data[batch->m_used + length] = '\0';
+    batch->m_len[batch->m_count++] = length;
+    batch->m_used += length + 1;
+}
+
+static void wl_report_epoch(void *user)
+{
+    WlGpsContext *ctx = (WlGpsContext *)user;
 
-        p = q;
+    ctx->m_epoch_open = 0;
+    wl_commit_nmea_batch(ctx);
+}
+
+/*forgets whatever a previous session left undelivered*/
+static void wl_reset_delivery(WlGpsContext *ctx)
+{
+    pthread_mutex_lock(&ctx->m_deliver_mutex);
+    ctx->m_deliver_signalled = 0;
+    ctx->m_location_ready = 0;
+    ctx->m_sv_status_ready = 0;
+    ctx->m_nmea_head = 0;
+    ctx->m_nmea_count = 0;
+    pthread_mutex_unlock(&ctx->m_deliver_mutex);
+    ctx->m_nmea_filling = NULL;
+}
+
+/*
+ * The parser only reports what the framework registered a callback for.
+ * Fixes are always wanted, the geofences may be registered later.
+ */
+static void wl_set_parse_callbacks(WlGpsContext *ctx)
+{
+    NmeaParseCallbacks *parse_callbacks = &ctx->m_parse_callbacks;
+
+    parse_callbacks->location_cb = wl_report_location;
+    parse_callbacks->sv_status_cb = ctx->m_callbacks->sv_status_cb ? wl_report_sv_status : NULL;
+    parse_callbacks->nmea_cb = ctx->m_callbacks->nmea_cb ? wl_report_nmea : NULL;
+    parse_callbacks->epoch_cb = wl_report_epoch;
+    parse_callbacks->user = ctx;
+}
+
+static int wl_gps_xtra_init(GpsXtraCallbacks* callbacks) 
+{
+    LOGD("Enter ql_gps_xtra_init");
+    g_gps_ctx.m_xtra_callbacks = callbacks;
+    return 0;
+}
+
+static void wl_gps_geofence_init(GpsGeofenceCallbacks* callbacks)
+{
+    LOGD("Enter wl_gps_geofence_init");
+    g_gps_ctx.m_geofence_callbacks = callbacks;
+}
+
+static void wl_gps_add_geofence_area(int32_t geofence_id, double latitude, double longitude,
+            double radius_meters, int last_transition, int monitor_transitions,
+            int notification_responsiveness_ms, int unknown_timer_ms)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+    int ret;
+
+    /*every fix is checked, so responsiveness is as good as the fix rate*/
+    pthread_mutex_lock(&ctx->m_geofence_mutex);
+    ret = wl_geofence_add(&ctx->m_geofence, geofence_id, latitude, longitude, radius_meters,
+        last_transition, monitor_transitions);
+    pthread_mutex_unlock(&ctx->m_geofence_mutex);
+
+    if (ret != GPS_GEOFENCE_OPERATION_SUCCESS)
+        LOGD("[wl_gps_add_geofence_area]:geofence %d rejected: %d", geofence_id, ret);
+    else
+        wl_update_nmea_wanted(ctx);
+    if (ctx->m_geofence_callbacks)
+        ctx->m_geofence_callbacks->geofence_add_callback(geofence_id, ret);
+}
+
+static void wl_gps_pause_geofence(int32_t geofence_id)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+    int ret;
+
+    pthread_mutex_lock(&ctx->m_geofence_mutex);
+    ret = wl_geofence_pause(&ctx->m_geofence, geofence_id);
+    pthread_mutex_unlock(&ctx->m_geofence_mutex);
+
+    if (ctx->m_geofence_callbacks)
+        ctx->m_geofence_callbacks->geofence_pause_callback(geofence_id, ret);
+}
+
+static void wl_gps_resume_geofence(int32_t geofence_id, int monitor_transitions)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+    int ret;
+
+    pthread_mutex_lock(&ctx->m_geofence_mutex);
+    ret = wl_geofence_resume(&ctx->m_geofence, geofence_id, monitor_transitions);
+    pthread_mutex_unlock(&ctx->m_geofence_mutex);
+
+    if (ctx->m_geofence_callbacks)
+        ctx->m_geofence_callbacks->geofence_resume_callback(geofence_id, ret);
+}
+
+static void wl_gps_remove_geofence_area(int32_t geofence_id)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+    int ret;
+
+    pthread_mutex_lock(&ctx->m_geofence_mutex);
+    ret = wl_geofence_remove(&ctx->m_geofence, geofence_id);
+    pthread_mutex_unlock(&ctx->m_geofence_mutex);
+
+    if (ret == GPS_GEOFENCE_OPERATION_SUCCESS)
+        wl_update_nmea_wanted(ctx);
+    if (ctx->m_geofence_callbacks)
+        ctx->m_geofence_callbacks->geofence_remove_callback(geofence_id, ret);
+}
+
+/*only the fixes asked for are unpacked into out, under the lock the adder takes*/
+static int wl_gps_history_get_range(GpsUtcTime from, GpsUtcTime to, GpsUtcTime step,
+            GpsLocation *out, int max)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+    int ret;
+
+    if ((NULL == out) || (max <= 0))
+        return 0;
+
+    pthread_mutex_lock(&ctx->m_history_mutex);
+    ret = wl_history_range(&ctx->m_history, from, to, step, out, max);
+    pthread_mutex_unlock(&ctx->m_history_mutex);
+    return ret;
+}
+
+static int wl_gps_history_get_last(GpsLocation *out, int max)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+    int ret;
+
+    if (NULL == out)
+        return 0;
+
+    pthread_mutex_lock(&ctx->m_history_mutex);
+    ret = wl_history_last(&ctx->m_history, out, max);
+    pthread_mutex_unlock(&ctx->m_history_mutex);
+    return ret;
+}
+
+static int wl_gps_history_get_span(GpsUtcTime *oldest, GpsUtcTime *newest)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+    int ret;
+
+    pthread_mutex_lock(&ctx->m_history_mutex);
+    ret = wl_history_span(&ctx->m_history, oldest, newest);
+    pthread_mutex_unlock(&ctx->m_history_mutex);
+    return ret;
+}
+
+static void wl_gps_set_sv_status_wanted(int wanted)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+
+    LOGD("[wl_gps_set_sv_status_wanted]:%d", wanted);
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    ctx->m_sv_status_listened = (wanted != 0);
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+    wl_update_nmea_wanted(ctx);
+}
+
+static void wl_gps_set_nmea_wanted(unsigned int types)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+
+    LOGD("[wl_gps_set_nmea_wanted]:0x%x", types);
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    ctx->m_nmea_listened = types & WL_NMEA_ALL;
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+    wl_update_nmea_wanted(ctx);
+}
+
+static void wl_gps_get_wakeups(WlGpsWakeups *wakeups)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+
+    /*each counter has a single writer, a torn count is all a reader can see*/
+    wakeups->m_reader = __atomic_load_n(&ctx->m_reader_wakeups, __ATOMIC_RELAXED);
+    wakeups->m_parser = __atomic_load_n(&ctx->m_parser_wakeups, __ATOMIC_RELAXED);
+    wakeups->m_deliver = __atomic_load_n(&ctx->m_deliver_wakeups, __ATOMIC_RELAXED);
+}
+
+static void wl_gps_get_rx_stats(WlGpsRxStats *stats)
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+
+    /*all written by the buffer thread alone, like the wakeup counters*/
+    stats->m_framed = __atomic_load_n(&ctx->m_lines_framed, __ATOMIC_RELAXED);
+    stats->m_dropped = __atomic_load_n(&ctx->m_lines_dropped, __ATOMIC_RELAXED);
+    stats->m_bad_checksum = __atomic_load_n(&ctx->m_lines_bad_checksum, __ATOMIC_RELAXED);
+    stats->m_fields_cut = __atomic_load_n(&ctx->m_lines_fields_cut, __ATOMIC_RELAXED);
+}
+
+/*a new HISTORY_LEN starts the history over, the same one keeps it*/
+static void wl_size_history(WlGpsContext *ctx)
+{
+    int len = ctx->m_config.m_history_len;
+
+    pthread_mutex_lock(&ctx->m_history_mutex);
+    if (len != ctx->m_history.m_cap)
+    {
+        wl_history_free(&ctx->m_history);
+        if (wl_history_init(&ctx->m_history, len) == 0)
+            LOGD("[wl_size_history]:keeping the last %d fixes", len);
     }
+    pthread_mutex_unlock(&ctx->m_history_mutex);
+}
 
-    seg->m_count = count;
-    return count;
+static void wl_wake_thread(int evt_fd)
+{
+    uint64_t one = 1;
+
+    if (evt_fd >= 0)
+        write(evt_fd, &one, sizeof(one));
+}
+
+static void wl_clear_wakeup(int evt_fd)
+{
+    uint64_t count;
+
+    read(evt_fd, &count, sizeof(count));
+}
+
+/*
+ * Sleeps until evt_fd is rung or timeout_ms expires (-1 waits forever).
+ */
+static void wl_wait_wakeup(int evt_fd, int timeout_ms)
+{
+    struct pollfd pfd;
+
+    pfd.fd = evt_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    if (poll(&pfd, 1, timeout_ms) > 0)
+        wl_clear_wakeup(evt_fd);
+}
+
+static int64_t wl_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * Takes the time another thread stored in *woken_ns when it rang us. A
+ * wakeup nobody stamped, cleanup's or a spurious one, is not counted.
+ */
+static void wl_note_wakeup(WlWakeLatency *latency, int64_t *woken_ns)
+{
+    int64_t then = __atomic_exchange_n(woken_ns, 0, __ATOMIC_ACQ_REL);
+    unsigned int us;
+
+    if (0 == then)
+        return;
+    us = (unsigned int)((wl_now_ns() - then) / 1000);
+    latency->m_total_us += us;
+    latency->m_count++;
+    if (us > latency->m_max_us)
+        latency->m_max_us = us;
 }
 
-static Charseg wl_get_segments_by_index(NmeaInfoSegs *nmea_seg, int index)
+static const char *g_thread_policy_names[WL_THREAD_POLICY_COUNT] = { "READER", "PARSER", "DELIVER" };
+
+/*
+ * Gives the calling HAL thread the scheduling its config entry asks for.
+ * Linux applies all three calls to the calling thread alone.
+ */
+static void wl_apply_thread_policy(WlGpsContext *ctx, int thread)
 {
-    Charseg  seg;
-    static const char *empty_str = "";
+    const WlThreadPolicy *policy = &ctx->m_config.m_thread_policy[thread];
+    const char *name = g_thread_policy_names[thread];
+    struct sched_param param;
 
-    if (index < 0 || index >= nmea_seg->m_count) 
+    if (policy->m_sched_set)
     {
-        seg.m_beg = seg.m_end = empty_str;
-    } 
-    else
+        memset(&param, 0, sizeof(param));
+        if (policy->m_policy != SCHED_OTHER)
+        {
+            param.sched_priority = policy->m_priority;
+            if (param.sched_priority < sched_get_priority_min(policy->m_policy))
+                param.sched_priority = sched_get_priority_min(policy->m_policy);
+            if (param.sched_priority > sched_get_priority_max(policy->m_policy))
+                param.sched_priority = sched_get_priority_max(policy->m_policy);
+        }
+        if (sched_setscheduler(0, policy->m_policy, &param) < 0)
+            LOGE("[wl_apply_thread_policy]:%s keeps its scheduling, errno=%d", name, errno);
+        else if ((policy->m_policy == SCHED_OTHER)
+            && (setpriority(PRIO_PROCESS, syscall(__NR_gettid), policy->m_nice) < 0))
+            LOGE("[wl_apply_thread_policy]:%s keeps its nice value, errno=%d", name, errno);
+    }
+
+    /*the raw call takes a plain mask, no cpu_set_t and _GNU_SOURCE needed*/
+    if (policy->m_cpus
+        && (syscall(__NR_sched_setaffinity, 0, sizeof(policy->m_cpus), &policy->m_cpus) < 0))
+        LOGE("[wl_apply_thread_policy]:%s keeps its CPUs, errno=%d", name, errno);
+
+    LOGD("[wl_apply_thread_policy]:%s runs %s priority %d nice %d, CPUs 0x%llx",
+        name, (sched_getscheduler(0) == SCHED_FIFO) ? "FIFO" :
+        (sched_getscheduler(0) == SCHED_RR) ? "RR" : "OTHER",
+        (sched_getparam(0, &param) == 0) ? param.sched_priority : -1,
+        getpriority(PRIO_PROCESS, syscall(__NR_gettid)), (unsigned long long)policy->m_cpus);
+}
+
+/*
+ * MLOCK=1, keeps a buffer a HAL thread works in from being paged out. Not
+ * const: the buffers are fresh from malloc, and a const pointer to them
+ * reads as a use of uninitialized memory to -Wmaybe-uninitialized.
+ */
+static void wl_lock_memory(WlGpsContext *ctx, void *addr, size_t len)
+{
+    if (ctx->m_config.m_mlock && addr && (mlock(addr, len) < 0))
+        LOGE("[wl_lock_memory]:can not lock %u bytes, errno=%d", (unsigned int)len, errno);
+}
+
+/*a locked range stays locked after free, unlock it first*/
+static void wl_unlock_memory(WlGpsContext *ctx, const void *addr, size_t len)
+{
+    if (ctx->m_config.m_mlock && addr)
+        munlock(addr, len);
+}
+
+/*lets AT senders notice m_need_reading_nmea went down*/
+static void wl_wake_at_senders(WlGpsContext *ctx)
+{
+    pthread_mutex_lock(&ctx->m_atcmd_mutex);
+    pthread_cond_broadcast(&ctx->m_atcmd_cond);
+    pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+}
+
+static void wl_close_wakeup_fds(WlGpsContext *ctx)
+{
+    if (ctx->m_read_port_evt >= 0)
+    {
+        close(ctx->m_read_port_evt);
+        ctx->m_read_port_evt = -1;
+    }
+
+    if (ctx->m_read_buff_evt >= 0)
     {
-        seg = nmea_seg->m_segs[index];
+        close(ctx->m_read_buff_evt);
+        ctx->m_read_buff_evt = -1;
     }
 
-    return seg;
+    if (ctx->m_deliver_evt >= 0)
+    {
+        close(ctx->m_deliver_evt);
+        ctx->m_deliver_evt = -1;
+    }
 }
 
-static int str2int(const char *beg, const char * end)
+static pthread_t wl_create_thread(WlGpsContext *ctx, const char *name, void (*start)(void *))
 {
-    int   result = 0;
-    int   len    = end - beg;
+    pthread_t tid;
+
+    pthread_mutex_lock(&ctx->m_thread_mutex);
+    ctx->m_thread_count++;
+    pthread_mutex_unlock(&ctx->m_thread_mutex);
 
-    for ( ; len > 0; len--, beg++ )
+    tid = ctx->m_callbacks->create_thread_cb(name, start, ctx);
+    if (0 == tid)
     {
-        int  c;
+        LOGE("Can not create %s", name);
+        pthread_mutex_lock(&ctx->m_thread_mutex);
+        ctx->m_thread_count--;
+        pthread_cond_broadcast(&ctx->m_thread_cond);
+        pthread_mutex_unlock(&ctx->m_thread_mutex);
+    }
+
+    return tid;
+}
 
-        if (beg >= end)
-            goto Fail;
+/*
+ * Must be the last thing a HAL thread does before returning.
+ */
+static void wl_thread_exit(WlGpsContext *ctx)
+{
+    pthread_mutex_lock(&ctx->m_thread_mutex);
+    ctx->m_thread_count--;
+    pthread_cond_broadcast(&ctx->m_thread_cond);
+    pthread_mutex_unlock(&ctx->m_thread_mutex);
+}
+
+/*
+ * Absolute CLOCK_REALTIME time timeout_ms from now, for pthread_cond_timedwait.
+ */
+static void wl_get_deadline(struct timespec *deadline, int timeout_ms)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
 
-        c = *beg - '0';
-        if ((unsigned)c >= 10)
-            goto Fail;
+/*
+ * The threads come from create_thread_cb, which hands out detached threads
+ * on Android, so they are reaped by counting them out instead of joining.
+ * Returns the number of threads still running after timeout_ms.
+ */
+static int wl_wait_threads_exit(WlGpsContext *ctx, int timeout_ms)
+{
+    struct timespec deadline;
+    int count;
 
-        result = result*10 + c;
+    wl_get_deadline(&deadline, timeout_ms);
+    pthread_mutex_lock(&ctx->m_thread_mutex);
+    while (ctx->m_thread_count > 0)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&ctx->m_thread_cond, &ctx->m_thread_mutex, &deadline))
+            break;
     }
-    return  result;
+    count = ctx->m_thread_count;
+    pthread_mutex_unlock(&ctx->m_thread_mutex);
 
-Fail:
-    return -1;
+    return count;
 }
 
-static double str2float(const char *beg, const char *end)
+/*
+ * Makes the UART driver push received bytes to the tty right away instead of
+ * from its deferred work. Not every driver has it; the port works either way.
+ */
+static void wl_set_low_latency(int fd)
 {
-    int   len    = end - beg;
-    char  temp[16];
-	double tmp;
+    struct serial_struct serial;
 
-    if (len >= (int)sizeof(temp))
-        return 0.;
+    if ((ioctl(fd, TIOCGSERIAL, &serial) < 0) || (serial.flags |= ASYNC_LOW_LATENCY,
+        ioctl(fd, TIOCSSERIAL, &serial) < 0))
+        LOGD("[wl_set_low_latency]:not supported by this port, errno=%d", errno);
+}
 
-    memcpy( temp, beg, len );
-    temp[len] = 0;
-	tmp = strtod( temp, NULL );
-    return strtod( temp, NULL );
+/*m_mutex, with the wait for it and the hold traced apart*/
+static void wl_rx_lock(WlGpsContext *ctx)
+{
+    WL_TRACE_BEGIN(WL_TRACE_RX_LOCK_WAIT, 0);
+    pthread_mutex_lock(&ctx->m_mutex);
+    WL_TRACE_END(WL_TRACE_RX_LOCK_WAIT);
+    WL_TRACE_BEGIN(WL_TRACE_RX_LOCK_HOLD, 0);
 }
 
-static double wl_get_latlong_from_seg(Charseg seg)
+static void wl_rx_unlock(WlGpsContext *ctx)
 {
-    double  val     = str2float(seg.m_beg, seg.m_end);
-    int     degrees = (int)(floor(val) / 100);
-    double  minutes = val - degrees*100.;
-    double  dcoord  = degrees + minutes / 60.0;
-    return dcoord;
+    WL_TRACE_END(WL_TRACE_RX_LOCK_HOLD);
+    pthread_mutex_unlock(&ctx->m_mutex);
 }
 
-static int wl_get_latlong(GpsLocation *loc, Charseg latitude, Charseg latitudeHemi, Charseg longitude, Charseg longitudeHemi )
+/*sized from the config the reader has just read, before the buffer thread runs*/
+static int wl_alloc_rx_buffer(WlGpsContext *ctx)
 {
-    double   lat, lon;
-    Charseg seg;
+    gps_info_buf *buf = &ctx->m_gps_info_buf;
+    char *mem = malloc(ctx->m_config.m_rx_buffer + 1);
 
-    seg = latitude;
-    if (seg.m_beg + 6 > seg.m_end) 
+    if (NULL == mem)
     {
-        LOGD("Warning! Latitude is not correct");
+        LOGE("Can not allocate a %d byte receive buffer", ctx->m_config.m_rx_buffer);
         return -1;
     }
-    
-    lat = wl_get_latlong_from_seg(seg);
-	LOGD("wl_get_latlong:lat=%f",lat);
-    if (latitudeHemi.m_beg[0] == 'S')
-        lat = -lat;
 
-    seg = longitude;
-    if (seg.m_beg + 6 > seg.m_end) 
+    wl_lock_memory(ctx, mem, ctx->m_config.m_rx_buffer + 1);
+    pthread_mutex_lock(&ctx->m_mutex);
+    wl_unlock_memory(ctx, buf->m_buf, buf->m_size + 1);
+    free(buf->m_buf);
+    buf->m_buf = mem;
+    buf->m_buf[0] = '\0';
+    buf->m_size = ctx->m_config.m_rx_buffer;
+    buf->m_start = 0;
+    buf->len = 0;
+    pthread_mutex_unlock(&ctx->m_mutex);
+    return 0;
+}
+
+/*only once no HAL thread is left to touch it*/
+static void wl_free_rx_buffer(WlGpsContext *ctx)
+{
+    wl_unlock_memory(ctx, ctx->m_gps_info_buf.m_buf, ctx->m_gps_info_buf.m_size + 1);
+    free(ctx->m_gps_info_buf.m_buf);
+    memset(&ctx->m_gps_info_buf, 0, sizeof(ctx->m_gps_info_buf));
+}
+
+static int wl_gps_init_internal_process(WlGpsContext *ctx)
+{
+    /*a reader that gave up on the port may still be stopping its buffer thread*/
+    if (wl_wait_threads_exit(ctx, WL_THREAD_EXIT_TIMEOUT_MS) != 0)
+    {
+        LOGE("Old GPS threads are still running");
+        return -1;
+    }
+
+    wl_close_wakeup_fds(ctx);
+    ctx->m_read_port_evt = eventfd(0, EFD_NONBLOCK);
+    ctx->m_read_buff_evt = eventfd(0, EFD_NONBLOCK);
+    ctx->m_deliver_evt = eventfd(0, EFD_NONBLOCK);
+    if ((ctx->m_read_port_evt < 0) || (ctx->m_read_buff_evt < 0) || (ctx->m_deliver_evt < 0))
+    {
+        LOGE("Can not create eventfd, errno=%d", errno);
+        wl_close_wakeup_fds(ctx);
+        return -1;
+    }
+
+    wl_free_rx_buffer(ctx);
+    wl_reset_parse_state(&ctx->m_parse);
+    wl_attach_parse_memo(&ctx->m_parse, &ctx->m_nmea_memo);
+    ctx->m_epoch_open = 0;
+    ctx->m_read_port_waiting = 0;
+    ctx->m_read_buff_waiting = 0;
+    ctx->m_read_buff_thread = 0;
+    ctx->m_deliver_thread = 0;
+    wl_reset_delivery(ctx);
+
+    ctx->m_need_reading_nmea = 1;
+    ctx->m_read_port_thread = wl_create_thread(ctx, "wl_read_port_thread", wl_read_port_thread);
+    if (0 == ctx->m_read_port_thread)
     {
-        LOGD("Warning! longitude is not correct");
+        ctx->m_need_reading_nmea = 0;
+        wl_close_wakeup_fds(ctx);
         return -1;
     }
-    lon = wl_get_latlong_from_seg(seg);
-	LOGD("wl_get_latlong:lon=%f",lon);
-    if (longitudeHemi.m_beg[0] == 'W')
-        lon = -lon;
 
-    loc->flags    |= GPS_LOCATION_HAS_LAT_LONG;
-    loc->latitude  = lat;
-    loc->longitude = lon;
     return 0;
 }
 
-static int wl_get_altitude(GpsLocation *loc, Charseg altitude, Charseg units)
+static int wl_write_all(int fd, const char *buf, int len)
+{
+    while (len > 0)
+    {
+        int written = write(fd, buf, len);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/*
+ * Queues an AT line on the reader's ring, called with m_atcmd_mutex held.
+ * The reader fails the command if the write completes short.
+ */
+static int wl_uring_send_at(WlGpsContext *ctx, const char *line, int len)
 {
-    Charseg seg = altitude;
+    int ret;
+
+    if (ctx->m_at_write_busy || (len > WL_AT_LINE_LEN))
+    {
+        errno = EBUSY;
+        return -1;
+    }
 
-    if (seg.m_beg >= seg.m_end)
+    memcpy(ctx->m_at_write_buf, line, len);
+    ctx->m_at_write_len = len;
+    ret = wl_uring_queue_write(&ctx->m_uring, ctx->m_nmea_fd, ctx->m_at_write_buf, len, WL_URING_AT_WRITE);
+    if (ret < 0)
+    {
+        errno = -ret;
         return -1;
+    }
+    ctx->m_at_write_busy = 1;
 
-    loc->flags   |= GPS_LOCATION_HAS_ALTITUDE;
-    loc->altitude = str2float(seg.m_beg, seg.m_end);
+    /*queued is enough, the reader's next enter would submit it anyway*/
+    do
+        ret = wl_uring_enter(&ctx->m_uring, 0);
+    while (-EINTR == ret);
     return 0;
 }
 
-static int wl_get_time(GpsLocation *loc, Charseg  seg)
+/*the reader reaped the write of m_at_write_buf*/
+static void wl_uring_at_write_done(WlGpsContext *ctx, int res)
+{
+    pthread_mutex_lock(&ctx->m_atcmd_mutex);
+    if ((res != ctx->m_at_write_len) && (ctx->m_cur_atcmd != 0))
+    {
+        LOGD("AT command write error, res=%d", res);
+        ctx->m_atcmd_error = 1;
+        ctx->m_cur_atcmd = 0;
+        pthread_cond_broadcast(&ctx->m_atcmd_cond);
+    }
+    ctx->m_at_write_busy = 0;
+    pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+}
+
+/*
+ * Sends one "\r" terminated AT line and waits for its answer. Commands from
+ * different threads take turns: a caller first waits for the one in flight.
+ */
+static int wl_send_at_line(WlGpsContext *ctx, int cmd_index, const char *line, int len)
 {
-    int hour, minute;
-    double seconds;
-    struct tm  tm;
-	struct tm  utc;
-    time_t     fix_time;
-	double tmp = 0 ;
+    struct timespec deadline;
+    int ret = 0;
 
-    if (seg.m_beg + 6 > seg.m_end)
+    WL_TRACE_BEGIN(WL_TRACE_AT_CMD, cmd_index);
+    wl_get_deadline(&deadline, WL_ATCMD_TIMEOUT_MS);
+    pthread_mutex_lock(&ctx->m_atcmd_mutex);
+    while ((ctx->m_cur_atcmd != 0) && ctx->m_need_reading_nmea)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&ctx->m_atcmd_cond, &ctx->m_atcmd_mutex, &deadline))
+            break;
+    }
+    if ((ctx->m_cur_atcmd != 0) || !ctx->m_need_reading_nmea || (ctx->m_nmea_fd < 0))
+    {
+        pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+        WL_TRACE_END(WL_TRACE_AT_CMD);
+        LOGD("AT port busy");
+        return -2;
+    }
+
+    ctx->m_cur_atcmd = cmd_index;
+    ctx->m_atcmd_error = 0;
+    if ((ctx->m_uring_active ? wl_uring_send_at(ctx, line, len) : wl_write_all(ctx->m_nmea_fd, line, len)) < 0)
+    {
+        LOGD("AT command write error, errno=%d", errno);
+        ctx->m_cur_atcmd = 0;
+        pthread_cond_broadcast(&ctx->m_atcmd_cond);
+        pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+        WL_TRACE_END(WL_TRACE_AT_CMD);
         return -1;
+    }
+
+    /*the buffer thread signals as soon as it sees the answer*/
+    wl_get_deadline(&deadline, WL_ATCMD_TIMEOUT_MS);
+    while ((ctx->m_cur_atcmd != 0) && ctx->m_need_reading_nmea)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&ctx->m_atcmd_cond, &ctx->m_atcmd_mutex, &deadline))
+            break;
+    }
 
-    if (g_utc_info.m_year < 0)
+    if ((ctx->m_cur_atcmd != 0) || ctx->m_atcmd_error)
     {
-        time_t  now = time(NULL);
-        gmtime_r( &now, &tm );
-        g_utc_info.m_year = tm.tm_year + 1900;
-        g_utc_info.m_month = tm.tm_mon + 1;
-        g_utc_info.m_day  = tm.tm_mday;
+        LOGD("AT command error");
+        ctx->m_cur_atcmd = 0;
+        pthread_cond_broadcast(&ctx->m_atcmd_cond);
+        ret = -1;
     }
+    pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+    WL_TRACE_END(WL_TRACE_AT_CMD);
+
+    return ret;
+}
 
-    hour = str2int(seg.m_beg,   seg.m_beg+2);
-    minute  = str2int(seg.m_beg+2, seg.m_beg+4);
-    seconds = str2float(seg.m_beg+4, seg.m_end);
+/*the line of each ATCMD_*, and the receiver setting its "OK" leaves behind*/
+typedef struct
+{
+    const char *m_line;
+    int m_setting;
+    int m_value;
+} WlAtCmd;
 
-    tm.tm_hour  = hour;
-    tm.tm_min   = minute;
-    tm.tm_sec   = (int) seconds;
-    tm.tm_year  = g_utc_info.m_year - 1900;
-    tm.tm_mon   = g_utc_info.m_month - 1;
-    tm.tm_mday  = g_utc_info.m_day;
-    tm.tm_isdst = -1;
+static const WlAtCmd g_atcmds[] =
+{
+    [ATCMD_ZGINIT] = { "AT+ZGINIT", WL_RX_INIT, 1 },
+    [ATCMD_ZGMODE_3] = { "AT+ZGMODE=3", WL_RX_MODE, 3 },
+    [ATCMD_ZGNMEA_0] = { "AT+ZGNMEA=0", WL_RX_NMEA, 0 },
+    [ATCMD_ZGRUN_0] = { "AT+ZGRUN=0", WL_RX_RUN, 0 },
+    [ATCMD_ZGRUN_2] = { "AT+ZGRUN=2", WL_RX_RUN, 2 },
+    [ATCMD_ZGFIXRATE_65535] = { "AT+ZGFIXRATE=65535,0", WL_RX_FIXRATE, 0 },
+    [ATCMD_ZGFIXRATE_1] = { "AT+ZGFIXRATE=1,0", WL_RX_FIXRATE, WL_FIXRATE_SINGLE },
+};
 
-	tmp = ceil((fabs(loc->longitude) - 7.5) / 15 + 1);
-	g_utc_info.m_sub = (loc->longitude / fabs(loc->longitude)) * tmp * 3600;
+static void wl_forget_rx_state_locked(WlGpsContext *ctx)
+{
+    int i;
 
-	fix_time = mktime( &tm ) + g_utc_info.m_sub;
-	
-    loc->timestamp = (long long)fix_time;
-	
-	gmtime_r( (time_t*) &loc->timestamp, &utc );
-	
-    return 0;
+    for (i = 0; i < WL_RX_SETTING_COUNT; i++)
+        ctx->m_rx_state[i] = WL_RX_UNKNOWN;
+    ctx->m_rx_epoch++;
+}
+
+/*the port was (re)opened, the receiver behind it may have been reset*/
+static void wl_forget_rx_state(WlGpsContext *ctx)
+{
+    pthread_mutex_lock(&ctx->m_atcmd_mutex);
+    wl_forget_rx_state_locked(ctx);
+    pthread_mutex_unlock(&ctx->m_atcmd_mutex);
 }
 
-static int wl_get_bearing(GpsLocation *loc, Charseg bearing)
+/*
+ * Puts the receiver in the state cmd->m_setting = cmd->m_value, sending the
+ * command only when its last answer did not leave it there already.
+ */
+static int wl_send_at_setting(WlGpsContext *ctx, int cmd_index, const WlAtCmd *cmd)
 {
-    Charseg seg = bearing;
-    float   value = 0.0f;
+    char cmd_buf[32];
+    unsigned int epoch;
+    int ret;
 
-    if (seg.m_beg < seg.m_end) 
+    if (ctx->m_nmea_fd < 0)
     {
-        value = str2float(seg.m_beg, seg.m_end);
-    } 
-    else if ((seg.m_beg >= seg.m_end) && (loc->flags & GPS_LOCATION_HAS_BEARING)) 
+        return -1;
+    }
+
+    pthread_mutex_lock(&ctx->m_atcmd_mutex);
+    if (ctx->m_rx_state[cmd->m_setting] == cmd->m_value)
     {
+        ctx->m_atcmds_skipped++;
+        pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+        LOGT("%s skipped, the receiver is there already", cmd->m_line);
         return 0;
     }
+    epoch = ctx->m_rx_epoch;
+    ctx->m_atcmds_sent++;
+    pthread_mutex_unlock(&ctx->m_atcmd_mutex);
 
-    loc->flags   |= GPS_LOCATION_HAS_BEARING;
-    loc->bearing  = value;
-    return 0;
+    snprintf(cmd_buf, sizeof(cmd_buf), "%s\r", cmd->m_line);
+    ret = wl_send_at_line(ctx, cmd_index, cmd_buf, strlen(cmd_buf));
+
+    pthread_mutex_lock(&ctx->m_atcmd_mutex);
+    if (epoch == ctx->m_rx_epoch)
+    {
+        /*
+         * -2 never reached the receiver. An error or no answer at all may
+         * mean it reset, so nothing it acknowledged before is trusted.
+         */
+        if (-1 == ret)
+            wl_forget_rx_state_locked(ctx);
+        else if (0 == ret)
+        {
+            /*whatever ZGINIT resets is not known, only that it ran*/
+            if (WL_RX_INIT == cmd->m_setting)
+                wl_forget_rx_state_locked(ctx);
+            ctx->m_rx_state[cmd->m_setting] = cmd->m_value;
+        }
+    }
+    pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+
+    return ret;
 }
 
-static int wl_get_speed(GpsLocation *loc, Charseg speed)
+static int wl_send_at_cmd_internal(WlGpsContext *ctx, int cmd_index)
 {
-    Charseg seg = speed;
-
-    if (seg.m_beg >= seg.m_end)
+    if ((cmd_index <= 0) || (cmd_index >= (int)(sizeof(g_atcmds) / sizeof(g_atcmds[0])))
+        || (NULL == g_atcmds[cmd_index].m_line))
+    {
+        LOGD("Unknown command");
         return -1;
+    }
+    return wl_send_at_setting(ctx, cmd_index, &g_atcmds[cmd_index]);
+}
+
+/*continuous fixes every interval_s seconds, 0 for the receiver's own rate*/
+static int wl_send_fix_rate(WlGpsContext *ctx, int interval_s)
+{
+    char line[32];
+    WlAtCmd cmd = { line, WL_RX_FIXRATE, interval_s };
+
+    snprintf(line, sizeof(line), "AT+ZGFIXRATE=65535,%d", interval_s);
+    return wl_send_at_setting(ctx, ATCMD_ZGFIXRATE, &cmd);
+}
+
+/*the receiver's sentence mask has the WL_NMEA_* bits, 31 sends all five*/
+static int wl_send_nmea_types(WlGpsContext *ctx, unsigned int types)
+{
+    char line[32];
+    WlAtCmd cmd = { line, WL_RX_NMEA, (int)types };
+
+    snprintf(line, sizeof(line), "AT+ZGNMEA=%u", types);
+    return wl_send_at_setting(ctx, ATCMD_ZGNMEA, &cmd);
+}
+
+/*
+ * Streams one XTRA blob as AT+ZGXTRA=<total>,<offset>,<hex> lines, waiting
+ * for each chunk's "OK" before sending the next. Returns 1 when newer data
+ * arrived meanwhile and this blob is no longer worth finishing.
+ */
+static int wl_xtra_stream(WlGpsContext *ctx, const char *data, int length)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char line[WL_AT_LINE_LEN];
+    int offset, i;
+
+    for (offset = 0; offset < length; offset += WL_XTRA_CHUNK_SIZE)
+    {
+        int chunk = length - offset;
+        int len;
+
+        if (chunk > WL_XTRA_CHUNK_SIZE)
+            chunk = WL_XTRA_CHUNK_SIZE;
+
+        if (ctx->m_xtra_pending)
+            return 1;
+
+        len = sprintf(line, "AT+ZGXTRA=%d,%d,", length, offset);
+        for (i = 0; i < chunk; i++)
+        {
+            line[len++] = hex[((unsigned char)data[offset + i]) >> 4];
+            line[len++] = hex[((unsigned char)data[offset + i]) & 0x0f];
+        }
+        line[len++] = '\r';
+
+        if (wl_send_at_line(ctx, ATCMD_ZGXTRA, line, len) < 0)
+        {
+            LOGE("[wl_xtra_stream]:chunk at %d of %d rejected", offset, length);
+            return -1;
+        }
+
+        if ((offset / WL_XTRA_CHUNK_SIZE) % 64 == 0)
+            LOGD("[wl_xtra_stream]:%d of %d bytes sent", offset + chunk, length);
+    }
 
-    loc->flags  |= GPS_LOCATION_HAS_SPEED;
-    loc->speed = (1.852 / 3.6) * str2float(seg.m_beg, seg.m_end); 
     return 0;
 }
 
-static int wl_get_date(GpsLocation *loc, Charseg date, Charseg time)
+/*
+ * Injects whatever XTRA data is pending, then exits. A failed injection asks
+ * the framework for a fresh download, the only way GpsXtraCallbacks lets us
+ * tell it anything.
+ */
+static void wl_xtra_inject_thread(void *param)
 {
-    Charseg  seg = date;
-    int day, month, year;
+    WlGpsContext *ctx = (WlGpsContext *)param;
+    char *data;
+    int length;
+    int ret;
+
+    LOGD("[wl_xtra_inject_thread]:ENTER.");
+    wl_trace_thread_name("xtra");
 
-    if (seg.m_beg + 6 != seg.m_end) 
+    for (;;)
+    {
+        pthread_mutex_lock(&ctx->m_xtra_mutex);
+        data = ctx->m_xtra_pending;
+        length = ctx->m_xtra_pending_len;
+        ctx->m_xtra_pending = NULL;
+        if ((NULL == data) || !ctx->m_need_reading_nmea)
+        {
+            ctx->m_xtra_running = 0;
+            pthread_mutex_unlock(&ctx->m_xtra_mutex);
+            free(data);
+            break;
+        }
+        pthread_mutex_unlock(&ctx->m_xtra_mutex);
+
+        ret = wl_xtra_stream(ctx, data, length);
+        free(data);
+
+        if (0 == ret)
+        {
+            ctx->m_xtra_injected++;
+            LOGD("[wl_xtra_inject_thread]:%d bytes of XTRA data injected", length);
+        }
+        else if ((ret < 0) && ctx->m_need_reading_nmea)
+        {
+            ctx->m_xtra_failed++;
+            if (ctx->m_xtra_callbacks && ctx->m_xtra_callbacks->download_request_cb)
+                ctx->m_xtra_callbacks->download_request_cb();
+        }
+    }
+
+    LOGD("[wl_xtra_inject_thread]:EXIT.");
+    wl_thread_exit(ctx);
+}
+
+/*
+ * Only queues a copy of the data; the injector thread streams it to the
+ * receiver one acknowledged chunk at a time while NMEA keeps flowing.
+ */
+static int wl_gps_xtra_inject_xtra_data(char* data, int length) 
+{
+    WlGpsContext *ctx = &g_gps_ctx;
+    char *copy;
+    int ret = 0;
+
+    LOGD("Enter ql_gps_xtra_inject_xtra_data: %d bytes", length);
+
+    if ((NULL == data) || (length <= 0) || (ctx->m_is_internal_initialized == 0))
     {
-        LOGD("Date format error");
         return -1;
     }
-    
-    day  = str2int(seg.m_beg, seg.m_beg+2);
-    month  = str2int(seg.m_beg+2, seg.m_beg+4);
-    year = str2int(seg.m_beg+4, seg.m_beg+6) + 2000;
 
-    if ((day|month|year) < 0) 
+    copy = malloc(length);
+    if (NULL == copy)
     {
-        LOGD("Date format error");
         return -1;
     }
+    memcpy(copy, data, length);
+
+    pthread_mutex_lock(&ctx->m_xtra_mutex);
+    if (ctx->m_xtra_pending)
+    {
+        LOGD("Drop older XTRA data still waiting");
+    }
+    free(ctx->m_xtra_pending);
+    ctx->m_xtra_pending = copy;
+    ctx->m_xtra_pending_len = length;
+
+    if (ctx->m_xtra_running == 0)
+    {
+        ctx->m_xtra_running = 1;
+        if (0 == wl_create_thread(ctx, "wl_xtra_inject_thread", wl_xtra_inject_thread))
+        {
+            ctx->m_xtra_running = 0;
+            free(ctx->m_xtra_pending);
+            ctx->m_xtra_pending = NULL;
+            ret = -1;
+        }
+    }
+    pthread_mutex_unlock(&ctx->m_xtra_mutex);
+
+    return ret;
+}
+
+const GpsInterface* wl_get_gps_interface(struct gps_device_t* dev)
+{
+    LOGD("Enter wl_get_gps_interface");
+    return &wl_GpsInterface;
+}
+
+static int wl_open_gps(const struct hw_module_t* module, char const* name,
+        struct hw_device_t** device)
+{
+    LOGD("Enter wl_open_gps");
+    struct gps_device_t *dev = malloc(sizeof(struct gps_device_t));
+    memset(dev, 0, sizeof(*dev));
 
-    g_utc_info.m_year  = year;
-    g_utc_info.m_month   = month;
-    g_utc_info.m_day   = day;
+    dev->common.tag = HARDWARE_DEVICE_TAG;
+    dev->common.version = 0;
+    dev->common.module = (struct hw_module_t*)module;
+    //dev->common.close = NULL;
+    dev->get_gps_interface = wl_get_gps_interface;
+
+    *device = (struct hw_device_t*)dev;
+    return 0;
+}
+
+/*
+ * How much younger the newest buffered bytes are than the line ending at
+ * stream offset end. A line older than every remembered read is measured
+ * from the oldest one, which only makes it look fresher than it is.
+ */
+static int64_t wl_line_behind_ns(WlGpsContext *ctx, uint32_t end)
+{
+	unsigned int count = ctx->m_rx_arrival_count;
+	unsigned int first = (count > WL_RX_ARRIVALS) ? count - WL_RX_ARRIVALS : 0;
+	int64_t newest, arrived;
+	unsigned int i;
+
+	if (0 == count)
+		return 0;
+	newest = ctx->m_rx_arrivals[(count - 1) % WL_RX_ARRIVALS].m_ns;
+	arrived = newest;
+	/*the line arrived with the oldest read that ends at or after it*/
+	for (i = count; i-- > first; )
+	{
+		const WlRxArrival *arrival = &ctx->m_rx_arrivals[i % WL_RX_ARRIVALS];
+
+		if ((int32_t)(arrival->m_end - end) < 0)
+			break;
+		arrived = arrival->m_ns;
+	}
+	return newest - arrived;
+}
 
-    return wl_get_time(loc, time);
+/*
+ * Feeds the NMEA stream what the reader appended since the last call, up to
+ * the end of the next sentence; no byte is looked at twice. Returns the
+ * sentence length, 0 if a line was dropped and -1 once every buffered byte
+ * is taken without ending one. When behind_ns is given and STALE_MS is on,
+ * it is set to how much younger the newest buffered bytes are than the line.
+ */
+static int wl_take_line_from_buf(WlGpsContext *ctx, NmeaStream *stream, NmeaSentence *sentence,
+			int64_t *behind_ns)
+{
+	gps_info_buf *buf = &ctx->m_gps_info_buf;
+	int info_len = -1;
+	int taken = 0;
+	int ret;
+
+	wl_rx_lock(ctx);
+	ret = wl_nmea_stream_feed(stream, buf->m_buf + buf->m_start, buf->len - buf->m_start,
+		&taken, sentence);
+	/*no memmove per line, the reader compacts when it needs the room*/
+	buf->m_start += taken;
+	if(WL_NMEA_STREAM_TOO_LONG == ret)
+	{
+		LOGD("[wl_read_buffer_thread]:ERROR!THE INFO IS TOO LONG TO READ!");
+		ctx->m_lines_dropped++;
+		info_len = 0;
+	}
+	else if(WL_NMEA_STREAM_SENTENCE == ret)
+	{
+		info_len = sentence->m_len;
+		if (behind_ns && (ctx->m_config.m_stale_ms > 0))
+			*behind_ns = wl_line_behind_ns(ctx, ctx->m_rx_total - (buf->len - buf->m_start));
+	}
+
+	if(buf->m_start == buf->len)
+	{
+		buf->m_start = 0;
+		buf->len = 0;
+		buf->m_buf[0] = '\0';
+	}
+
+	if(info_len < 0)
+		ctx->m_read_buff_waiting = 1;
+	else if(info_len > 0)
+		ctx->m_lines_framed++;
+
+	/*a partial line is taken too, so any byte taken makes room*/
+	if((taken > 0) && ctx->m_read_port_waiting)
+	{
+		ctx->m_read_port_waiting = 0;
+		wl_wake_thread(ctx->m_read_port_evt);
+	}
+	wl_rx_unlock(ctx);
+
+	return info_len;
 }
 
-static void wl_parse_nmea_line(GpsLocation *loc, char *line_buf, int line_len)
+#ifdef WL_GPS_TRACE
+static int wl_trace_parse_span(const char *line, int len)
 {
-    NmeaInfoSegs info_segs[1];
-    Charseg seg;
-        
-    if (line_len < 9)
+	switch (wl_nmea_sentence_type(line, len))
+	{
+	case WL_NMEA_GGA: return WL_TRACE_PARSE_GGA;
+	case WL_NMEA_GSA: return WL_TRACE_PARSE_GSA;
+	case WL_NMEA_GSV: return WL_TRACE_PARSE_GSV;
+	case WL_NMEA_VTG: return WL_TRACE_PARSE_VTG;
+	case WL_NMEA_RMC: return WL_TRACE_PARSE_RMC;
+	default: return WL_TRACE_PARSE_OTHER;
+	}
+}
+#endif
+
+/*
+ * Decides at an epoch's first line whether it gets decoded. A shed epoch
+ * still goes to nmea_cb whole and closes at its RMC as usual.
+ */
+static const NmeaParseCallbacks *wl_start_epoch(WlGpsContext *ctx, int64_t behind_ns,
+			NmeaParseCallbacks *shed_callbacks)
+{
+	ctx->m_epoch_open = 1;
+	if ((ctx->m_config.m_stale_ms <= 0) || (behind_ns < (int64_t)ctx->m_config.m_stale_ms * 1000000))
+		return &ctx->m_parse_callbacks;
+
+	*shed_callbacks = ctx->m_parse_callbacks;
+	shed_callbacks->location_cb = NULL;
+	shed_callbacks->sv_status_cb = NULL;
+	ctx->m_epochs_shed++;
+	return shed_callbacks;
+}
+
+static void wl_read_buffer_thread(void *param) 
+{
+	WlGpsContext *ctx = (WlGpsContext *)param;
+	char *info = malloc(ctx->m_config.m_max_line + 1);
+	int info_len = 0;
+	NmeaStream stream;
+	NmeaSentence sentence;
+	const NmeaParseCallbacks *callbacks = &ctx->m_parse_callbacks;
+	NmeaParseCallbacks shed_callbacks;
+	int64_t behind_ns = 0;
+
+	LOGD("[wl_read_buffer_thread]:ENTER.");
+	wl_trace_thread_name("parser");
+	wl_apply_thread_policy(ctx, WL_THREAD_PARSER);
+	wl_lock_memory(ctx, info, ctx->m_config.m_max_line + 1);
+	if (NULL == info)
+	{
+		LOGE("[wl_read_buffer_thread]:can not allocate the line buffer");
+		ctx->m_need_reading_nmea = 0;
+		wl_wake_thread(ctx->m_read_port_evt);
+		wl_wake_thread(ctx->m_deliver_evt);
+	}
+	wl_nmea_stream_init(&stream, info, ctx->m_config.m_max_line);
+
+	while(ctx->m_need_reading_nmea)
+	{
+		WL_TRACE_BEGIN(WL_TRACE_FRAME, 0);
+		info_len = wl_take_line_from_buf(ctx, &stream, &sentence, ctx->m_epoch_open ? NULL : &behind_ns);
+		WL_TRACE_END(WL_TRACE_FRAME);
+		if(info_len < 0)
+		{
+			/*sleep until the reader brings more bytes or cleanup stops us*/
+			WL_TRACE_BEGIN(WL_TRACE_PARSER_IDLE, 0);
+			wl_wait_wakeup(ctx->m_read_buff_evt, -1);
+			WL_TRACE_END(WL_TRACE_PARSER_IDLE);
+			wl_note_wakeup(&ctx->m_parser_latency, &ctx->m_parser_woken_ns);
+			ctx->m_parser_wakeups++;
+			continue;
+		}
+		else if(0 == info_len)
+		{
+			continue;
+		}
+		else if(WL_NMEA_CHECKSUM_BAD == sentence.m_checksum)
+		{
+			LOGD("[wl_read_buffer_thread]:checksum wrong, dropped: %s", info);
+			ctx->m_lines_bad_checksum++;
+			continue;
+		}
+		if (sentence.m_fields_cut)
+			ctx->m_lines_fields_cut++;
+
+		LOGT("Get one line: %.*s", info_len, info);
+		if ((ctx->m_cur_atcmd != 0) && (((info_len >= 2) && (info[0] == 'O') && (info[1] == 'K'))
+			|| ((info_len >= 5) && !strncmp(info, "ERROR", 5))))
+		{
+			LOGT("wl_read_buffer_thread]:Find response of atcmd");
+			pthread_mutex_lock(&ctx->m_atcmd_mutex);
+			ctx->m_atcmd_error = (info[0] == 'E');
+			ctx->m_cur_atcmd = 0;
+			/*the sender and any command waiting for its turn*/
+			pthread_cond_broadcast(&ctx->m_atcmd_cond);
+			pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+		}
+		else
+		{
+			if (!ctx->m_epoch_open)
+			{
+				callbacks = wl_start_epoch(ctx, behind_ns, &shed_callbacks);
+				behind_ns = 0;
+			}
+			WL_TRACE_BEGIN(wl_trace_parse_span(info, info_len), info_len);
+			wl_parse_nmea_sentence(&ctx->m_parse, callbacks, &sentence);
+			WL_TRACE_END(wl_trace_parse_span(info, info_len));
+		}
+	}
+
+	wl_unlock_memory(ctx, info, ctx->m_config.m_max_line + 1);
+	free(info);
+	LOGD("[wl_read_buffer_thread]:EXIT.");
+	wl_thread_exit(ctx);
+}
+
+/*
+ * Whether a fix is worth a location_cb, measured against the last one that
+ * was. Constant time, the distance is flat-earth with the cosine of the
+ * last delivered fix worked out once.
+ */
+static int wl_filter_fix(WlGpsContext *ctx, const GpsLocation *location)
+{
+    const WlGpsConfig *config = &ctx->m_config;
+    const GpsLocation *last = &ctx->m_filter_last;
+    int64_t now_ms = wl_now_ns() / 1000000;
+    int pass;
+
+    if (ctx->m_filter_restart)
     {
-        LOGD("Len=%d, too short for a nmea line", line_len);
-        return;
+        ctx->m_filter_restart = 0;
+        ctx->m_filter_have_last = 0;
     }
 
-    if (0 == wl_get_all_segments_from_buf(info_segs, line_buf, line_len))
+    pass = !config->m_filter || !ctx->m_filter_have_last;
+    if (!pass && (config->m_filter_heartbeat_ms > 0))
+        pass = (now_ms - ctx->m_filter_last_ms >= config->m_filter_heartbeat_ms);
+    if (!pass && (config->m_filter_distance > 0))
     {
-        LOGD("No valid segments get");
-        return;
+        double dlon = location->longitude - last->longitude;
+        double dx, dy;
+
+        if (dlon > 180.0)
+            dlon -= 360.0;
+        else if (dlon < -180.0)
+            dlon += 360.0;
+        dx = dlon * WL_METERS_PER_DEG * ctx->m_filter_cos_lat;
+        dy = (location->latitude - last->latitude) * WL_METERS_PER_DEG;
+        pass = (dx * dx + dy * dy >= config->m_filter_distance * config->m_filter_distance);
+    }
+    if (!pass && (config->m_filter_bearing > 0)
+        && (location->flags & last->flags & GPS_LOCATION_HAS_BEARING))
+    {
+        double turn = fabs(location->bearing - last->bearing);
+
+        if (turn > 180.0)
+            turn = 360.0 - turn;
+        pass = (turn >= config->m_filter_bearing);
     }
+    if (!pass && (config->m_filter_speed > 0)
+        && (location->flags & last->flags & GPS_LOCATION_HAS_SPEED))
+        pass = (fabs(location->speed - last->speed) >= config->m_filter_speed);
 
-    seg = wl_get_segments_by_index(info_segs, 0);
-    if (seg.m_beg + 5 > seg.m_end)
+    if (!pass)
     {
-        LOGD("NMEA Token string too short");
-        return;
+        ctx->m_fixes_filtered++;
+        return 0;
     }
 
-    seg.m_beg += 2;
+    ctx->m_filter_last = *location;
+    ctx->m_filter_cos_lat = cos(location->latitude * WL_DEG_TO_RAD);
+    ctx->m_filter_last_ms = now_ms;
+    ctx->m_filter_have_last = 1;
+    ctx->m_fixes_delivered++;
+    return 1;
+}
+
+/*
+ * Whether the device looks still at this fix: slow, not turning, and with
+ * the fixes since it came to rest neither spread out nor drifting away.
+ * Anything else takes the fix as the new resting point.
+ */
+static int wl_motion_still(WlGpsContext *ctx, const GpsLocation *location)
+{
+    const WlGpsConfig *config = &ctx->m_config;
+    double radius2 = config->m_adaptive_still_radius * config->m_adaptive_still_radius;
+    double dlon, dx, dy, ex, ey;
+    int still = ctx->m_motion_have;
+
+    if (!(location->flags & GPS_LOCATION_HAS_LAT_LONG))
+        return 0;
 
-    if ((!memcmp(seg.m_beg, "GGA", 3))
-        || (!memcmp(seg.m_beg, "GSA", 3))
-        || (!memcmp(seg.m_beg, "GSV", 3))
-        || (!memcmp(seg.m_beg, "VTG", 3))
-        || (!memcmp(seg.m_beg, "RMC", 3) ) )
+    if ((location->flags & GPS_LOCATION_HAS_SPEED) && (location->speed >= config->m_adaptive_still_speed))
+        still = 0;
+    /*the bearing of a device that barely moves is noise*/
+    if (still && (location->flags & GPS_LOCATION_HAS_BEARING) && (location->flags & GPS_LOCATION_HAS_SPEED)
+        && (location->speed >= config->m_adaptive_still_speed / 2))
     {
-        if (p_java_layer_callback->nmea_cb)
-        {
-            time_t cur_time = time(NULL);
-            p_java_layer_callback->nmea_cb(cur_time, line_buf, line_len);
-        }
+        double turn = fabs(location->bearing - ctx->m_motion_bearing);
+
+        if (turn > 180.0)
+            turn = 360.0 - turn;
+        if (turn >= config->m_adaptive_turn)
+            still = 0;
     }
-    else
+    ctx->m_motion_bearing = location->bearing;
+
+    if (still)
     {
-        LOGD("Not a correct NMEA line: %.*s", line_len, line_buf);
-        return;
+        dlon = location->longitude - ctx->m_motion_lon;
+        if (dlon > 180.0)
+            dlon -= 360.0;
+        else if (dlon < -180.0)
+            dlon += 360.0;
+        dx = dlon * WL_METERS_PER_DEG * ctx->m_motion_cos_lat;
+        dy = (location->latitude - ctx->m_motion_lat) * WL_METERS_PER_DEG;
+        ctx->m_motion_east += WL_MOTION_ALPHA * (dx - ctx->m_motion_east);
+        ctx->m_motion_north += WL_MOTION_ALPHA * (dy - ctx->m_motion_north);
+        ex = dx - ctx->m_motion_east;
+        ey = dy - ctx->m_motion_north;
+        ctx->m_motion_var += WL_MOTION_ALPHA * (ex * ex + ey * ey - ctx->m_motion_var);
+        if ((ctx->m_motion_var >= radius2)
+            || (ctx->m_motion_east * ctx->m_motion_east + ctx->m_motion_north * ctx->m_motion_north >= radius2))
+            still = 0;
     }
 
-    if (!memcmp(seg.m_beg, "GGA", 3))
+    if (!still)
     {
-        Charseg  seg_time          = wl_get_segments_by_index(info_segs,1);
-        Charseg  seg_latitude      = wl_get_segments_by_index(info_segs,2);
-        Charseg  seg_latitudeHemi  = wl_get_segments_by_index(info_segs,3);
-        Charseg  seg_longitude     = wl_get_segments_by_index(info_segs,4);
-        Charseg  seg_longitudeHemi = wl_get_segments_by_index(info_segs,5);
-        Charseg  seg_altitude      = wl_get_segments_by_index(info_segs,9);
-        Charseg  seg_altitudeUnits = wl_get_segments_by_index(info_segs,10);
-
-        wl_get_latlong(loc, seg_latitude, seg_latitudeHemi, seg_longitude, seg_longitudeHemi);
-        wl_get_altitude(loc, seg_altitude, seg_altitudeUnits);
-        wl_get_time(loc, seg_time);
+        ctx->m_motion_lat = location->latitude;
+        ctx->m_motion_lon = location->longitude;
+        ctx->m_motion_cos_lat = cos(location->latitude * WL_DEG_TO_RAD);
+        ctx->m_motion_east = 0;
+        ctx->m_motion_north = 0;
+        ctx->m_motion_var = 0;
+        ctx->m_motion_have = 1;
     }
-    else if (!memcmp(seg.m_beg, "GSA", 3))
+    return still;
+}
+
+/*starts the settings thread when a session's receiver is behind, m_rx_setting_mutex held*/
+static void wl_kick_rx_setting_locked(WlGpsContext *ctx)
+{
+    if (ctx->m_rx_setting_running || ctx->m_session_ending
+        || (ctx->m_cur_gps_status != GPS_STATUS_SESSION_BEGIN))
+        return;
+    if ((ctx->m_rate_wanted == ctx->m_rate_applied) && (ctx->m_nmea_wanted == ctx->m_nmea_applied))
+        return;
+
+    ctx->m_rx_setting_running = 1;
+    if (0 == wl_create_thread(ctx, "wl_rx_setting_thread", wl_rx_setting_thread))
+        ctx->m_rx_setting_running = 0;
+}
+
+static void wl_request_fix_rate(WlGpsContext *ctx, int interval_s)
+{
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    if (interval_s != ctx->m_rate_wanted)
     {
-        Charseg seg_acc = wl_get_segments_by_index(info_segs, 15);
+        ctx->m_rate_wanted = interval_s;
+        wl_kick_rx_setting_locked(ctx);
+    }
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+}
 
-        loc->accuracy = str2float(seg_acc.m_beg, seg_acc.m_end);
-        loc->flags |= GPS_LOCATION_HAS_ACCURACY;
+/*
+ * The WL_NMEA_* types someone uses. RMC closes every epoch. A fix takes GGA,
+ * RMC and the accuracy from GSA, whether it goes to location_cb, the
+ * geofences or the history; SV status takes GSA and GSV; nmea_cb whatever
+ * its listeners and NMEA_FORWARD both name. VTG only repeats what RMC has.
+ */
+static unsigned int wl_wanted_nmea_types_locked(WlGpsContext *ctx, int fences)
+{
+    const GpsCallbacks *callbacks = ctx->m_callbacks;
+    unsigned int types = WL_NMEA_RMC;
+
+    if ((callbacks && callbacks->location_cb) || (fences > 0) || (ctx->m_config.m_history_len > 0))
+        types |= WL_NMEA_GGA | WL_NMEA_GSA;
+    if (callbacks && callbacks->sv_status_cb && ctx->m_sv_status_listened)
+        types |= WL_NMEA_GSA | WL_NMEA_GSV;
+    if (callbacks && callbacks->nmea_cb)
+        types |= ctx->m_nmea_listened & ctx->m_config.m_nmea_forward;
+    return types;
+}
 
-        int i;
-        int temp_number;
-        Charseg seg_satellite_using;
+/*after a change in who listens, a running session's receiver follows*/
+static void wl_update_nmea_wanted(WlGpsContext *ctx)
+{
+    int fences;
 
-        memset(&g_satellites_info, 0, sizeof(UsingSatellitesInfo));//Added
-        for (i=0; i<12; i++)
-        {
-            seg_satellite_using = wl_get_segments_by_index(info_segs, i+3);
-            temp_number = str2int(seg_satellite_using.m_beg, seg_satellite_using.m_end);
+    pthread_mutex_lock(&ctx->m_geofence_mutex);
+    fences = ctx->m_geofence.m_ids.m_count;
+    pthread_mutex_unlock(&ctx->m_geofence_mutex);
 
-            if (0 == temp_number)
-            {
-                break;
-            }
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    ctx->m_nmea_wanted = wl_wanted_nmea_types_locked(ctx, fences);
+    wl_kick_rx_setting_locked(ctx);
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+}
 
-            g_satellites_info.m_count++;
-            g_satellites_info.m_number[i] = temp_number;
-        }
+/*
+ * ADAPTIVE_RATE, on the delivery thread for every fix. Slows down only after
+ * WL_ADAPTIVE_STILL_FIXES still fixes in a row, speeds up at the first that
+ * is not. Also splits the session's time and lines between the two rates.
+ */
+static void wl_adapt_fix_rate(WlGpsContext *ctx, const GpsLocation *location)
+{
+    const WlGpsConfig *config = &ctx->m_config;
+    int64_t now_ms = wl_now_ns() / 1000000;
+    /*counted by the buffer thread, read like wl_gps_get_rx_stats does*/
+    unsigned int lines = __atomic_load_n(&ctx->m_lines_framed, __ATOMIC_RELAXED);
+    int idle_s, slowed;
 
-        g_sv_status_flag |= 0x01;
-    }
-    else if (!memcmp(seg.m_beg, "GSV", 3))
+    if (!config->m_adaptive_rate || ctx->m_session_single)
+        return;
+    if (ctx->m_rate_restart)
     {
-        Charseg seg_msg_index = wl_get_segments_by_index(info_segs, 2);
-        volatile int msg_index = str2int(seg_msg_index.m_beg, seg_msg_index.m_end);
-        Charseg seg_satellites_visble = wl_get_segments_by_index(info_segs, 3);
-        volatile int satellites_visble = str2int(seg_satellites_visble.m_beg, seg_satellites_visble.m_end);
-        GpsSvStatus *p_gps_sv_status = &g_sv_status_info;
-
-        g_sv_status_flag |= (1<<msg_index);
+        ctx->m_rate_restart = 0;
+        ctx->m_motion_have = 0;
+        ctx->m_still_fixes = 0;
+        ctx->m_rate_mark_ms = now_ms;
+        ctx->m_rate_mark_lines = lines;
+    }
 
-        p_gps_sv_status->size = sizeof(GpsSvStatus);
-        p_gps_sv_status->num_svs = satellites_visble;
+    /*the settings thread writes the applied rate*/
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    slowed = (ctx->m_rate_applied != ctx->m_session_interval_s);
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+    ctx->m_rate_ms[slowed] += now_ms - ctx->m_rate_mark_ms;
+    ctx->m_rate_lines[slowed] += lines - ctx->m_rate_mark_lines;
+    ctx->m_rate_mark_ms = now_ms;
+    ctx->m_rate_mark_lines = lines;
+
+    ctx->m_still_fixes = wl_motion_still(ctx, location) ? ctx->m_still_fixes + 1 : 0;
+    idle_s = (config->m_adaptive_idle_s > ctx->m_session_interval_s)
+        ? config->m_adaptive_idle_s : ctx->m_session_interval_s;
+    wl_request_fix_rate(ctx, (ctx->m_still_fixes >= WL_ADAPTIVE_STILL_FIXES)
+        ? idle_s : ctx->m_session_interval_s);
+}
 
-        volatile int temp;
-        if((satellites_visble / 4) < msg_index)
-        {
-            temp = satellites_visble % 4;
-        }
-        else
-        {
-            temp = 4;
-        }
+/*
+ * Stop's first step: no setting may follow the commands that end the
+ * session, so the settings thread is told to go and waited for.
+ */
+static void wl_end_rx_settings(WlGpsContext *ctx)
+{
+    struct timespec deadline;
 
-        LOGD("satellites visible = %d messages index = %d\n",satellites_visble,msg_index);
-        
-        int i;
-        for(i = 0; i < temp;i++)
+    wl_get_deadline(&deadline, WL_RX_SETTING_EXIT_TIMEOUT_MS);
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    ctx->m_session_ending = 1;
+    while (ctx->m_rx_setting_running)
+    {
+        if (ETIMEDOUT == pthread_cond_timedwait(&ctx->m_rx_setting_cond, &ctx->m_rx_setting_mutex, &deadline))
         {
-            p_gps_sv_status->sv_list[i + 4 * (msg_index - 1)].size = sizeof(GpsSvInfo);
-            
-            Charseg seg_prn = wl_get_segments_by_index(info_segs, 4 + i * 4);
-            int prn = str2int(seg_prn.m_beg,seg_prn.m_end);                
-            p_gps_sv_status->sv_list[i + 4 * (msg_index - 1)].prn = prn;
-            
-            Charseg seg_elevation = wl_get_segments_by_index(info_segs,5 + i * 4);
-            float elevation = str2float(seg_elevation.m_beg,seg_elevation.m_end);
-            p_gps_sv_status->sv_list[i + 4 * (msg_index - 1)].elevation = elevation;
-            
-            Charseg seg_azimuth = wl_get_segments_by_index(info_segs,6 + i * 4);
-            float azimuth = str2float(seg_azimuth.m_beg,seg_azimuth.m_end);
-            p_gps_sv_status->sv_list[i + 4 * (msg_index - 1)].azimuth = azimuth;
-            
-            Charseg seg_snr = wl_get_segments_by_index(info_segs,7 + i * 4);
-            float snr = str2float(seg_snr.m_beg,seg_snr.m_end);
-            p_gps_sv_status->sv_list[ i + 4 * (msg_index - 1)].snr = snr;
-
-            LOGD("prn:%d snr:%f elevation:%f azimuth:%f\n",prn,snr,elevation,azimuth);
+            LOGE("[wl_end_rx_settings]:settings thread still sending, stopping anyway");
+            break;
         }
     }
-    else if ( !memcmp(seg.m_beg, "VTG", 3))
-    {
-        Charseg seg_bearing = wl_get_segments_by_index(info_segs,1);
-        Charseg seg_speed = wl_get_segments_by_index(info_segs,5);
-        wl_get_bearing(loc, seg_bearing);
-        wl_get_speed(loc, seg_speed);
-    }
-    else if ( !memcmp(seg.m_beg, "RMC", 3) ) 
-    {
-        Charseg seg_time = wl_get_segments_by_index(info_segs,1);
-        Charseg seg_fixStatus = wl_get_segments_by_index(info_segs,2);
-        Charseg seg_latitude = wl_get_segments_by_index(info_segs,3);
-        Charseg seg_latitudeHemi = wl_get_segments_by_index(info_segs,4);
-        Charseg seg_longitude = wl_get_segments_by_index(info_segs,5);
-        Charseg seg_longitudeHemi = wl_get_segments_by_index(info_segs,6);
-        Charseg seg_speed = wl_get_segments_by_index(info_segs,7);
-        Charseg seg_bearing = wl_get_segments_by_index(info_segs,8);
-        Charseg seg_date = wl_get_segments_by_index(info_segs,9);
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+}
+
+/*
+ * Sends what a session's receiver is behind on, one setting at a time, and
+ * goes when it has caught up or the session ends. A setting the receiver
+ * refused is tried again at the next change.
+ */
+static void wl_rx_setting_thread(void *param)
+{
+    WlGpsContext *ctx = (WlGpsContext *)param;
+    int interval_s;
+    unsigned int types;
+    int rate_behind;
+    int ret;
 
-        LOGD("fixStatus=%c", seg_fixStatus.m_beg[0]);
-        if (seg_fixStatus.m_beg[0] == 'A')
+    LOGD("[wl_rx_setting_thread]:ENTER.");
+    wl_trace_thread_name("rxsetting");
+
+    for (;;)
+    {
+        pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+        interval_s = ctx->m_rate_wanted;
+        types = ctx->m_nmea_wanted;
+        rate_behind = (interval_s != ctx->m_rate_applied);
+        if ((!rate_behind && (types == ctx->m_nmea_applied)) || !ctx->m_need_reading_nmea
+            || ctx->m_session_ending || (ctx->m_cur_gps_status != GPS_STATUS_SESSION_BEGIN))
         {
-            wl_get_latlong(loc, seg_latitude, seg_latitudeHemi, seg_longitude, seg_longitudeHemi);
-            wl_get_date(loc, seg_date, seg_time);
-            wl_get_bearing(loc, seg_bearing);
-            wl_get_speed  (loc, seg_speed);
+            ctx->m_rx_setting_running = 0;
+            pthread_cond_broadcast(&ctx->m_rx_setting_cond);
+            pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+            break;
         }
-        {
-            unsigned int i;
-            g_sv_status_info.used_in_fix_mask &= 0x00;
-            
-            for(i = 0;i < g_satellites_info.m_count;i++)
-            {
-                if (g_satellites_info.m_number[i] <= 32)
-                    g_sv_status_info.used_in_fix_mask |= (0x01 << (g_satellites_info.m_number[i] - 1)); 
-            }
-            
-            g_sv_status_flag = 0;
-            if (p_java_layer_callback->sv_status_cb)
-                p_java_layer_callback->sv_status_cb(&g_sv_status_info);
-            
-            memset(&g_sv_status_info, 0, sizeof(GpsSvStatus));
-            memset(&g_satellites_info, 0, sizeof(UsingSatellitesInfo));
-        } 
-    }
+        pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
 
-    if (loc->flags == 0x1f)
-    {
-        char   temp[256];
-        char*  beg   = temp;
-        char*  end = beg + sizeof(temp);
-        struct tm   utc;
+        ret = rate_behind ? wl_send_fix_rate(ctx, interval_s) : wl_send_nmea_types(ctx, types);
 
-        beg += snprintf(beg, end-beg, "Location info:" );
-        if (loc->flags & GPS_LOCATION_HAS_LAT_LONG) 
+        pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+        if (ret < 0)
         {
-            beg += snprintf(beg, end-beg, " lat=%g lon=%g", loc->latitude, loc->longitude);
+            if (rate_behind)
+                ctx->m_rate_failed++;
+            else
+                ctx->m_nmea_failed++;
+            ctx->m_rx_setting_running = 0;
+            pthread_cond_broadcast(&ctx->m_rx_setting_cond);
+            pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+            if (rate_behind)
+                LOGD("[wl_rx_setting_thread]:receiver did not take a fix every %ds", interval_s);
+            else
+                LOGD("[wl_rx_setting_thread]:receiver did not take sentences 0x%x", types);
+            break;
         }
-        if (loc->flags & GPS_LOCATION_HAS_ALTITUDE) 
+        if (rate_behind)
         {
-            beg += snprintf(beg, end-beg, " altitude=%g", loc->altitude);
+            ctx->m_rate_applied = interval_s;
+            ctx->m_rate_changes++;
         }
-        if (loc->flags & GPS_LOCATION_HAS_SPEED) 
+        else
         {
-            beg += snprintf(beg, end-beg, " speed=%g", loc->speed);
+            ctx->m_nmea_applied = types;
+            ctx->m_nmea_changes++;
         }
-        if (loc->flags & GPS_LOCATION_HAS_BEARING) 
+        pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+        if (rate_behind)
+            LOGD("[wl_rx_setting_thread]:a fix every %ds now", interval_s);
+        else
+            LOGD("[wl_rx_setting_thread]:sentences 0x%x now", types);
+    }
+
+    LOGD("[wl_rx_setting_thread]:EXIT.");
+    wl_thread_exit(ctx);
+}
+
+/*
+ * Calls the framework with what the buffer thread reported: the queued
+ * sentences first, then the latest SV status and fix they led up to.
+ */
+static void wl_deliver_thread(void *param)
+{
+    WlGpsContext *ctx = (WlGpsContext *)param;
+    WlNmeaBatch *batch;
+    GpsLocation location;
+    GpsSvStatus sv_status;
+    int nmea_count;
+    int has_location, has_sv_status;
+
+    LOGD("[wl_deliver_thread]:ENTER.");
+    wl_trace_thread_name("deliver");
+    wl_apply_thread_policy(ctx, WL_THREAD_DELIVER);
+
+    while (ctx->m_need_reading_nmea)
+    {
+        pthread_mutex_lock(&ctx->m_deliver_mutex);
+        nmea_count = ctx->m_nmea_count;
+        if ((0 == nmea_count) && !ctx->m_location_ready && !ctx->m_sv_status_ready)
         {
-            beg += snprintf(beg, end-beg, " bearing=%g", loc->bearing);
+            /*anything reported from now on rings m_deliver_evt again*/
+            ctx->m_deliver_signalled = 0;
+            pthread_mutex_unlock(&ctx->m_deliver_mutex);
+            WL_TRACE_BEGIN(WL_TRACE_DELIVER_IDLE, 0);
+            wl_wait_wakeup(ctx->m_deliver_evt, -1);
+            WL_TRACE_END(WL_TRACE_DELIVER_IDLE);
+            ctx->m_deliver_wakeups++;
+            wl_note_wakeup(&ctx->m_deliver_latency, &ctx->m_deliver_woken_ns);
+            continue;
         }
-        if (loc->flags & GPS_LOCATION_HAS_ACCURACY) 
+        pthread_mutex_unlock(&ctx->m_deliver_mutex);
+
+        /*only what was there already, so a fast talker cannot starve the fix*/
+        while (nmea_count-- > 0)
         {
-            beg += snprintf(beg,end-beg, " accuracy=%g", loc->accuracy);
+            const char *line;
+            int i;
+
+            /*committed batches stay ours until the head moves past them*/
+            batch = &ctx->m_nmea_queue[ctx->m_nmea_head];
+            line = batch->m_data;
+            for (i = 0; i < batch->m_count; i++)
+            {
+                WL_TRACE_BEGIN(WL_TRACE_NMEA_CB, batch->m_len[i]);
+                ctx->m_callbacks->nmea_cb(batch->m_timestamp, line, batch->m_len[i]);
+                WL_TRACE_END(WL_TRACE_NMEA_CB);
+                line += batch->m_len[i] + 1;
+            }
+
+            pthread_mutex_lock(&ctx->m_deliver_mutex);
+            ctx->m_nmea_head = (ctx->m_nmea_head + 1) % WL_NMEA_QUEUE_LEN;
+            ctx->m_nmea_count--;
+            pthread_mutex_unlock(&ctx->m_deliver_mutex);
         }
-        localtime_r( (time_t*) &loc->timestamp, &utc );
-        beg += snprintf(beg, end-beg, " time=%s", asctime( &utc ) );
-        LOGD("%s",temp);
-        
-        if (p_java_layer_callback->location_cb) 
+
+        pthread_mutex_lock(&ctx->m_deliver_mutex);
+        has_sv_status = ctx->m_sv_status_ready;
+        if (has_sv_status)
+            sv_status = ctx->m_sv_status_slot;
+        has_location = ctx->m_location_ready;
+        if (has_location)
+            location = ctx->m_location_slot;
+        ctx->m_sv_status_ready = 0;
+        ctx->m_location_ready = 0;
+        pthread_mutex_unlock(&ctx->m_deliver_mutex);
+
+        if (has_sv_status)
         {
-            p_java_layer_callback->location_cb(loc);
-            loc->flags &= 0x0;
-            loc->latitude = 0.0;
-            loc->longitude = 0.0;
-            loc->altitude = 0.0;
-            loc->speed = 0.0;
-            loc->bearing = 0.0;
-            loc->accuracy = 0.0;
+            WL_TRACE_BEGIN(WL_TRACE_SV_STATUS_CB, sv_status.num_svs);
+            ctx->m_callbacks->sv_status_cb(&sv_status);
+            WL_TRACE_END(WL_TRACE_SV_STATUS_CB);
         }
-        else 
+        if (has_location)
         {
-            LOGD("No callback function for report location");
+            wl_adapt_fix_rate(ctx, &location);
+            if (ctx->m_history.m_cap)
+            {
+                pthread_mutex_lock(&ctx->m_history_mutex);
+                wl_history_add(&ctx->m_history, &location);
+                pthread_mutex_unlock(&ctx->m_history_mutex);
+            }
+            if (ctx->m_callbacks->location_cb && wl_filter_fix(ctx, &location))
+            {
+                WL_TRACE_BEGIN(WL_TRACE_LOCATION_CB, 0);
+                ctx->m_callbacks->location_cb(&location);
+                WL_TRACE_END(WL_TRACE_LOCATION_CB);
+            }
+            if (ctx->m_geofence_callbacks)
+            {
+                WL_TRACE_BEGIN(WL_TRACE_GEOFENCE_CHECK, 0);
+                wl_check_geofences(ctx, &location);
+                WL_TRACE_END(WL_TRACE_GEOFENCE_CHECK);
+            }
         }
-    }  
+    }
+
+    LOGD("[wl_deliver_thread]:EXIT.");
+    wl_thread_exit(ctx);
 }
 
-static void wl_report_cur_state(GpsStatusValue status)
+/*WL_NMEA_* bits named in a list like "GGA,RMC", or ALL or NONE*/
+static unsigned int wl_parse_nmea_types(char *value)
 {
-    GpsStatus gps_stat;
+    unsigned int mask = 0;
+    char *save = NULL;
+    char *name;
 
-    gps_stat.size = sizeof(GpsStatus);
-    gps_stat.status = status;
-    
-    p_java_layer_callback->status_cb(&gps_stat);
-    return;
+    for (name = strtok_r(value, ", \t", &save); name; name = strtok_r(NULL, ", \t", &save))
+    {
+        if (!strcmp(name, "ALL"))
+            mask |= WL_NMEA_ALL;
+        else if (!strcmp(name, "NONE"))
+            mask = 0;
+        else if (!strcmp(name, "GGA"))
+            mask |= WL_NMEA_GGA;
+        else if (!strcmp(name, "GSA"))
+            mask |= WL_NMEA_GSA;
+        else if (!strcmp(name, "GSV"))
+            mask |= WL_NMEA_GSV;
+        else if (!strcmp(name, "VTG"))
+            mask |= WL_NMEA_VTG;
+        else if (!strcmp(name, "RMC"))
+            mask |= WL_NMEA_RMC;
+        else
+            LOGD("[wl_parse_nmea_types]:unknown sentence type %s", name);
+    }
+    return mask;
 }
 
-static int wl_gps_xtra_init(GpsXtraCallbacks* callbacks) 
+static char *wl_trim(char *str)
 {
-    LOGD("Enter ql_gps_xtra_init");
-    p_java_layer_xtra_callbacks = callbacks;
-    return 0;
+    char *end;
+
+    while ((*str == ' ') || (*str == '\t'))
+        str++;
+    end = str + strlen(str);
+    while ((end > str) && ((end[-1] == ' ') || (end[-1] == '\t') || (end[-1] == '\r') || (end[-1] == '\n')))
+        end--;
+    *end = '\0';
+    return str;
 }
 
-static int wl_gps_xtra_inject_xtra_data(char* data, int length) 
+/*CPU lists like 0,2-3; CPUs past 63 are ignored*/
+static uint64_t wl_parse_cpus(const char *value)
 {
-    LOGD("Enter ql_gps_xtra_inject_xtra_data");
-    return 0;
-}
+    uint64_t cpus = 0;
+    char *end;
 
-static int wl_gps_init_internal_process()
-{
-    g_need_reading_nmea = 1;
-    g_read_port_thread = p_java_layer_callback->create_thread_cb( "wl_read_port_thread", wl_read_port_thread, NULL);
+    while (*value)
+    {
+        long first = strtol(value, &end, 10);
+        long last = first;
 
-    return 0;
+        if (end == value)
+            break;
+        if (*end == '-')
+        {
+            value = end + 1;
+            last = strtol(value, &end, 10);
+            if (end == value)
+                break;
+        }
+        for (; (first <= last) && (first < 64); first++)
+        {
+            if (first >= 0)
+                cpus |= 1ULL << first;
+        }
+        value = end;
+        if (*value == ',')
+            value++;
+    }
+    return cpus;
 }
 
-static int wl_send_at_cmd_internal(int cmd_index)
+/*
+ * READER_SCHED, PARSER_CPUS and the like. -1 when the key is none of them.
+ */
+static int wl_parse_thread_policy(WlGpsConfig *config, const char *key, const char *value)
 {
-    char cmd_buf[32] = {0};
-    int retry = 30;
-    if (g_nmea_fd < 0)
-    {
-        return -1;
-    }
+    WlThreadPolicy *policy = NULL;
+    const char *suffix = NULL;
+    int i;
 
-    if (g_cur_atcmd != 0)
+    for (i = 0; i < WL_THREAD_POLICY_COUNT; i++)
     {
-        LOGD("AT port busy");
-        return -2;
-    }
-    
-    g_cur_atcmd = cmd_index;
-
-    switch(cmd_index)
-    {
-    case ATCMD_ZGINIT:
-        strcpy(cmd_buf, "AT+ZGINIT");
-        break;
-    case ATCMD_ZGMODE_3:
-        strcpy(cmd_buf, "AT+ZGMODE=3");
-        break;
-    case ATCMD_ZGNMEA_31:
-        strcpy(cmd_buf, "AT+ZGNMEA=31");
-        break;
-    case ATCMD_ZGNMEA_0:
-        strcpy(cmd_buf, "AT+ZGNMEA=0");
-        break;
-    case ATCMD_ZGRUN_0:
-        strcpy(cmd_buf, "AT+ZGRUN=0");
-        break;
-    case ATCMD_ZGRUN_2:
-		strcpy(cmd_buf, "AT+ZGRUN=2");
-		break;
-	case ATCMD_ZGFIXRATE_65535:
-		strcpy(cmd_buf, "AT+ZGFIXRATE=65535,0");
-		break;	
-	case ATCMD_ZGFIXRATE_1:
-		strcpy(cmd_buf, "AT+ZGFIXRATE=1,0");
-		break;
-    default:
-        LOGD("Unknown command");
-        return -1;
-        break;
-    }
-
-    strcat(cmd_buf, "\r");
-    
-    write(g_nmea_fd, cmd_buf, strlen(cmd_buf));
+        size_t len = strlen(g_thread_policy_names[i]);
 
-    while (retry-- > 0)
-    {
-        if (g_cur_atcmd == 0)
+        if (!strncmp(key, g_thread_policy_names[i], len) && (key[len] == '_'))
         {
+            policy = &config->m_thread_policy[i];
+            suffix = key + len + 1;
             break;
         }
-
-        usleep(200000);
     }
+    if (NULL == policy)
+        return -1;
 
-    if (g_cur_atcmd != 0)
+    if (!strcmp(suffix, "CPUS"))
     {
-        LOGD("AT command error");
-        g_cur_atcmd = 0;
-        return -1;
+        policy->m_cpus = wl_parse_cpus(value);
+        return 0;
     }
+    if (strcmp(suffix, "SCHED"))
+        return -1;
 
+    policy->m_sched_set = 1;
+    policy->m_priority = 0;
+    policy->m_nice = 0;
+    if (!strncmp(value, "FIFO:", 5))
+    {
+        policy->m_policy = SCHED_FIFO;
+        policy->m_priority = atoi(value + 5);
+    }
+    else if (!strncmp(value, "RR:", 3))
+    {
+        policy->m_policy = SCHED_RR;
+        policy->m_priority = atoi(value + 3);
+    }
+    else if (!strncmp(value, "NICE:", 5))
+    {
+        policy->m_policy = SCHED_OTHER;
+        policy->m_nice = atoi(value + 5);
+    }
+    else
+    {
+        if (strcmp(value, "OTHER"))
+            LOGD("[wl_parse_thread_policy]:%s=%s is not a policy, using OTHER", key, value);
+        policy->m_policy = SCHED_OTHER;
+    }
     return 0;
-    
 }
 
-const GpsInterface* wl_get_gps_interface(struct gps_device_t* dev)
+/*
+ * Reads NMEA_PORT_PATH_CONFIG. Only NMEA_PORT is required, everything else
+ * keeps its default when missing.
+ */
+static int wl_read_config(WlGpsConfig *config)
 {
-    LOGD("Enter wl_get_gps_interface");
-    return &wl_GpsInterface;
-}
+	FILE * fp = NULL;
+	char str_buf[128]={0};
+	
+	memset(config, 0, sizeof(*config));
+	config->m_nmea_forward = WL_NMEA_ALL;
+	config->m_read_batch_ms = -1;
 
-static int wl_open_gps(const struct hw_module_t* module, char const* name,
-        struct hw_device_t** device)
-{
-    LOGD("Enter wl_open_gps");
-    struct gps_device_t *dev = malloc(sizeof(struct gps_device_t));
-    memset(dev, 0, sizeof(*dev));
+	fp = fopen(NMEA_PORT_PATH_CONFIG,"r");
+	if(NULL == fp)
+		return -1;
+	
+	while(fgets(str_buf,128,fp))
+	{
+		char *key = str_buf;
+		char *value = strchr(str_buf, '=');
+
+		if (NULL == value)
+			continue;
+		*value++ = '\0';
+		key = wl_trim(key);
+		value = wl_trim(value);
+
+		if (!strcmp(key, "NMEA_PORT"))
+			strncpy(config->m_nmea_port, value, WL_CONFIG_PORT_LEN - 1);
+		else if (!strcmp(key, "NMEA_FORWARD"))
+			config->m_nmea_forward = wl_parse_nmea_types(value);
+		else if (!strcmp(key, "HIGH_RATE"))
+			config->m_high_rate = (atoi(value) != 0);
+		else if (!strcmp(key, "BAUD_RATE"))
+			config->m_baud_rate = atoi(value);
+		else if (!strcmp(key, "RX_BUFFER"))
+			config->m_rx_buffer = atoi(value);
+		else if (!strcmp(key, "MAX_LINE"))
+			config->m_max_line = atoi(value);
+		else if (!strcmp(key, "READ_MODE"))
+			config->m_read_throughput = !strcmp(value, "THROUGHPUT");
+		else if (!strcmp(key, "READ_BATCH_MS"))
+			config->m_read_batch_ms = atoi(value);
+		else if (!strcmp(key, "VMIN"))
+			config->m_vmin = atoi(value);
+		else if (!strcmp(key, "VTIME"))
+			config->m_vtime = atoi(value);
+		else if (!strcmp(key, "LOW_LATENCY"))
+			config->m_low_latency = (atoi(value) != 0);
+		else if (!strcmp(key, "READ_BACKEND"))
+			config->m_io_uring = !strcmp(value, "IO_URING");
+		else if (!strcmp(key, "TRACE_FILE"))
+			strncpy(config->m_trace_file, value, WL_CONFIG_PORT_LEN - 1);
+		else if (!strcmp(key, "FILTER_DISTANCE"))
+			config->m_filter_distance = atof(value);
+		else if (!strcmp(key, "FILTER_BEARING"))
+			config->m_filter_bearing = atof(value);
+		else if (!strcmp(key, "FILTER_SPEED"))
+			config->m_filter_speed = atof(value);
+		else if (!strcmp(key, "FILTER_HEARTBEAT_MS"))
+			config->m_filter_heartbeat_ms = atoi(value);
+		else if (!strcmp(key, "MLOCK"))
+			config->m_mlock = (atoi(value) != 0);
+		else if (!strcmp(key, "STALE_MS"))
+			config->m_stale_ms = atoi(value);
+		else if (!strcmp(key, "ADAPTIVE_RATE"))
+			config->m_adaptive_rate = (atoi(value) != 0);
+		else if (!strcmp(key, "ADAPTIVE_IDLE_S"))
+			config->m_adaptive_idle_s = atoi(value);
+		else if (!strcmp(key, "ADAPTIVE_STILL_SPEED"))
+			config->m_adaptive_still_speed = atof(value);
+		else if (!strcmp(key, "ADAPTIVE_STILL_RADIUS"))
+			config->m_adaptive_still_radius = atof(value);
+		else if (!strcmp(key, "ADAPTIVE_TURN"))
+			config->m_adaptive_turn = atof(value);
+		else if (!strcmp(key, "HISTORY_LEN"))
+			config->m_history_len = atoi(value);
+		else if ((wl_parse_thread_policy(config, key, value) < 0) && (key[0] != '#'))
+			LOGD("[wl_read_config]:unknown key %s", key);
+	}
 
-    dev->common.tag = HARDWARE_DEVICE_TAG;
-    dev->common.version = 0;
-    dev->common.module = (struct hw_module_t*)module;
-    //dev->common.close = NULL;
-    dev->get_gps_interface = wl_get_gps_interface;
+	fclose(fp);
+	fp = NULL;
 
-    *device = (struct hw_device_t*)dev;
-    return 0;
+	/*keys may come in any order, the defaults are only settled at the end*/
+	if (config->m_baud_rate <= 0)
+		config->m_baud_rate = config->m_high_rate ? WL_HIGH_RATE_BAUD : WL_DEFAULT_BAUD;
+	if (config->m_rx_buffer <= 0)
+		config->m_rx_buffer = config->m_high_rate ? WL_HIGH_RATE_BUF : LEN_GPS_BUF;
+	if (config->m_max_line <= 0)
+		config->m_max_line = config->m_high_rate ? WL_HIGH_RATE_LINE : LEN_GPS_INFO;
+	if (config->m_rx_buffer > WL_MAX_RX_BUFFER)
+		config->m_rx_buffer = WL_MAX_RX_BUFFER;
+	if (config->m_max_line < WL_MIN_LINE)
+		config->m_max_line = WL_MIN_LINE;
+	/*a whole line and its "\r\n" must fit, or the buffer could never drain*/
+	if (config->m_rx_buffer < config->m_max_line + 2)
+		config->m_rx_buffer = config->m_max_line + 2;
+	if (config->m_read_batch_ms < 0)
+		config->m_read_batch_ms = config->m_read_throughput ? WL_THROUGHPUT_BATCH_MS : 0;
+	if ((config->m_vmin < 1) || (config->m_vmin > 255))
+		config->m_vmin = 1;
+	if ((config->m_vtime < 0) || (config->m_vtime > 255))
+		config->m_vtime = 0;
+	/*without the inter-byte timer a read could wait forever for VMIN bytes*/
+	if ((config->m_vmin > 1) && (0 == config->m_vtime))
+		config->m_vtime = 1;
+	if (config->m_adaptive_idle_s <= 0)
+		config->m_adaptive_idle_s = WL_ADAPTIVE_IDLE_S;
+	if (config->m_adaptive_still_speed <= 0)
+		config->m_adaptive_still_speed = WL_ADAPTIVE_STILL_SPEED;
+	if (config->m_adaptive_still_radius <= 0)
+		config->m_adaptive_still_radius = WL_ADAPTIVE_STILL_RADIUS;
+	if (config->m_adaptive_turn <= 0)
+		config->m_adaptive_turn = WL_ADAPTIVE_TURN;
+	config->m_filter = (config->m_filter_distance > 0) || (config->m_filter_bearing > 0)
+		|| (config->m_filter_speed > 0) || (config->m_filter_heartbeat_ms > 0);
+	if (config->m_filter)
+		LOGD("[wl_read_config]:fixes filtered at %.1fm, %.1f degrees, %.1fm/s, heartbeat %dms",
+			config->m_filter_distance, config->m_filter_bearing, config->m_filter_speed,
+			config->m_filter_heartbeat_ms);
+	LOGD("[wl_read_config]:%d baud, %d byte buffer, lines up to %d, batch %dms, VMIN %d VTIME %d%s%s",
+		config->m_baud_rate, config->m_rx_buffer, config->m_max_line, config->m_read_batch_ms,
+		config->m_vmin, config->m_vtime, config->m_low_latency ? ", low latency" : "",
+		config->m_io_uring ? ", io_uring" : "");
+
+	if(strlen(config->m_nmea_port) == 0)
+		return -1;
+	return 0;
 }
 
-static void wl_read_buffer_thread(void *param) 
+static speed_t wl_baud_to_speed(int baud_rate)
 {
-	char info[LEN_GPS_INFO+1];
-	int info_len = 0;
-	char *temp = NULL;
-	int err_flag = 0;
-	GpsLocation loc;
-
-	LOGD("[wl_read_buffer_thread]:ENTER.");
-
-	memset(info,0,LEN_GPS_INFO+1);
-
-	/*init location info*/
-    memset(&loc, 0, sizeof(GpsLocation));
-    loc.size = sizeof(GpsLocation);
-	
-readbuf:	
-	pthread_mutex_lock(&mutex);
-	LOGD("[wl_read_buffer_thread]:readbuf step1.");
-	if(g_gps_info_buf->len == 0)
-		goto wait;
-
-	temp = strstr(g_gps_info_buf->m_buf,"\r\n");
-	if(NULL == temp && g_gps_info_buf->len >= LEN_GPS_BUF)
-	{
-		LOGD("[wl_read_buffer_thread]:WRONG INFO 1.");
-		err_flag = 1;
-		memset(g_gps_info_buf,0,LEN_GPS_BUF);
-	}
-	else if(NULL == temp && g_gps_info_buf->len < LEN_GPS_BUF)
+	switch (baud_rate)
 	{
-		LOGD("[wl_read_buffer_thread]:THE INFO IS NOT COMPLETE!PLEASE WAIT...");
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 115200: return B115200;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	case 921600: return B921600;
+	default:
+		LOGD("[wl_baud_to_speed]:unsupported baud rate %d, using 115200", baud_rate);
+		return B115200;
 	}
-	else if(temp != NULL && (temp - g_gps_info_buf->m_buf) > LEN_GPS_INFO)
+}
+
+/*
+ * Moves the unparsed tail to the front once a quarter of the room is left.
+ * Returns the room for the next read; at 0 the buffer is full and only the
+ * buffer thread or cleanup can wake the reader.
+ */
+static int wl_make_room(WlGpsContext *ctx)
+{
+	gps_info_buf *buf = &ctx->m_gps_info_buf;
+	int room;
+
+	wl_rx_lock(ctx);
+	if ((buf->m_start > 0) && (buf->m_size - buf->len < buf->m_size / 4))
 	{
-		LOGD("[wl_read_buffer_thread]:ERROR!THE INFO IS TOO LONG TO READ!");
-		memmove(g_gps_info_buf->m_buf,temp+2,(LEN_GPS_BUF - (temp+2 - g_gps_info_buf->m_buf)));
-		g_gps_info_buf->len -= (temp+2 - g_gps_info_buf->m_buf);
+		memmove(buf->m_buf, buf->m_buf + buf->m_start, buf->len - buf->m_start);
+		buf->len -= buf->m_start;
+		buf->m_start = 0;
+		buf->m_buf[buf->len] = '\0';
 	}
-	else if(temp != NULL && (temp - g_gps_info_buf->m_buf) <= LEN_GPS_INFO)
+	/*only grows until we append, the buffer thread just consumes*/
+	room = buf->m_size - buf->len;
+	ctx->m_read_port_waiting = (room <= 0);
+	wl_rx_unlock(ctx);
+
+	if (room <= 0)
+		LOGD("[wl_read_port_thread]:Buffer full, please wait..\n");
+	return room;
+}
+
+/*appends what one read returned, at most the room wl_make_room gave*/
+static void wl_append_read(WlGpsContext *ctx, const char *data, int len)
+{
+	gps_info_buf *buf = &ctx->m_gps_info_buf;
+	int wake_parser;
+
+	wl_rx_lock(ctx);
+	memcpy(&buf->m_buf[buf->len], data, len);
+	buf->len += len;
+	buf->m_buf[buf->len] = '\0';
+	ctx->m_rx_total += len;
+	if (ctx->m_config.m_stale_ms > 0)
 	{
-		if(0 == err_flag)
-		{
-			LOGD("[wl_read_buffer_thread]:THE INFO IS COMPLETE.");
-			memcpy(&info,g_gps_info_buf->m_buf,(temp - g_gps_info_buf->m_buf));
-			info_len = temp - g_gps_info_buf->m_buf;
-			info[info_len+1]="\0";
-			memmove(g_gps_info_buf->m_buf,temp+2,(LEN_GPS_BUF - (temp+2 - g_gps_info_buf->m_buf)));
-			g_gps_info_buf->len -= (temp+2 - g_gps_info_buf->m_buf);
-		}	
-		else
-		{
-			LOGD("[wl_read_buffer_thread]:WRONG INFO 2.");
-			memmove(g_gps_info_buf->m_buf,temp+2,(LEN_GPS_BUF - (temp+2 - g_gps_info_buf->m_buf)));
-			g_gps_info_buf->len -= (temp+2 - g_gps_info_buf->m_buf);
-			err_flag = 0;
-		}
+		WlRxArrival *arrival = &ctx->m_rx_arrivals[ctx->m_rx_arrival_count++ % WL_RX_ARRIVALS];
+
+		arrival->m_end = ctx->m_rx_total;
+		arrival->m_ns = wl_now_ns();
 	}
-	
-	pthread_mutex_unlock(&mutex);
-	LOGD("[wl_read_buffer_thread]:readbuf step2.");
-	temp = NULL;
-	if(strlen(info) == 0)
+	/*a busy buffer thread finds the bytes on its own*/
+	wake_parser = ctx->m_read_buff_waiting;
+	ctx->m_read_buff_waiting = 0;
+	wl_rx_unlock(ctx);
+	ctx->m_reader_reads++;
+	ctx->m_reader_bytes += len;
+
+	if (wake_parser)
 	{
-		LOGD("[wl_read_buffer_thread]:readbuf step3.");
-		usleep(3000);
-		goto readbuf;
+		__atomic_store_n(&ctx->m_parser_woken_ns, wl_now_ns(), __ATOMIC_RELEASE);
+		wl_wake_thread(ctx->m_read_buff_evt);
+		ctx->m_reader_syscalls++;
 	}
+}
 
-	LOGD("Get one line: %.*s", info_len, info);
-	if ((g_cur_atcmd != 0) && (info_len >= 2) && (info[0] == 'O') && (info[1] == 'K'))
+/*
+ * READ_BACKEND=IO_URING. A read of the port into the registered scratch
+ * buffer and a poll of m_read_port_evt stay queued on the ring and are
+ * requeued as they complete, so a single io_uring_enter hands in the next
+ * read and waits for data. With READ_BATCH_MS a poll and a timeout go ahead
+ * of the read. Returns 0 when stopped, -1 on a port error and -2 when this
+ * kernel has no usable io_uring. Sets *scratch to NULL when the ring could
+ * not be drained and the kernel may still write to it.
+ */
+static int wl_uring_read_loop(WlGpsContext *ctx, char **scratch, int *try_count)
+{
+	WlUring *ring = &ctx->m_uring;
+	struct iovec iov;
+	uint64_t user_data;
+	/*the WL_URING_PORT_* operation queued on the port, 0 when none is*/
+	int port_op = 0;
+	int wakeup_queued = 0;
+	int timed_out = 0;
+	int room = 0;
+	int res;
+	int ret;
+
+	ret = wl_uring_init(ring, WL_URING_ENTRIES);
+	if (0 == ret)
 	{
-		LOGD("wl_read_buffer_thread]:Find response of atcmd");
-		g_cur_atcmd = 0;
+		iov.iov_base = *scratch;
+		iov.iov_len = ctx->m_config.m_rx_buffer;
+		ret = wl_uring_register_buffers(ring, &iov, 1);
+		if (ret < 0)
+			wl_uring_exit(ring);
 	}
-	else
+	if (ret < 0)
 	{
-		LOGD("[wl_read_buffer_thread]:readbuf step4.");
-		wl_parse_nmea_line(&loc, info, info_len);
+		LOGD("[wl_uring_read_loop]:io_uring not available, errno=%d, using poll", -ret);
+		return -2;
 	}
-	memset(info,0,LEN_GPS_INFO+1);
-	LOGD("[wl_read_buffer_thread]:readbuf step5.");
-	goto readbuf;
 
-wait:
-	LOGD("[wl_read_buffer_thread]:readbuf step6.");
-	pthread_mutex_unlock(&mutex);
-	LOGD("[wl_read_buffer_thread]:readbuf step7.");
-	usleep(3000);
-	LOGD("[wl_read_buffer_thread]:readbuf step8.");
-	goto readbuf;
-}
+	pthread_mutex_lock(&ctx->m_atcmd_mutex);
+	/*a write the last ring could not drain died with it*/
+	ctx->m_at_write_busy = 0;
+	ctx->m_uring_active = 1;
+	pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+	LOGD("[wl_uring_read_loop]:read loop.");
 
-static int wl_get_nmea_port(char *port)
-{
-	FILE * fp = NULL;
-	char *temp = NULL;
-	char str_buf[128]={0};
-	
-	fp = fopen(NMEA_PORT_PATH_CONFIG,"r");
-	if(NULL == fp)
-		return -1;
-	
-	while(fgets(str_buf,128,fp))
+	while (ctx->m_need_reading_nmea && (0 == ret))
 	{
-		temp = strstr(str_buf,"NMEA_PORT");
-		if(NULL != temp)
+		/*a read of the nonblocking eventfd would not wait, a poll does*/
+		if (!wakeup_queued)
+			wakeup_queued = (0 == wl_uring_queue_poll(ring, ctx->m_read_port_evt, WL_URING_WAKEUP));
+		if (0 == port_op)
+		{
+			room = wl_make_room(ctx);
+			if ((room > 0) && (ctx->m_config.m_read_batch_ms > 0))
+				port_op = (0 == wl_uring_queue_poll(ring, ctx->m_nmea_fd, WL_URING_PORT_POLL)) ?
+					WL_URING_PORT_POLL : 0;
+			else if (room > 0)
+				port_op = (0 == wl_uring_queue_read_fixed(ring, ctx->m_nmea_fd, *scratch, room, 0,
+					WL_URING_PORT_READ)) ? WL_URING_PORT_READ : 0;
+		}
+
+		WL_TRACE_BEGIN(WL_TRACE_URING_ENTER, port_op);
+		res = wl_uring_enter(ring, 1);
+		WL_TRACE_END(WL_TRACE_URING_ENTER);
+		ctx->m_reader_wakeups++;
+		ctx->m_reader_syscalls++;
+		if ((res < 0) && (res != -EINTR))
+		{
+			LOGD("[wl_uring_read_loop]:io_uring_enter failed, errno=%d", -res);
+			ret = -1;
+		}
+
+		while (wl_uring_next_completion(ring, &user_data, &res))
 		{
-			strncpy(port,temp+10,20);
+			switch (user_data)
+			{
+			case WL_URING_WAKEUP:
+				wakeup_queued = 0;
+				wl_clear_wakeup(ctx->m_read_port_evt);
+				ctx->m_reader_syscalls++;
+				break;
+			case WL_URING_PORT_POLL:
+				/*let the burst build up; cleanup still gets through on the eventfd*/
+				port_op = WL_URING_PORT_BATCH;
+				if ((res < 0) || (wl_uring_queue_timeout(ring, ctx->m_config.m_read_batch_ms,
+					WL_URING_PORT_BATCH) < 0))
+				{
+					port_op = 0;
+					ret = -1;
+				}
+				break;
+			case WL_URING_PORT_BATCH:
+				/*the room measured before the poll can only have grown*/
+				port_op = WL_URING_PORT_READ;
+				if (wl_uring_queue_read_fixed(ring, ctx->m_nmea_fd, *scratch, room, 0, WL_URING_PORT_READ) < 0)
+				{
+					port_op = 0;
+					ret = -1;
+				}
+				break;
+			case WL_URING_PORT_READ:
+				port_op = 0;
+				if (res <= 0)
+				{
+					ret = -1;
+					break;
+				}
+				wl_append_read(ctx, *scratch, res);
+				*try_count = 0;
+				break;
+			case WL_URING_AT_WRITE:
+				wl_uring_at_write_done(ctx, res);
+				break;
+			}
+		}
+	}
+
+	pthread_mutex_lock(&ctx->m_atcmd_mutex);
+	ctx->m_uring_active = 0;
+	pthread_mutex_unlock(&ctx->m_atcmd_mutex);
+
+	/*nothing may be left to write into the scratch buffer or the AT line*/
+	if (port_op)
+		wl_uring_queue_cancel(ring, port_op, WL_URING_CANCEL);
+	if (wakeup_queued)
+		wl_uring_queue_cancel(ring, WL_URING_WAKEUP, WL_URING_CANCEL);
+	wl_uring_queue_timeout(ring, WL_URING_DRAIN_MS, WL_URING_DRAIN);
+	while ((port_op || wakeup_queued || ctx->m_at_write_busy) && !timed_out)
+	{
+		res = wl_uring_enter(ring, 1);
+		if ((res < 0) && (res != -EINTR))
 			break;
+		while (wl_uring_next_completion(ring, &user_data, &res))
+		{
+			if (WL_URING_WAKEUP == user_data)
+				wakeup_queued = 0;
+			else if (WL_URING_AT_WRITE == user_data)
+				wl_uring_at_write_done(ctx, res);
+			else if (WL_URING_DRAIN == user_data)
+				timed_out = 1;
+			else if (user_data == (uint64_t)port_op)
+				port_op = 0;
 		}
 	}
+	if (port_op || wakeup_queued)
+	{
+		LOGE("[wl_uring_read_loop]:io_uring reads still queued, leaving their buffer to the kernel");
+		*scratch = NULL;
+	}
+	wl_uring_exit(ring);
 
-	if(strlen(port) == 0)
-		return -1;
-	
-	fclose(fp);
-	fp = NULL;
-	return 0;
+	return ret;
 }
 
 static void wl_read_port_thread(void *param) 
 {
-	gps_info_buf gps_buf;
+	WlGpsContext *ctx = (WlGpsContext *)param;
+	/*bytes land here first, a VMIN/VTIME read must not hold m_mutex*/
+	char *scratch = NULL;
     int read_len = 0;
-    char *read_buf = NULL;
-    int read_buf_len = 0;
-    char *line_buf = NULL;
-    int line_len = 0;
-    int sel_count = 0;
+    int poll_count = 0;
 	int try_count = 0;
-	char nmea_port[20] = {0};
-  //  struct timeval sel_timeout = {2,0};
-  	
-	struct timeval sel_timeout;	
-	sel_timeout.tv_sec = 1;	
-	sel_timeout.tv_usec = 0;	 
+	int room = 0;
+	int ret = 0;
+	struct pollfd pfds[2];
 
 	LOGD("[wl_read_port_thread]:ENTER.");
 
-    /*init information of utc time*/
-    g_utc_info.m_year = -1;
-    g_utc_info.m_month = -1;
-    g_utc_info.m_day = -1;
-    g_utc_info.m_sub = wl_calc_utc_sub();
-
-	/*init gps_buf*/
-	g_gps_info_buf = &gps_buf;
-	memset(g_gps_info_buf,0,sizeof(gps_buf));
-
 	/*get port*/
-	if(wl_get_nmea_port(nmea_port)<0)
+	if(wl_read_config(&ctx->m_config)<0)
 	{	
 		LOGD("[wl_read_port_thread]:Read Port Config Wrong!");
 		goto cleanup;
 	}
+	if (ctx->m_config.m_trace_file[0])
+		wl_trace_start();
+	wl_trace_thread_name("reader");
+	wl_apply_thread_policy(ctx, WL_THREAD_READER);
+	wl_lock_memory(ctx, ctx, sizeof(*ctx));
+	wl_size_history(ctx);
+	/*the buffer thread is not running yet, or is idle between sessions*/
+	ctx->m_parse_callbacks.nmea_mask = ctx->m_config.m_nmea_forward;
+	if (wl_alloc_rx_buffer(ctx) < 0)
+		goto cleanup;
+	scratch = malloc(ctx->m_config.m_rx_buffer);
+	if (NULL == scratch)
+		goto cleanup;
+	wl_lock_memory(ctx, scratch, ctx->m_config.m_rx_buffer);
     
 Open_port:
 	LOGD("[wl_read_port_thread]:open port.");
-    while (g_need_reading_nmea)
+	wl_forget_rx_state(ctx);
+    if (ctx->m_nmea_fd >= 0)
+    {
+        close(ctx->m_nmea_fd);
+        ctx->m_nmea_fd = -1;
+    }
+
+    while (ctx->m_need_reading_nmea)
     {
-        g_nmea_fd = open(nmea_port, O_RDWR);
-        if (g_nmea_fd > 0) 
+        ctx->m_nmea_fd = open(ctx->m_config.m_nmea_port, O_RDWR);
+        if (ctx->m_nmea_fd > 0) 
         {
             struct termios ios;
             memset(&ios, 0, sizeof(ios));
-            tcgetattr( g_nmea_fd, &ios);
+            tcgetattr( ctx->m_nmea_fd, &ios);
             cfmakeraw(&ios);
             ios.c_lflag = 0; 
-            cfsetispeed(&ios, 115200);
-            cfsetospeed(&ios, 115200);
-            tcsetattr( g_nmea_fd, TCSANOW, &ios );
+            /*a read only follows poll, so at least one byte is always there*/
+            ios.c_cc[VMIN] = ctx->m_config.m_vmin;
+            ios.c_cc[VTIME] = ctx->m_config.m_vtime;
+            cfsetispeed(&ios, wl_baud_to_speed(ctx->m_config.m_baud_rate));
+            cfsetospeed(&ios, wl_baud_to_speed(ctx->m_config.m_baud_rate));
+            tcsetattr( ctx->m_nmea_fd, TCSANOW, &ios );
+            if (ctx->m_config.m_low_latency)
+                wl_set_low_latency(ctx->m_nmea_fd);
 			LOGD("[wl_read_port_thread]:open port successfully.");
             break;
         }
         else
         {
-            LOGD("[wl_read_port_thread]:Error! Can not open NMEA port, will try later,s%",nmea_port);
-            sleep(2);
+            LOGD("[wl_read_port_thread]:Error! Can not open NMEA port %s, will try later",ctx->m_config.m_nmea_port);
+            wl_wait_wakeup(ctx->m_read_port_evt, WL_PORT_REOPEN_DELAY_MS);
             continue;
         }
     }
 
-	g_read_buff_thread = p_java_layer_callback->create_thread_cb( "wl_read_buffer_thread", wl_read_buffer_thread, NULL);
+    if (!ctx->m_need_reading_nmea)
+        goto cleanup;
+
+    if (0 == ctx->m_read_buff_thread)
+    {
+        ctx->m_read_buff_thread = wl_create_thread(ctx, "wl_read_buffer_thread", wl_read_buffer_thread);
+        if (0 == ctx->m_read_buff_thread)
+            goto cleanup;
+    }
+
+    if (0 == ctx->m_deliver_thread)
+    {
+        ctx->m_deliver_thread = wl_create_thread(ctx, "wl_deliver_thread", wl_deliver_thread);
+        if (0 == ctx->m_deliver_thread)
+            goto cleanup;
+    }
+
+	if (ctx->m_config.m_io_uring)
+	{
+		ret = wl_uring_read_loop(ctx, &scratch, &try_count);
+		if ((0 == ret) || (NULL == scratch))
+			goto cleanup;
+		if (ret < -1)
+			ctx->m_config.m_io_uring = 0;
+		else if(try_count <= 3)
+		{
+			LOGD("[wl_read_port_thread]:Reopen GPS port.");
+			try_count++;
+			goto Open_port;
+		}
+		else
+		{
+			LOGD("[wl_read_port_thread]:Error!exit GPS process");
+			goto cleanup;
+		}
+	}
 
-	fd_set nmea_port_set;
-	
-Readloop:
 	LOGD("[wl_read_port_thread]:read loop.");
-    while (g_need_reading_nmea)
+    while (ctx->m_need_reading_nmea)
     {	
-    	usleep(3000);
-    	LOGD("[wl_read_port_thread]:read loop step1");
-		FD_ZERO(&nmea_port_set);
-		FD_SET(g_nmea_fd, &nmea_port_set);
-    	sel_count = select((g_nmea_fd+1), &nmea_port_set, NULL, NULL, &sel_timeout);
-		LOGD("[wl_read_port_thread]:read loop step2");
-        if (0 == sel_count)
-        {	
-        	LOGD("[wl_read_port_thread]:read loop step3");
-            continue;
-        }
-        else if (sel_count < 0)
+		pfds[0].fd = ctx->m_nmea_fd;
+		pfds[0].events = POLLIN;
+		pfds[0].revents = 0;
+		pfds[1].fd = ctx->m_read_port_evt;
+		pfds[1].events = POLLIN;
+		pfds[1].revents = 0;
+
+		room = wl_make_room(ctx);
+		WL_TRACE_BEGIN(WL_TRACE_POLL, room);
+    	poll_count = (room <= 0) ? poll(&pfds[1], 1, -1) : poll(pfds, 2, -1);
+		WL_TRACE_END(WL_TRACE_POLL);
+    	ctx->m_reader_wakeups++;
+    	ctx->m_reader_syscalls++;
+        if (poll_count < 0)
         {
+        	if (EINTR == errno)
+        		continue;
+
         	if(try_count <= 3)
         	{
 				LOGD("[wl_read_port_thread]:Reopen GPS port.");
@@ -1039,33 +3021,35 @@ Readloop:
 			}
         }
 
-		pthread_mutex_lock(&mutex);
-		LOGD("[wl_read_port_thread]:read loop step4");
-		read_buf = &(g_gps_info_buf->m_buf[g_gps_info_buf->len]);
-		read_buf_len = LEN_GPS_BUF - g_gps_info_buf->len;
-		
-        if (0 == read_buf_len)
-        {
-            LOGD("[wl_read_port_thread]:Buffer full, please wait..\n");
-			goto wait;
-        }
+		if (pfds[1].revents & POLLIN)
+		{
+			wl_clear_wakeup(ctx->m_read_port_evt);
+			ctx->m_reader_syscalls++;
+		}
+
+		if (0 == pfds[0].revents)
+			continue;
 
-		LOGD("[wl_read_port_thread]:read loop step5");
-        read_len = read(g_nmea_fd, read_buf, read_buf_len);
-		
-		if(read_len)
+		/*let the burst build up; cleanup still gets through on the eventfd*/
+		if (ctx->m_config.m_read_batch_ms > 0)
 		{
-			LOGD("[wl_read_port_thread]:read data.");
-			g_gps_info_buf->len += read_len;
-			g_gps_info_buf->m_buf[g_gps_info_buf->len+1] = "\0";
+			ctx->m_reader_syscalls++;
+			WL_TRACE_BEGIN(WL_TRACE_POLL, 0);
+			poll_count = poll(&pfds[1], 1, ctx->m_config.m_read_batch_ms);
+			WL_TRACE_END(WL_TRACE_POLL);
+			if (poll_count > 0)
+			{
+				wl_clear_wakeup(ctx->m_read_port_evt);
+				ctx->m_reader_syscalls++;
+			}
 		}
-		
-		pthread_mutex_unlock(&mutex);
 
-		LOGD("[wl_read_port_thread]:read loop step6");
+		WL_TRACE_BEGIN(WL_TRACE_READ, room);
+        read_len = read(ctx->m_nmea_fd, scratch, room);
+		WL_TRACE_END(WL_TRACE_READ);
+        ctx->m_reader_syscalls++;
         if (read_len <= 0)
         {
-            usleep(3000);
             if(try_count <= 3)
         	{
 				LOGD("[wl_read_port_thread]:Reopen GPS port.");
@@ -1079,36 +3063,42 @@ Readloop:
 			}
         }
 
+		wl_append_read(ctx, scratch, read_len);
 		try_count = 0;
-		LOGD("[wl_read_port_thread]:read loop step7");
     }
 	
 cleanup:
 	LOGD("[wl_read_port_thread]:clean up.");
-    if (g_nmea_fd > 0)
+	wl_unlock_memory(ctx, scratch, ctx->m_config.m_rx_buffer);
+	free(scratch);
+    if (ctx->m_nmea_fd >= 0)
     {
-        close(g_nmea_fd);
-        g_nmea_fd = -1;
+        close(ctx->m_nmea_fd);
+        ctx->m_nmea_fd = -1;
+    }
+
+    if (ctx->m_need_reading_nmea)
+    {
+        /*gave up on the port by ourselves, take the buffer thread down too*/
+        ctx->m_need_reading_nmea = 0;
+        wl_wake_thread(ctx->m_read_buff_evt);
+        wl_wake_thread(ctx->m_deliver_evt);
+        wl_wake_at_senders(ctx);
+        ctx->m_is_internal_initialized = 0;
+        ctx->m_cur_gps_status = GPS_STATUS_NONE;
+        wl_report_cur_state(ctx, ctx->m_cur_gps_status);
+        wl_lose_geofence_fixes(ctx);
     }
-	
-    wl_gps_cleanup();
-	g_gps_info_buf = NULL;
-	return NULL;
 
-wait:
-	LOGD("[wl_read_port_thread]:wait...");
-	pthread_mutex_unlock(&mutex);
-	LOGD("[wl_read_port_thread]:read loop step8");
-	usleep(3000);
-	LOGD("[wl_read_port_thread]:read loop step9");
-	goto Readloop;
+	LOGD("[wl_read_port_thread]:EXIT.");
+	wl_thread_exit(ctx);
 }
 
 //interfaces
 static int wl_gps_init(GpsCallbacks* callbacks) 
 {
+    WlGpsContext *ctx = &g_gps_ctx;
     int ret;
-    GpsStatus gps_stat;
     
     LOGD("This is Welink GPS module, VERSION: %s",DRIVER_VERSION);
 
@@ -1117,11 +3107,13 @@ static int wl_gps_init(GpsCallbacks* callbacks)
         return -1;
     }
 
-    p_java_layer_callback = callbacks;
+    ctx->m_callbacks = callbacks;
+    wl_set_parse_callbacks(ctx);
+    wl_update_nmea_wanted(ctx);
 
-    if (g_is_internal_initialized == 0)
+    if (ctx->m_is_internal_initialized == 0)
     {
-        ret = wl_gps_init_internal_process();
+        ret = wl_gps_init_internal_process(ctx);
         if (ret < 0)
         {
             LOGE("Error while initialize GPS device");
@@ -1129,132 +3121,220 @@ static int wl_gps_init(GpsCallbacks* callbacks)
         }
     }
 
-    g_is_internal_initialized = 1;
-    g_cur_gps_status = GPS_STATUS_ENGINE_ON;
-    wl_report_cur_state(g_cur_gps_status);
+    ctx->m_is_internal_initialized = 1;
+    ctx->m_cur_gps_status = GPS_STATUS_ENGINE_ON;
+    wl_report_cur_state(ctx, ctx->m_cur_gps_status);
     return 0;
 }
 
 static void wl_gps_cleanup(void) 
 {
-    int retry = 15;
+    WlGpsContext *ctx = &g_gps_ctx;
+    int running;
 
     LOGD("Enter wl_gps_cleanup");    
-    g_need_reading_nmea = 0;
-
-    while (retry-- > 0)
+    ctx->m_need_reading_nmea = 0;
+    wl_wake_thread(ctx->m_read_port_evt);
+    wl_wake_thread(ctx->m_read_buff_evt);
+    wl_wake_thread(ctx->m_deliver_evt);
+    wl_wake_at_senders(ctx);
+
+    running = wl_wait_threads_exit(ctx, WL_THREAD_EXIT_TIMEOUT_MS);
+    if (running != 0)
     {
-        if (g_nmea_fd <= 0)
-        {
-            break;
-        }
-
-        usleep(200000);
+        /*they still hold the eventfds, leave them to the next init*/
+        LOGE("wl_gps_cleanup: %d GPS threads did not exit", running);
     }
-
-    if (g_nmea_fd > 0)
+    else
     {
-        close(g_nmea_fd);
-        g_nmea_fd = -1;
+        wl_close_wakeup_fds(ctx);
+        wl_reset_parse_state(&ctx->m_parse);
+        wl_attach_parse_memo(&ctx->m_parse, &ctx->m_nmea_memo);
+        wl_free_rx_buffer(ctx);
     }
 
-    g_is_internal_initialized = 0;
+    ctx->m_read_port_thread = 0;
+    ctx->m_read_buff_thread = 0;
+    ctx->m_deliver_thread = 0;
+    ctx->m_is_internal_initialized = 0;
 
-    memset(&g_satellites_info, 0, sizeof(UsingSatellitesInfo));
-    g_sv_status_flag = 0;
-    memset(&g_sv_status_info, 0, sizeof(GpsSvStatus));
+    ctx->m_cur_atcmd = 0;
 
-    g_cur_atcmd = 0;
-
-    g_cur_gps_status = GPS_STATUS_NONE;
-    wl_report_cur_state(g_cur_gps_status);
+    ctx->m_cur_gps_status = GPS_STATUS_NONE;
+    wl_report_cur_state(ctx, ctx->m_cur_gps_status);
+    wl_lose_geofence_fixes(ctx);
 }
 
 static int wl_gps_start(void) 
 {
+    WlGpsContext *ctx = &g_gps_ctx;
+    unsigned int types;
     int ret;
     
     LOGD("Enter wl_gps_start");
 
-    if ((g_cur_gps_status == GPS_STATUS_NONE)
-        || (g_cur_gps_status == GPS_STATUS_ENGINE_OFF))
+    if ((ctx->m_cur_gps_status == GPS_STATUS_NONE)
+        || (ctx->m_cur_gps_status == GPS_STATUS_ENGINE_OFF))
     {
-        ret = wl_gps_init(p_java_layer_callback);
+        ret = wl_gps_init(ctx->m_callbacks);
         if (ret != 0) return -1;
     }
 
-    if (g_is_internal_initialized == 0)
+    if (ctx->m_is_internal_initialized == 0)
     {
         return -1;
     }
 
-    ret = wl_send_at_cmd_internal(ATCMD_ZGINIT);
+    if (ctx->m_cur_gps_status == GPS_STATUS_SESSION_END)
+    {
+        /*all three threads should have slept through the whole idle period*/
+        LOGD("Idle since last stop: %u reader, %u parser, %u delivery wakeups",
+            ctx->m_reader_wakeups - ctx->m_idle_reader_wakeups,
+            ctx->m_parser_wakeups - ctx->m_idle_parser_wakeups,
+            ctx->m_deliver_wakeups - ctx->m_idle_deliver_wakeups);
+    }
+
+    ret = wl_send_at_cmd_internal(ctx, ATCMD_ZGINIT);
     if (ret < 0)
     {
         return -1;
     }
 
-    ret = wl_send_at_cmd_internal(ATCMD_ZGMODE_3);
+    ret = wl_send_at_cmd_internal(ctx, ATCMD_ZGMODE_3);
     if (ret < 0)
     {
         return -1;
     }
 
-	ret = wl_send_at_cmd_internal(ATCMD_ZGFIXRATE_65535);
+    /*ADAPTIVE_RATE keeps to the session's interval, everything else as fast as it goes*/
+    if (ctx->m_config.m_adaptive_rate && !ctx->m_session_single)
+    {
+        ret = wl_send_fix_rate(ctx, ctx->m_session_interval_s);
+        pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+        ctx->m_rate_wanted = ctx->m_session_interval_s;
+        ctx->m_rate_applied = ctx->m_session_interval_s;
+        pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+        ctx->m_rate_restart = 1;
+    }
+    else
+        ret = wl_send_at_cmd_internal(ctx, ATCMD_ZGFIXRATE_65535);
     if (ret < 0)
     {
         return -1;
     }
 
-	ret = wl_send_at_cmd_internal(ATCMD_ZGNMEA_31);
+    /*only the sentences someone uses, the config is only read by now*/
+    wl_update_nmea_wanted(ctx);
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    types = ctx->m_nmea_wanted;
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+    ret = wl_send_nmea_types(ctx, types);
     if (ret < 0)
     {
         return -1;
     }
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    ctx->m_nmea_applied = types;
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
 	
-    ret = wl_send_at_cmd_internal(ATCMD_ZGRUN_2);
+    ctx->m_filter_restart = 1;
+    ret = wl_send_at_cmd_internal(ctx, ATCMD_ZGRUN_2);
     if (ret < 0)
     {
         return -1;
     }
 
-    g_cur_gps_status = GPS_STATUS_SESSION_BEGIN;
-    wl_report_cur_state(g_cur_gps_status);
+    /*a listener that came or went while the session started*/
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    ctx->m_cur_gps_status = GPS_STATUS_SESSION_BEGIN;
+    ctx->m_session_ending = 0;
+    wl_kick_rx_setting_locked(ctx);
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+    wl_report_cur_state(ctx, ctx->m_cur_gps_status);
     return 0;    
 }
 
 static int wl_gps_stop(void) 
 {
+    WlGpsContext *ctx = &g_gps_ctx;
+    unsigned int lines;
     int ret;
     
     LOGD("Enter wl_gps_stop");
 
-    if (g_is_internal_initialized == 0)
+    if (ctx->m_is_internal_initialized == 0)
     {
         LOGD("Not init, return directly");
         return -1;
     }
 
-    ret = wl_send_at_cmd_internal(ATCMD_ZGRUN_0);
+    wl_end_rx_settings(ctx);
+    ret = wl_send_at_cmd_internal(ctx, ATCMD_ZGRUN_0);
     if (ret < 0)
     {
         return -1;
     }
 
-    ret = wl_send_at_cmd_internal(ATCMD_ZGNMEA_0);
+    ret = wl_send_at_cmd_internal(ctx, ATCMD_ZGNMEA_0);
     if (ret < 0)
     {
         return -1;
     }
 
-	ret = wl_send_at_cmd_internal(ATCMD_ZGFIXRATE_1);
+	ret = wl_send_at_cmd_internal(ctx, ATCMD_ZGFIXRATE_1);
     if (ret < 0)
     {
         return -1;
     }
-    
-    g_cur_gps_status = GPS_STATUS_SESSION_END;
-    wl_report_cur_state(g_cur_gps_status);
+
+    LOGD("Delivery so far: %u locations and %u SV status coalesced, %u NMEA dropped, %u lines unframed, "
+        "%u failing the checksum, %u with more than %d fields",
+        ctx->m_location_coalesced, ctx->m_sv_status_coalesced, ctx->m_nmea_dropped, ctx->m_lines_dropped,
+        ctx->m_lines_bad_checksum, ctx->m_lines_fields_cut, WL_NMEA_MAX_FIELDS);
+    if (ctx->m_config.m_filter && (ctx->m_fixes_delivered + ctx->m_fixes_filtered))
+        LOGD("Filter so far: %u fixes delivered, %u suppressed (%.1f%%)",
+            ctx->m_fixes_delivered, ctx->m_fixes_filtered,
+            100.0 * ctx->m_fixes_filtered / (ctx->m_fixes_delivered + ctx->m_fixes_filtered));
+    /*each parser wakeup is a poll and a read of its eventfd*/
+    lines = __atomic_load_n(&ctx->m_lines_framed, __ATOMIC_RELAXED);
+    if (lines && ctx->m_reader_reads)
+        LOGD("Reading so far: %u lines, %u bytes per read, %.2f syscalls per line",
+            lines, ctx->m_reader_bytes / ctx->m_reader_reads,
+            (ctx->m_reader_syscalls + 2.0 * ctx->m_parser_wakeups) / lines);
+    /*lines per second show what the slower rate saved on the port and in the parser*/
+    if (ctx->m_config.m_adaptive_rate && (ctx->m_rate_ms[0] + ctx->m_rate_ms[1] > 0))
+        LOGD("Fix rate so far: %u changes, %u failed; %llds at the session rate, %.1f lines/s; "
+            "%llds slowed, %.1f lines/s",
+            ctx->m_rate_changes, ctx->m_rate_failed,
+            (long long)(ctx->m_rate_ms[0] / 1000), ctx->m_rate_ms[0] ? 1000.0 * ctx->m_rate_lines[0] / ctx->m_rate_ms[0] : 0.0,
+            (long long)(ctx->m_rate_ms[1] / 1000), ctx->m_rate_ms[1] ? 1000.0 * ctx->m_rate_lines[1] / ctx->m_rate_ms[1] : 0.0);
+    LOGD("Sentences so far: 0x%x asked for, %u changes in a session, %u failed",
+        ctx->m_nmea_applied, ctx->m_nmea_changes, ctx->m_nmea_failed);
+    /*a hit is a GSA or GSV neither split nor converted again*/
+    if (ctx->m_nmea_memo.m_hits + ctx->m_nmea_memo.m_misses)
+        LOGD("Sentence memo so far: %u hits, %u misses (%.1f%% reused)",
+            ctx->m_nmea_memo.m_hits, ctx->m_nmea_memo.m_misses,
+            100.0 * ctx->m_nmea_memo.m_hits / (ctx->m_nmea_memo.m_hits + ctx->m_nmea_memo.m_misses));
+    if (ctx->m_config.m_stale_ms > 0)
+        LOGD("Backlog so far: %u epochs older than %dms shed", ctx->m_epochs_shed, ctx->m_config.m_stale_ms);
+    LOGD("AT commands so far: %u sent, %u skipped as already applied",
+        ctx->m_atcmds_sent, ctx->m_atcmds_skipped);
+    if (ctx->m_parser_latency.m_count && ctx->m_deliver_latency.m_count)
+        LOGD("Wakeup latency so far: parser %lluus mean %uus max, delivery %lluus mean %uus max",
+            (unsigned long long)(ctx->m_parser_latency.m_total_us / ctx->m_parser_latency.m_count),
+            ctx->m_parser_latency.m_max_us,
+            (unsigned long long)(ctx->m_deliver_latency.m_total_us / ctx->m_deliver_latency.m_count),
+            ctx->m_deliver_latency.m_max_us);
+    if (ctx->m_config.m_trace_file[0])
+        wl_trace_dump(ctx->m_config.m_trace_file);
+    ctx->m_idle_reader_wakeups = ctx->m_reader_wakeups;
+    ctx->m_idle_parser_wakeups = ctx->m_parser_wakeups;
+    ctx->m_idle_deliver_wakeups = ctx->m_deliver_wakeups;
+    pthread_mutex_lock(&ctx->m_rx_setting_mutex);
+    ctx->m_cur_gps_status = GPS_STATUS_SESSION_END;
+    pthread_mutex_unlock(&ctx->m_rx_setting_mutex);
+    wl_report_cur_state(ctx, ctx->m_cur_gps_status);
+    wl_lose_geofence_fixes(ctx);
     return 0;
 }
 
@@ -1276,10 +3356,18 @@ static void wl_gps_delete_aiding_data(GpsAidingData flags)
 }
 
 
+/*
+ * Only the interval and recurrence are used, as the bounds of ADAPTIVE_RATE;
+ * they take effect at the next start.
+ */
 static int wl_gps_set_position_mode(GpsPositionMode mode, GpsPositionRecurrence recurrence,
             uint32_t min_interval, uint32_t preferred_accuracy, uint32_t preferred_time)
 {
-    LOGD("ql_gps_set_position_mode: Not support");
+    WlGpsContext *ctx = &g_gps_ctx;
+
+    LOGD("Enter wl_gps_set_position_mode: recurrence=%d min_interval=%u", recurrence, min_interval);
+    ctx->m_session_interval_s = min_interval / 1000;
+    ctx->m_session_single = (GPS_POSITION_RECURRENCE_SINGLE == recurrence);
     return 0;
 }
 
@@ -1288,6 +3376,16 @@ static const void* wl_gps_get_extension(const char* name)
     LOGD("Enter wl_gps_get_extension: para=%s", name);
     if (!strcmp(name, GPS_XTRA_INTERFACE))
         return &wl_GpsXtraInterface;
+    if (!strcmp(name, GPS_GEOFENCING_INTERFACE))
+        return &wl_GpsGeofencingInterface;
+    if (!strcmp(name, WL_GPS_HISTORY_INTERFACE))
+        return &wl_GpsHistoryInterface;
+    if (!strcmp(name, WL_GPS_SUBSCRIPTION_INTERFACE))
+        return &wl_GpsSubscriptionInterface;
+    if (!strcmp(name, WL_GPS_WAKEUPS_INTERFACE))
+        return &wl_GpsWakeupsInterface;
+    if (!strcmp(name, WL_GPS_RX_STATS_INTERFACE))
+        return &wl_GpsRxStatsInterface;
     return NULL;
 }
 
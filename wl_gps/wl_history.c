@@ -0,0 +1,172 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wl_log.h"
+#include "wl_history.h"
+
+static int32_t wl_history_round(double value, double limit)
+{
+    if (value > limit)
+        value = limit;
+    else if (value < -limit)
+        value = -limit;
+    return (int32_t)lrint(value);
+}
+
+static uint16_t wl_history_round_u16(double value)
+{
+    if (!(value > 0))
+        return 0;
+    if (value > 65535.0)
+        return 65535;
+    return (uint16_t)lrint(value);
+}
+
+int wl_history_init(WlHistory *history, int capacity)
+{
+    memset(history, 0, sizeof(*history));
+    if (capacity <= 0)
+        return 0;
+
+    history->m_time = malloc(sizeof(GpsUtcTime) * capacity);
+    history->m_fixes = malloc(sizeof(WlHistoryFix) * capacity);
+    if ((NULL == history->m_time) || (NULL == history->m_fixes))
+    {
+        LOGE("[wl_history_init]:can not allocate %d fixes", capacity);
+        wl_history_free(history);
+        return -1;
+    }
+    history->m_cap = capacity;
+    return 0;
+}
+
+void wl_history_free(WlHistory *history)
+{
+    free(history->m_time);
+    free(history->m_fixes);
+    memset(history, 0, sizeof(*history));
+}
+
+/*ring slot of the index-th oldest fix*/
+static int wl_history_slot(const WlHistory *history, int index)
+{
+    int slot = history->m_head - history->m_count + index;
+
+    return (slot < 0) ? slot + history->m_cap : slot;
+}
+
+static GpsUtcTime wl_history_time(const WlHistory *history, int index)
+{
+    return history->m_time[wl_history_slot(history, index)];
+}
+
+void wl_history_add(WlHistory *history, const GpsLocation *location)
+{
+    WlHistoryFix *fix;
+    double bearing;
+
+    if (0 == history->m_cap)
+        return;
+
+    if ((history->m_count > 0) && (location->timestamp < wl_history_time(history, history->m_count - 1)))
+    {
+        LOGD("[wl_history_add]:time went back, %d fixes forgotten", history->m_count);
+        history->m_head = 0;
+        history->m_count = 0;
+    }
+
+    fix = &history->m_fixes[history->m_head];
+    fix->m_latitude_e7 = wl_history_round(location->latitude * 1e7, 900000000.0);
+    fix->m_longitude_e7 = wl_history_round(location->longitude * 1e7, 1800000000.0);
+    fix->m_altitude_cm = wl_history_round(location->altitude * 100.0, 2000000000.0);
+    fix->m_speed_cms = wl_history_round_u16(location->speed * 100.0);
+    bearing = fmod(location->bearing, 360.0);
+    if (bearing < 0)
+        bearing += 360.0;
+    fix->m_bearing_cdeg = wl_history_round_u16(bearing * 100.0) % 36000;
+    fix->m_accuracy_dm = wl_history_round_u16(location->accuracy * 10.0);
+    fix->m_flags = location->flags;
+    history->m_time[history->m_head] = location->timestamp;
+
+    history->m_head = (history->m_head + 1 == history->m_cap) ? 0 : history->m_head + 1;
+    if (history->m_count < history->m_cap)
+        history->m_count++;
+}
+
+static void wl_history_unpack(const WlHistory *history, int index, GpsLocation *location)
+{
+    int slot = wl_history_slot(history, index);
+    const WlHistoryFix *fix = &history->m_fixes[slot];
+
+    memset(location, 0, sizeof(*location));
+    location->size = sizeof(GpsLocation);
+    location->flags = fix->m_flags;
+    location->latitude = fix->m_latitude_e7 / 1e7;
+    location->longitude = fix->m_longitude_e7 / 1e7;
+    location->altitude = fix->m_altitude_cm / 100.0;
+    location->speed = fix->m_speed_cms / 100.0f;
+    location->bearing = fix->m_bearing_cdeg / 100.0f;
+    location->accuracy = fix->m_accuracy_dm / 10.0f;
+    location->timestamp = history->m_time[slot];
+}
+
+/*index of the first fix from first on that is no older than time*/
+static int wl_history_find(const WlHistory *history, int first, GpsUtcTime time)
+{
+    int last = history->m_count;
+
+    while (first < last)
+    {
+        int mid = first + (last - first) / 2;
+
+        if (wl_history_time(history, mid) < time)
+            first = mid + 1;
+        else
+            last = mid;
+    }
+    return first;
+}
+
+int wl_history_range(const WlHistory *history, GpsUtcTime from, GpsUtcTime to, GpsUtcTime step,
+            GpsLocation *out, int max)
+{
+    int index = wl_history_find(history, 0, from);
+    int filled = 0;
+
+    while ((filled < max) && (index < history->m_count))
+    {
+        GpsUtcTime time = wl_history_time(history, index);
+
+        if (time > to)
+            break;
+        wl_history_unpack(history, index, &out[filled++]);
+        /*downsampled, the next one is bisected for instead of walked to*/
+        index = (step > 0) ? wl_history_find(history, index + 1, time + step) : index + 1;
+    }
+    return filled;
+}
+
+int wl_history_last(const WlHistory *history, GpsLocation *out, int max)
+{
+    int first = (max < history->m_count) ? history->m_count - max : 0;
+    int i;
+
+    if (max <= 0)
+        return 0;
+    for (i = first; i < history->m_count; i++)
+        wl_history_unpack(history, i, &out[i - first]);
+    return history->m_count - first;
+}
+
+int wl_history_span(const WlHistory *history, GpsUtcTime *oldest, GpsUtcTime *newest)
+{
+    if (history->m_count > 0)
+    {
+        if (oldest)
+            *oldest = wl_history_time(history, 0);
+        if (newest)
+            *newest = wl_history_time(history, history->m_count - 1);
+    }
+    return history->m_count;
+}
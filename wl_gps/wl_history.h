@@ -0,0 +1,69 @@
+#ifndef WL_HISTORY_H
+#define WL_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <hardware/gps.h>
+
+/*
+ * What GpsInterface.get_extension returns for WL_GPS_HISTORY_INTERFACE: the
+ * fixes the HAL kept, HISTORY_LEN of them at most. Times are on the clock of
+ * GpsLocation.timestamp. Every call fills at most max entries of out, oldest
+ * first, and returns how many it filled; only those are copied.
+ */
+#define WL_GPS_HISTORY_INTERFACE "wl-gps-history"
+
+typedef struct
+{
+    size_t size;
+    /*fixes from from to to, each at least step after the one before, 0 for all*/
+    int (*get_range)(GpsUtcTime from, GpsUtcTime to, GpsUtcTime step, GpsLocation *out, int max);
+    /*the newest max fixes*/
+    int (*get_last)(GpsLocation *out, int max);
+    /*how many fixes are kept, and the oldest and newest time when any are*/
+    int (*get_span)(GpsUtcTime *oldest, GpsUtcTime *newest);
+} WlGpsHistoryInterface;
+
+/*
+ * A fix packed into 20 bytes: 1e-7 degrees, centimeters, cm/s, 1/100 degree
+ * and decimeters, about 1cm and 1cm/s resolution.
+ */
+typedef struct
+{
+    int32_t m_latitude_e7;
+    int32_t m_longitude_e7;
+    int32_t m_altitude_cm;
+    uint16_t m_speed_cms;
+    uint16_t m_bearing_cdeg;
+    uint16_t m_accuracy_dm;
+    uint16_t m_flags;
+} WlHistoryFix;
+
+/*
+ * Ring of the latest m_cap fixes, allocated once. The times are a column of
+ * their own, so a range lookup bisects 8 bytes per fix and only touches the
+ * packed fixes it returns. Times never go backwards; a fix older than the
+ * newest starts the history over. The ring does no locking of its own.
+ */
+typedef struct
+{
+    GpsUtcTime *m_time;
+    WlHistoryFix *m_fixes;
+    int m_cap;
+    /*where the next fix goes, and how many the ring holds*/
+    int m_head;
+    int m_count;
+} WlHistory;
+
+/*0, or -1 when the memory is not there; a capacity of 0 keeps nothing*/
+int wl_history_init(WlHistory *history, int capacity);
+void wl_history_free(WlHistory *history);
+
+void wl_history_add(WlHistory *history, const GpsLocation *location);
+
+int wl_history_range(const WlHistory *history, GpsUtcTime from, GpsUtcTime to, GpsUtcTime step,
+            GpsLocation *out, int max);
+int wl_history_last(const WlHistory *history, GpsLocation *out, int max);
+int wl_history_span(const WlHistory *history, GpsUtcTime *oldest, GpsUtcTime *newest);
+
+#endif
@@ -1,9 +1,30 @@
-#include <android/log.h>
-
 #define LOG_TAG "WL_GPS"
 
+#ifdef __ANDROID__
+#include <android/log.h>
+
 #define LOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG , LOG_TAG, __VA_ARGS__)
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO  , LOG_TAG, __VA_ARGS__)
 #define LOGW(...) __android_log_print(ANDROID_LOG_WARN  , LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR  , LOG_TAG, __VA_ARGS__)
+#else
+/*host builds of the parser and the tools only print warnings and errors*/
+#include <stdio.h>
+
+#define WL_HOST_LOG(...) do { fprintf(stderr, LOG_TAG ": " __VA_ARGS__); fputc('\n', stderr); } while (0)
+#define WL_HOST_NOLOG(...) do { if (0) fprintf(stderr, __VA_ARGS__); } while (0)
+
+#define LOGV(...) WL_HOST_NOLOG(__VA_ARGS__)
+#define LOGD(...) WL_HOST_NOLOG(__VA_ARGS__)
+#define LOGI(...) WL_HOST_NOLOG(__VA_ARGS__)
+#define LOGW(...) WL_HOST_LOG(__VA_ARGS__)
+#define LOGE(...) WL_HOST_LOG(__VA_ARGS__)
+#endif
+
+/*per-sentence tracing, too chatty for anything but bring-up builds*/
+#ifdef WL_GPS_TRACE_NMEA
+#define LOGT(...) LOGD(__VA_ARGS__)
+#else
+#define LOGT(...) do {} while (0)
+#endif
@@ -0,0 +1,1105 @@
+#include <math.h>
+#include <time.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "wl_log.h"
+#include "wl_nmea.h"
+
+typedef struct 
+{
+    const char * m_beg;
+    const char * m_end;
+} Charseg;
+
+typedef struct 
+{
+    int m_count;
+    Charseg m_segs[ WL_NMEA_MAX_FIELDS ];
+} NmeaInfoSegs;
+
+static int wl_calc_utc_sub(void)
+{
+    time_t         now = time(NULL);
+    struct tm      tm_local;
+    struct tm      tm_utc;
+    long           time_local, time_utc;
+
+    gmtime_r( &now, &tm_utc );
+    localtime_r( &now, &tm_local );
+
+    time_local = tm_local.tm_sec +
+                 60*(tm_local.tm_min +
+                 60*(tm_local.tm_hour +
+                 24*(tm_local.tm_yday +
+                 365*tm_local.tm_year)));
+
+    time_utc = tm_utc.tm_sec +
+               60*(tm_utc.tm_min +
+               60*(tm_utc.tm_hour +
+               24*(tm_utc.tm_yday +
+               365*tm_utc.tm_year)));
+    return time_local - time_utc;
+}
+
+/*splits no more than the first max_count fields, the rest read as empty*/
+static int wl_get_all_segments_from_buf( NmeaInfoSegs *seg, const char *line_buf, int line_len, int max_count)
+{
+    int    count = 0;
+    const char *p = line_buf;
+    const char *line_end = line_buf+line_len;
+
+    if ((p[0] != '$') || (p[line_len-3] != '*'))
+    {
+    	LOGD("p[%d]:%c",(line_len-3),p[line_len-3]);
+        LOGD("Line format not correct");
+        return 0;
+    }
+
+    p++;
+    line_end -= 3;
+
+    while ((p < line_end) && (count < max_count)) 
+    {
+        const char*  q = p;
+
+        q = memchr(p, ',', line_end-p);
+        if (q == NULL)
+            q = line_end;
+        
+        if (q >= p) 
+        {
+            seg->m_segs[count].m_beg = p;
+            seg->m_segs[count].m_end = q;
+            count += 1;
+        }
+        
+        if (q < line_end)
+            q += 1;
+
+        p = q;
+    }
+
+    seg->m_count = count;
+    return count;
+}
+
+/*the same split out of the field ends a stream recorded, without a scan*/
+static void wl_get_segments_from_fields(NmeaInfoSegs *seg, const NmeaSentence *sentence, int max_count)
+{
+    int count = (sentence->m_field_count < max_count) ? sentence->m_field_count : max_count;
+    int beg = 1;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        seg->m_segs[i].m_beg = sentence->m_line + beg;
+        seg->m_segs[i].m_end = sentence->m_line + sentence->m_field_end[i];
+        beg = sentence->m_field_end[i] + 1;
+    }
+    seg->m_count = count;
+}
+
+static int wl_hex_digit(char c)
+{
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    return -1;
+}
+
+/*sum is the XOR of everything before the '*' at star, the '$' included*/
+static int wl_check_sum(const char *line_buf, int line_len, int star, unsigned char sum)
+{
+    int high, low;
+
+    if ((star < 0) || (line_buf[0] != '$'))
+        return WL_NMEA_CHECKSUM_NONE;
+    if (star + 3 != line_len)
+        return WL_NMEA_CHECKSUM_BAD;
+
+    high = wl_hex_digit(line_buf[star + 1]);
+    low = wl_hex_digit(line_buf[star + 2]);
+    if ((high < 0) || (low < 0) || (((high << 4) | low) != (sum ^ '$')))
+        return WL_NMEA_CHECKSUM_BAD;
+    return WL_NMEA_CHECKSUM_OK;
+}
+
+/*
+ * The first '*' is the one that counts, as in wl_nmea_stream_feed: a line
+ * spliced onto the head of another has its own '*' before the last one.
+ */
+static int wl_line_checksum(const char *line_buf, int line_len)
+{
+    const char *star;
+    unsigned char sum = 0;
+    int i;
+
+    if (line_len <= 0)
+        return WL_NMEA_CHECKSUM_NONE;
+    /*the stream drops a stray '\r' from the sum, neither may take such a line*/
+    if (memchr(line_buf, '\r', line_len))
+        return WL_NMEA_CHECKSUM_BAD;
+    /*'$' only starts a sentence, the sum of a splice can match by chance*/
+    if ((line_len > 1) && memchr(line_buf + 1, '$', line_len - 1))
+        return WL_NMEA_CHECKSUM_BAD;
+    star = memchr(line_buf, '*', line_len);
+    if (NULL == star)
+        return WL_NMEA_CHECKSUM_NONE;
+    for (i = 0; i < star - line_buf; i++)
+        sum ^= line_buf[i];
+    return wl_check_sum(line_buf, line_len, star - line_buf, sum);
+}
+
+static Charseg wl_get_segments_by_index(NmeaInfoSegs *nmea_seg, int index)
+{
+    Charseg  seg;
+    static const char *empty_str = "";
+
+    if (index < 0 || index >= nmea_seg->m_count) 
+    {
+        seg.m_beg = seg.m_end = empty_str;
+    } 
+    else
+    {
+        seg = nmea_seg->m_segs[index];
+    }
+
+    return seg;
+}
+
+static int str2int(const char *beg, const char * end)
+{
+    int   result = 0;
+    int   len    = end - beg;
+
+    for ( ; len > 0; len--, beg++ )
+    {
+        int  c;
+
+        if (beg >= end)
+            goto Fail;
+
+        c = *beg - '0';
+        if ((unsigned)c >= 10)
+            goto Fail;
+
+        result = result*10 + c;
+    }
+    return  result;
+
+Fail:
+    return -1;
+}
+
+static double str2float(const char *beg, const char *end)
+{
+    int   len    = end - beg;
+    char  temp[16];
+
+    if (len >= (int)sizeof(temp))
+        return 0.;
+
+    memcpy( temp, beg, len );
+    temp[len] = 0;
+    return strtod( temp, NULL );
+}
+
+static double wl_get_latlong_from_seg(Charseg seg)
+{
+    double  val     = str2float(seg.m_beg, seg.m_end);
+    int     degrees = (int)(floor(val) / 100);
+    double  minutes = val - degrees*100.;
+    double  dcoord  = degrees + minutes / 60.0;
+    return dcoord;
+}
+
+static int wl_get_latlong(GpsLocation *loc, Charseg latitude, Charseg latitudeHemi, Charseg longitude, Charseg longitudeHemi )
+{
+    double   lat, lon;
+    Charseg seg;
+
+    seg = latitude;
+    if (seg.m_beg + 6 > seg.m_end) 
+    {
+        LOGD("Warning! Latitude is not correct");
+        return -1;
+    }
+    
+    lat = wl_get_latlong_from_seg(seg);
+	LOGT("wl_get_latlong:lat=%f",lat);
+    if (latitudeHemi.m_beg[0] == 'S')
+        lat = -lat;
+
+    seg = longitude;
+    if (seg.m_beg + 6 > seg.m_end) 
+    {
+        LOGD("Warning! longitude is not correct");
+        return -1;
+    }
+    lon = wl_get_latlong_from_seg(seg);
+	LOGT("wl_get_latlong:lon=%f",lon);
+    if (longitudeHemi.m_beg[0] == 'W')
+        lon = -lon;
+
+    loc->flags    |= GPS_LOCATION_HAS_LAT_LONG;
+    loc->latitude  = lat;
+    loc->longitude = lon;
+    return 0;
+}
+
+static int wl_get_altitude(GpsLocation *loc, Charseg altitude, Charseg units)
+{
+    Charseg seg = altitude;
+
+    if (seg.m_beg >= seg.m_end)
+        return -1;
+
+    loc->flags   |= GPS_LOCATION_HAS_ALTITUDE;
+    loc->altitude = str2float(seg.m_beg, seg.m_end);
+    return 0;
+}
+
+static int wl_get_time(UtcInfo *utc_info, GpsLocation *loc, Charseg  seg)
+{
+    int hour, minute;
+    double seconds;
+    struct tm  tm;
+	struct tm  utc;
+    time_t     fix_time;
+	double tmp = 0 ;
+
+    if (seg.m_beg + 6 > seg.m_end)
+        return -1;
+
+    if (utc_info->m_year < 0)
+    {
+        time_t  now = time(NULL);
+        gmtime_r( &now, &tm );
+        utc_info->m_year = tm.tm_year + 1900;
+        utc_info->m_month = tm.tm_mon + 1;
+        utc_info->m_day  = tm.tm_mday;
+    }
+
+    hour = str2int(seg.m_beg,   seg.m_beg+2);
+    minute  = str2int(seg.m_beg+2, seg.m_beg+4);
+    seconds = str2float(seg.m_beg+4, seg.m_end);
+
+    tm.tm_hour  = hour;
+    tm.tm_min   = minute;
+    tm.tm_sec   = (int) seconds;
+    tm.tm_year  = utc_info->m_year - 1900;
+    tm.tm_mon   = utc_info->m_month - 1;
+    tm.tm_mday  = utc_info->m_day;
+    tm.tm_isdst = -1;
+
+	tmp = ceil((fabs(loc->longitude) - 7.5) / 15 + 1);
+	utc_info->m_sub = (loc->longitude / fabs(loc->longitude)) * tmp * 3600;
+
+	fix_time = mktime( &tm ) + utc_info->m_sub;
+	
+    loc->timestamp = (long long)fix_time;
+	
+	gmtime_r( (time_t*) &loc->timestamp, &utc );
+	
+    return 0;
+}
+
+static int wl_get_bearing(GpsLocation *loc, Charseg bearing)
+{
+    Charseg seg = bearing;
+    float   value = 0.0f;
+
+    if (seg.m_beg < seg.m_end) 
+    {
+        value = str2float(seg.m_beg, seg.m_end);
+    } 
+    else if ((seg.m_beg >= seg.m_end) && (loc->flags & GPS_LOCATION_HAS_BEARING)) 
+    {
+        return 0;
+    }
+
+    loc->flags   |= GPS_LOCATION_HAS_BEARING;
+    loc->bearing  = value;
+    return 0;
+}
+
+static int wl_get_speed(GpsLocation *loc, Charseg speed)
+{
+    Charseg seg = speed;
+
+    if (seg.m_beg >= seg.m_end)
+        return -1;
+
+    loc->flags  |= GPS_LOCATION_HAS_SPEED;
+    loc->speed = (1.852 / 3.6) * str2float(seg.m_beg, seg.m_end); 
+    return 0;
+}
+
+static int wl_get_date(UtcInfo *utc_info, GpsLocation *loc, Charseg date, Charseg time)
+{
+    Charseg  seg = date;
+    int day, month, year;
+
+    if (seg.m_beg + 6 != seg.m_end) 
+    {
+        LOGD("Date format error");
+        return -1;
+    }
+    
+    day  = str2int(seg.m_beg, seg.m_beg+2);
+    month  = str2int(seg.m_beg+2, seg.m_beg+4);
+    year = str2int(seg.m_beg+4, seg.m_beg+6) + 2000;
+
+    if ((day|month|year) < 0) 
+    {
+        LOGD("Date format error");
+        return -1;
+    }
+
+    utc_info->m_year  = year;
+    utc_info->m_month   = month;
+    utc_info->m_day   = day;
+
+    return wl_get_time(utc_info, loc, time);
+}
+
+/*sv_list entry with the lowest SNR, sv_list must be full*/
+static int wl_weakest_sv(const GpsSvStatus *sv_status)
+{
+    int weakest = 0;
+    int i;
+
+    for (i = 1; i < GPS_MAX_SVS; i++)
+    {
+        if (sv_status->sv_list[i].snr < sv_status->sv_list[weakest].snr)
+            weakest = i;
+    }
+    return weakest;
+}
+
+void wl_reset_parse_state(NmeaParseState *state)
+{
+    memset(state, 0, sizeof(NmeaParseState));
+
+    /*init location info*/
+    state->m_loc.size = sizeof(GpsLocation);
+
+    /*init information of utc time*/
+    state->m_utc_info.m_year = -1;
+    state->m_utc_info.m_month = -1;
+    state->m_utc_info.m_day = -1;
+    state->m_utc_info.m_sub = wl_calc_utc_sub();
+}
+
+void wl_attach_parse_memo(NmeaParseState *state, NmeaMemo *memo)
+{
+    memset(memo, 0, sizeof(NmeaMemo));
+    state->m_memo = memo;
+}
+
+/*
+ * Wall clock in ms, as GpsUtcTime wants it. The coarse clock is read from the
+ * vDSO without a syscall; tick resolution is plenty for stamping sentences.
+ */
+static GpsUtcTime wl_coarse_time_ms(void)
+{
+    struct timespec ts;
+
+#ifdef CLOCK_REALTIME_COARSE
+    if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) != 0)
+#endif
+        clock_gettime(CLOCK_REALTIME, &ts);
+    return (GpsUtcTime)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+unsigned int wl_nmea_sentence_type(const char *line_buf, int line_len)
+{
+    const char *type = line_buf + 3;
+
+    /*"$P" starts a vendor's own sentence, "$PGRMC" is no RMC*/
+    if ((line_len < 6) || (line_buf[0] != '$') || (line_buf[1] == 'P'))
+        return 0;
+
+    if (!memcmp(type, "GGA", 3))
+        return WL_NMEA_GGA;
+    if (!memcmp(type, "GSA", 3))
+        return WL_NMEA_GSA;
+    if (!memcmp(type, "GSV", 3))
+        return WL_NMEA_GSV;
+    if (!memcmp(type, "VTG", 3))
+        return WL_NMEA_VTG;
+    if (!memcmp(type, "RMC", 3))
+        return WL_NMEA_RMC;
+    return 0;
+}
+
+/*
+ * How many leading fields, the sentence token included, the parser has to
+ * split for what the callbacks take. 1 means the sentence is only forwarded.
+ */
+static int wl_needed_segments(unsigned int type, const NmeaParseCallbacks *callbacks,
+            const GpsLocation *loc)
+{
+    int want_location = (callbacks->location_cb != NULL);
+    int want_sv_status = (callbacks->sv_status_cb != NULL);
+
+    switch (type)
+    {
+    case WL_NMEA_GGA:
+        /*up to the altitude units*/
+        return want_location ? 11 : 1;
+    case WL_NMEA_GSA:
+        /*the 12 PRNs end at 14, the accuracy is 15*/
+        return want_location ? 16 : (want_sv_status ? 15 : 1);
+    case WL_NMEA_GSV:
+        /*4 satellites of 4 fields from 4 on*/
+        return want_sv_status ? 20 : 1;
+    case WL_NMEA_VTG:
+        /*an RMC that came first already gave both*/
+        if (want_location && ((loc->flags & (GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING))
+            != (GPS_LOCATION_HAS_SPEED | GPS_LOCATION_HAS_BEARING)))
+            return 6;
+        return 1;
+    case WL_NMEA_RMC:
+        /*closes the epoch whoever listens, the fix needs up to the date*/
+        return want_location ? 10 : 1;
+    default:
+        return 1;
+    }
+}
+
+/*
+ * 0 for a sentence the parser reads whose checksum matches, -1 for one too
+ * short, of a type it does not read or failing the checksum.
+ */
+static int wl_check_sentence(const char *line_buf, int line_len, int checksum, unsigned int *type)
+{
+    if (line_len < 9)
+    {
+        LOGD("Len=%d, too short for a nmea line", line_len);
+        return -1;
+    }
+
+    /*proprietary and other sentences are not split, nothing here reads them*/
+    *type = wl_nmea_sentence_type(line_buf, line_len);
+    if (0 == *type)
+    {
+        LOGT("Not a sentence the parser knows: %.*s", line_len, line_buf);
+        return -1;
+    }
+
+    if (checksum != WL_NMEA_CHECKSUM_OK)
+    {
+        LOGD("Checksum %s: %.*s", (checksum == WL_NMEA_CHECKSUM_NONE) ? "missing" : "wrong",
+            line_len, line_buf);
+        return -1;
+    }
+    return 0;
+}
+
+static void wl_forward_sentence(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const char *line_buf, int line_len, unsigned int type)
+{
+    if (callbacks->nmea_cb && (callbacks->nmea_mask & type))
+    {
+        if (0 == state->m_epoch_time)
+            state->m_epoch_time = wl_coarse_time_ms();
+        callbacks->nmea_cb(callbacks->user, state->m_epoch_time, line_buf, line_len);
+    }
+}
+
+/*NmeaMemoEntry.m_wants*/
+#define WL_MEMO_WANTS_LOCATION (1 << 0)
+#define WL_MEMO_WANTS_SV_STATUS (1 << 1)
+
+/*the callbacks a GSA or GSV is decoded for, 0 when it is only forwarded*/
+static unsigned int wl_memo_wants(unsigned int type, const NmeaParseCallbacks *callbacks)
+{
+    unsigned int wants = 0;
+
+    if ((type != WL_NMEA_GSA) && (type != WL_NMEA_GSV))
+        return 0;
+    if (callbacks->sv_status_cb)
+        wants |= WL_MEMO_WANTS_SV_STATUS;
+    if ((type == WL_NMEA_GSA) && callbacks->location_cb)
+        wants |= WL_MEMO_WANTS_LOCATION;
+    return wants;
+}
+
+/*
+ * Talker, type, GSV message number and checksum, never 0. The checksum is
+ * what tells the sentences of one type apart.
+ */
+static uint32_t wl_memo_key(const char *line_buf, int line_len, unsigned int type)
+{
+    uint32_t key = ((unsigned char)line_buf[1] << 24) | ((unsigned char)line_buf[2] << 16);
+
+    key |= ((wl_hex_digit(line_buf[line_len - 2]) << 4) | wl_hex_digit(line_buf[line_len - 1])) << 8;
+    /*"$GPGSV,3,1," the number is the 10th byte*/
+    if (type == WL_NMEA_GSV)
+        key |= 0x80 | ((line_len > 10) ? (line_buf[9] & 0x7f) : 0);
+    return key;
+}
+
+/*index of the entry holding exactly this sentence, whatever it was decoded for, or -1*/
+static int wl_memo_find(NmeaMemo *memo, uint32_t key, const char *line_buf, int line_len)
+{
+    int i;
+
+    for (i = 0; i < WL_NMEA_MEMO_ENTRIES; i++)
+    {
+        if ((memo->m_keys[i] == key) && (memo->m_entries[i].m_len == line_len)
+            && !memcmp(memo->m_entries[i].m_line, line_buf, line_len))
+        {
+            memo->m_used[i] = ++memo->m_clock;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*keeps what a sentence the memo missed decoded to*/
+static void wl_memo_store(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const char *line_buf, int line_len, unsigned int type, const void *fields, size_t size)
+{
+    NmeaMemo *memo = state->m_memo;
+    NmeaMemoEntry *entry;
+    uint32_t key;
+    int slot, i;
+
+    if ((NULL == memo) || (line_len > WL_NMEA_MEMO_LINE))
+        return;
+
+    key = wl_memo_key(line_buf, line_len, type);
+    /*decoded for fewer callbacks before, the entry is redone in place*/
+    slot = wl_memo_find(memo, key, line_buf, line_len);
+    if (slot < 0)
+    {
+        /*empty entries are used 0, before anything*/
+        slot = 0;
+        for (i = 1; i < WL_NMEA_MEMO_ENTRIES; i++)
+        {
+            if (memo->m_used[i] < memo->m_used[slot])
+                slot = i;
+        }
+    }
+
+    entry = &memo->m_entries[slot];
+    entry->m_type = type;
+    entry->m_wants = wl_memo_wants(type, callbacks);
+    entry->m_len = line_len;
+    memcpy(entry->m_line, line_buf, line_len);
+    memcpy(&entry->m_fields, fields, size);
+    memo->m_keys[slot] = key;
+    memo->m_used[slot] = ++memo->m_clock;
+}
+
+/*only the fields the callbacks take*/
+static void wl_decode_gsa(const NmeaParseCallbacks *callbacks, NmeaInfoSegs *info_segs,
+            NmeaGsaFields *fields)
+{
+    int i;
+
+    memset(fields, 0, sizeof(NmeaGsaFields));
+    if (callbacks->location_cb)
+    {
+        Charseg seg_acc = wl_get_segments_by_index(info_segs, 15);
+
+        fields->m_accuracy = str2float(seg_acc.m_beg, seg_acc.m_end);
+    }
+
+    /*the PRNs only go into the SV status*/
+    for (i = 0; callbacks->sv_status_cb && (i < 12); i++)
+    {
+        Charseg seg_satellite_using = wl_get_segments_by_index(info_segs, i + 3);
+        int temp_number = str2int(seg_satellite_using.m_beg, seg_satellite_using.m_end);
+
+        if (0 == temp_number)
+            break;
+        fields->m_prn[fields->m_count++] = temp_number;
+    }
+}
+
+static void wl_apply_gsa(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const NmeaGsaFields *fields)
+{
+    GpsLocation *loc = &state->m_loc;
+    int i;
+
+    if (callbacks->location_cb)
+    {
+        loc->accuracy = fields->m_accuracy;
+        loc->flags |= GPS_LOCATION_HAS_ACCURACY;
+    }
+
+    /*multi-GNSS receivers send one GSA per constellation, each adds its PRNs*/
+    if (0 == (state->m_sv_status_flag & 0x01))
+        memset(&state->m_satellites_info, 0, sizeof(UsingSatellitesInfo));//Added
+    for (i = 0; callbacks->sv_status_cb && (i < fields->m_count); i++)
+    {
+        if (state->m_satellites_info.m_count >= WL_NMEA_MAX_USED_SVS)
+            break;
+        state->m_satellites_info.m_number[state->m_satellites_info.m_count++] = fields->m_prn[i];
+    }
+
+    state->m_sv_status_flag |= 0x01;
+}
+
+/*-1 for a message number out of range*/
+static int wl_decode_gsv(NmeaInfoSegs *info_segs, NmeaGsvFields *fields)
+{
+    Charseg seg_msg_index = wl_get_segments_by_index(info_segs, 2);
+    Charseg seg_satellites_visble = wl_get_segments_by_index(info_segs, 3);
+    int satellites_visble = str2int(seg_satellites_visble.m_beg, seg_satellites_visble.m_end);
+    int i;
+
+    fields->m_msg_index = str2int(seg_msg_index.m_beg, seg_msg_index.m_end);
+    /*the message number is a single digit, at most 36 satellites per talker*/
+    if ((fields->m_msg_index < 1) || (fields->m_msg_index > 9))
+    {
+        LOGD("GSV message index %d out of range", fields->m_msg_index);
+        return -1;
+    }
+
+    fields->m_count = satellites_visble - 4 * (fields->m_msg_index - 1);
+    if (fields->m_count > 4)
+    {
+        fields->m_count = 4;
+    }
+
+    LOGT("satellites visible = %d messages index = %d\n",satellites_visble,fields->m_msg_index);
+
+    for (i = 0; i < fields->m_count; i++)
+    {
+        GpsSvInfo *sv_info = &fields->m_sv[i];
+
+        sv_info->size = sizeof(GpsSvInfo);
+
+        Charseg seg_prn = wl_get_segments_by_index(info_segs, 4 + i * 4);
+        sv_info->prn = str2int(seg_prn.m_beg,seg_prn.m_end);
+
+        Charseg seg_elevation = wl_get_segments_by_index(info_segs,5 + i * 4);
+        sv_info->elevation = str2float(seg_elevation.m_beg,seg_elevation.m_end);
+
+        Charseg seg_azimuth = wl_get_segments_by_index(info_segs,6 + i * 4);
+        sv_info->azimuth = str2float(seg_azimuth.m_beg,seg_azimuth.m_end);
+
+        Charseg seg_snr = wl_get_segments_by_index(info_segs,7 + i * 4);
+        sv_info->snr = str2float(seg_snr.m_beg,seg_snr.m_end);
+
+        LOGT("prn:%d snr:%f elevation:%f azimuth:%f\n",sv_info->prn,sv_info->snr,sv_info->elevation,sv_info->azimuth);
+    }
+    return 0;
+}
+
+static void wl_apply_gsv(NmeaParseState *state, const NmeaGsvFields *fields)
+{
+    GpsSvStatus *p_gps_sv_status = &state->m_sv_status_info;
+    int i;
+
+    /*
+     * Every constellation numbers its own GSV group from 1; a group
+     * starts filling sv_list where the previous one ended.
+     */
+    if (1 == fields->m_msg_index)
+        state->m_gsv_base = p_gps_sv_status->num_svs;
+
+    state->m_sv_status_flag |= (1<<fields->m_msg_index);
+
+    p_gps_sv_status->size = sizeof(GpsSvStatus);
+
+    for (i = 0; i < fields->m_count; i++)
+    {
+        int slot = state->m_gsv_base + i + 4 * (fields->m_msg_index - 1);
+
+        /*sv_list is fixed by the HAL ABI; once full keep the strongest satellites*/
+        if (slot >= GPS_MAX_SVS)
+        {
+            slot = wl_weakest_sv(p_gps_sv_status);
+            if (fields->m_sv[i].snr <= p_gps_sv_status->sv_list[slot].snr)
+                continue;
+        }
+        p_gps_sv_status->sv_list[slot] = fields->m_sv[i];
+        if (slot >= p_gps_sv_status->num_svs)
+            p_gps_sv_status->num_svs = slot + 1;
+    }
+}
+
+static void wl_deliver_location(NmeaParseState *state, const NmeaParseCallbacks *callbacks);
+
+/*
+ * Takes a GSA or GSV the memo has, decoded for at least the callbacks there
+ * are now, without splitting it again. 0 leaves it to the full decode.
+ */
+static int wl_decode_from_memo(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const char *line_buf, int line_len, unsigned int type)
+{
+    NmeaMemo *memo = state->m_memo;
+    unsigned int wants = wl_memo_wants(type, callbacks);
+    NmeaMemoEntry *entry;
+    int slot;
+
+    if ((NULL == memo) || (0 == wants) || (line_len > WL_NMEA_MEMO_LINE))
+        return 0;
+
+    slot = wl_memo_find(memo, wl_memo_key(line_buf, line_len, type), line_buf, line_len);
+    if ((slot < 0) || ((memo->m_entries[slot].m_wants & wants) != wants))
+    {
+        memo->m_misses++;
+        return 0;
+    }
+    memo->m_hits++;
+    entry = &memo->m_entries[slot];
+
+    wl_forward_sentence(state, callbacks, line_buf, line_len, type);
+    if (type == WL_NMEA_GSA)
+        wl_apply_gsa(state, callbacks, &entry->m_fields.m_gsa);
+    else
+        wl_apply_gsv(state, &entry->m_fields.m_gsv);
+    wl_deliver_location(state, callbacks);
+    return 1;
+}
+
+/*everything past the split, needed is what wl_needed_segments said*/
+static void wl_decode_segments(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const char *line_buf, int line_len, unsigned int type, int needed,
+            NmeaInfoSegs *info_segs)
+{
+    GpsLocation *loc = &state->m_loc;
+    Charseg seg;
+
+    seg = wl_get_segments_by_index(info_segs, 0);
+    if (seg.m_beg + 5 > seg.m_end)
+    {
+        LOGD("NMEA Token string too short");
+        return;
+    }
+
+    seg.m_beg += 2;
+
+    wl_forward_sentence(state, callbacks, line_buf, line_len, type);
+
+    /*nobody wants what this sentence carries, only RMC still ends the epoch*/
+    if ((1 == needed) && (type != WL_NMEA_RMC))
+        return;
+
+    if (!memcmp(seg.m_beg, "GGA", 3))
+    {
+        Charseg  seg_time          = wl_get_segments_by_index(info_segs,1);
+        Charseg  seg_latitude      = wl_get_segments_by_index(info_segs,2);
+        Charseg  seg_latitudeHemi  = wl_get_segments_by_index(info_segs,3);
+        Charseg  seg_longitude     = wl_get_segments_by_index(info_segs,4);
+        Charseg  seg_longitudeHemi = wl_get_segments_by_index(info_segs,5);
+        Charseg  seg_altitude      = wl_get_segments_by_index(info_segs,9);
+        Charseg  seg_altitudeUnits = wl_get_segments_by_index(info_segs,10);
+
+        wl_get_latlong(loc, seg_latitude, seg_latitudeHemi, seg_longitude, seg_longitudeHemi);
+        wl_get_altitude(loc, seg_altitude, seg_altitudeUnits);
+        wl_get_time(&state->m_utc_info, loc, seg_time);
+    }
+    else if (!memcmp(seg.m_beg, "GSA", 3))
+    {
+        NmeaGsaFields fields;
+
+        wl_decode_gsa(callbacks, info_segs, &fields);
+        wl_memo_store(state, callbacks, line_buf, line_len, type, &fields, sizeof(fields));
+        wl_apply_gsa(state, callbacks, &fields);
+    }
+    else if (!memcmp(seg.m_beg, "GSV", 3))
+    {
+        NmeaGsvFields fields;
+
+        if (wl_decode_gsv(info_segs, &fields) < 0)
+            return;
+        wl_memo_store(state, callbacks, line_buf, line_len, type, &fields, sizeof(fields));
+        wl_apply_gsv(state, &fields);
+    }
+    else if ( !memcmp(seg.m_beg, "VTG", 3))
+    {
+        Charseg seg_bearing = wl_get_segments_by_index(info_segs,1);
+        Charseg seg_speed = wl_get_segments_by_index(info_segs,5);
+        wl_get_bearing(loc, seg_bearing);
+        wl_get_speed(loc, seg_speed);
+    }
+    else if ( !memcmp(seg.m_beg, "RMC", 3) ) 
+    {
+        Charseg seg_time = wl_get_segments_by_index(info_segs,1);
+        Charseg seg_fixStatus = wl_get_segments_by_index(info_segs,2);
+        Charseg seg_latitude = wl_get_segments_by_index(info_segs,3);
+        Charseg seg_latitudeHemi = wl_get_segments_by_index(info_segs,4);
+        Charseg seg_longitude = wl_get_segments_by_index(info_segs,5);
+        Charseg seg_longitudeHemi = wl_get_segments_by_index(info_segs,6);
+        Charseg seg_speed = wl_get_segments_by_index(info_segs,7);
+        Charseg seg_bearing = wl_get_segments_by_index(info_segs,8);
+        Charseg seg_date = wl_get_segments_by_index(info_segs,9);
+
+        LOGT("fixStatus=%c", seg_fixStatus.m_beg[0]);
+        if (callbacks->location_cb && (seg_fixStatus.m_beg[0] == 'A'))
+        {
+            wl_get_latlong(loc, seg_latitude, seg_latitudeHemi, seg_longitude, seg_longitudeHemi);
+            wl_get_date(&state->m_utc_info, loc, seg_date, seg_time);
+            wl_get_bearing(loc, seg_bearing);
+            wl_get_speed  (loc, seg_speed);
+        }
+        {
+            unsigned int i;
+            state->m_sv_status_info.used_in_fix_mask &= 0x00;
+            
+            for(i = 0;callbacks->sv_status_cb && (i < state->m_satellites_info.m_count);i++)
+            {
+                if ((state->m_satellites_info.m_number[i] > 0) && (state->m_satellites_info.m_number[i] <= 32))
+                    state->m_sv_status_info.used_in_fix_mask |= (0x01 << (state->m_satellites_info.m_number[i] - 1)); 
+            }
+            
+            state->m_sv_status_flag = 0;
+            state->m_gsv_base = 0;
+            if (callbacks->sv_status_cb)
+                callbacks->sv_status_cb(callbacks->user, &state->m_sv_status_info);
+            
+            memset(&state->m_sv_status_info, 0, sizeof(GpsSvStatus));
+            memset(&state->m_satellites_info, 0, sizeof(UsingSatellitesInfo));
+        } 
+
+        state->m_epoch_time = 0;
+        if (callbacks->epoch_cb)
+            callbacks->epoch_cb(callbacks->user);
+    }
+
+    wl_deliver_location(state, callbacks);
+}
+
+/*reports the fix once the sentences of an epoch gave all of it*/
+static void wl_deliver_location(NmeaParseState *state, const NmeaParseCallbacks *callbacks)
+{
+    GpsLocation *loc = &state->m_loc;
+
+    if (loc->flags == 0x1f)
+    {
+#ifdef WL_GPS_TRACE_NMEA
+        char   temp[256];
+        char*  beg   = temp;
+        char*  end = beg + sizeof(temp);
+        struct tm   utc;
+
+        beg += snprintf(beg, end-beg, "Location info:" );
+        if (loc->flags & GPS_LOCATION_HAS_LAT_LONG) 
+        {
+            beg += snprintf(beg, end-beg, " lat=%g lon=%g", loc->latitude, loc->longitude);
+        }
+        if (loc->flags & GPS_LOCATION_HAS_ALTITUDE) 
+        {
+            beg += snprintf(beg, end-beg, " altitude=%g", loc->altitude);
+        }
+        if (loc->flags & GPS_LOCATION_HAS_SPEED) 
+        {
+            beg += snprintf(beg, end-beg, " speed=%g", loc->speed);
+        }
+        if (loc->flags & GPS_LOCATION_HAS_BEARING) 
+        {
+            beg += snprintf(beg, end-beg, " bearing=%g", loc->bearing);
+        }
+        if (loc->flags & GPS_LOCATION_HAS_ACCURACY) 
+        {
+            beg += snprintf(beg,end-beg, " accuracy=%g", loc->accuracy);
+        }
+        localtime_r( (time_t*) &loc->timestamp, &utc );
+        beg += snprintf(beg, end-beg, " time=%s", asctime( &utc ) );
+        LOGT("%s",temp);
+#endif
+        
+        if (callbacks->location_cb) 
+        {
+            callbacks->location_cb(callbacks->user, loc);
+            loc->flags &= 0x0;
+            loc->latitude = 0.0;
+            loc->longitude = 0.0;
+            loc->altitude = 0.0;
+            loc->speed = 0.0;
+            loc->bearing = 0.0;
+            loc->accuracy = 0.0;
+        }
+        else 
+        {
+            LOGD("No callback function for report location");
+        }
+    }  
+}
+
+void wl_parse_nmea_line(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const char *line_buf, int line_len)
+{
+    NmeaInfoSegs info_segs[1];
+    unsigned int type;
+    int needed;
+
+    while ((line_len > 0) && (line_buf[line_len - 1] == '\r'))
+        line_len--;
+    if (wl_check_sentence(line_buf, line_len, wl_line_checksum(line_buf, line_len), &type) < 0)
+        return;
+
+    needed = wl_needed_segments(type, callbacks, &state->m_loc);
+    if (wl_decode_from_memo(state, callbacks, line_buf, line_len, type))
+        return;
+    if (0 == wl_get_all_segments_from_buf(info_segs, line_buf, line_len, needed))
+    {
+        LOGD("No valid segments get");
+        return;
+    }
+    wl_decode_segments(state, callbacks, line_buf, line_len, type, needed, info_segs);
+}
+
+void wl_parse_nmea_sentence(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const NmeaSentence *sentence)
+{
+    NmeaInfoSegs info_segs[1];
+    unsigned int type;
+    int needed;
+
+    if (wl_check_sentence(sentence->m_line, sentence->m_len, sentence->m_checksum, &type) < 0)
+        return;
+    if (sentence->m_fields_cut)
+        LOGD("More than %d fields, the rest are ignored", WL_NMEA_MAX_FIELDS);
+
+    needed = wl_needed_segments(type, callbacks, &state->m_loc);
+    if (wl_decode_from_memo(state, callbacks, sentence->m_line, sentence->m_len, type))
+        return;
+    wl_get_segments_from_fields(info_segs, sentence, needed);
+    wl_decode_segments(state, callbacks, sentence->m_line, sentence->m_len, type, needed, info_segs);
+}
+
+/*the bytes wl_nmea_stream_feed does more with than keep and sum*/
+static const unsigned char g_nmea_stream_special[256] =
+{
+    ['\n'] = 1,
+    ['\r'] = 1,
+    ['$'] = 1,
+    [','] = 1,
+    ['*'] = 1,
+};
+
+void wl_nmea_stream_init(NmeaStream *stream, char *line_buf, int max_line)
+{
+    memset(stream, 0, sizeof(NmeaStream));
+    stream->m_line = line_buf;
+    stream->m_max_line = max_line;
+    stream->m_star = -1;
+    stream->m_cr_len = -1;
+}
+
+int wl_nmea_stream_feed(NmeaStream *stream, const char *data, int len, int *taken,
+            NmeaSentence *sentence)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + len;
+    char *line = stream->m_line;
+    int line_len = stream->m_len;
+    int max_line = stream->m_max_line;
+    unsigned char sum = stream->m_sum;
+    int line_end = 0;
+    int ret;
+
+    while (p < end)
+    {
+        unsigned char c = *p++;
+
+        /*most bytes are none of the four, they are only kept and summed*/
+        if (!g_nmea_stream_special[c])
+        {
+            if (line_len < max_line)
+            {
+                line[line_len++] = c;
+                sum ^= c;
+                continue;
+            }
+        }
+        else if (c == '\n')
+        {
+            line_end = 1;
+            break;
+        }
+        else if (c == '\r')
+        {
+            if (stream->m_cr_len < 0)
+                stream->m_cr_len = line_len;
+            continue;
+        }
+        else if (c == '$')
+        {
+            if (line_len > 0)
+                stream->m_spliced = 1;
+            if (line_len < max_line)
+            {
+                line[line_len++] = c;
+                sum ^= c;
+                continue;
+            }
+        }
+
+        if (line_len == max_line)
+        {
+            /*nothing more is kept, straight on to the '\n' that drops the line*/
+            const unsigned char *newline = memchr(p, '\n', end - p);
+
+            stream->m_too_long = 1;
+            p = newline ? newline : end;
+            continue;
+        }
+
+        if (stream->m_star < 0)
+        {
+            if (stream->m_field_count < WL_NMEA_MAX_FIELDS)
+                stream->m_field_end[stream->m_field_count++] = line_len;
+            else
+                stream->m_fields_cut = 1;
+            if (c == '*')
+            {
+                stream->m_star = line_len;
+                stream->m_star_sum = sum;
+            }
+        }
+        line[line_len++] = c;
+        sum ^= c;
+    }
+
+    *taken = (const char *)p - data;
+    if (!line_end)
+    {
+        stream->m_len = line_len;
+        stream->m_sum = sum;
+        return WL_NMEA_STREAM_MORE;
+    }
+
+    line[line_len] = '\0';
+    if (stream->m_too_long)
+    {
+        ret = WL_NMEA_STREAM_TOO_LONG;
+    }
+    else
+    {
+        sentence->m_line = line;
+        sentence->m_len = line_len;
+        sentence->m_field_count = stream->m_field_count;
+        sentence->m_field_end = stream->m_field_end;
+        sentence->m_checksum = wl_check_sum(line, line_len, stream->m_star, stream->m_star_sum);
+        /*only the "\r" of "\r\n" belongs, any other left a hole in the sum*/
+        if (((stream->m_cr_len >= 0) && (stream->m_cr_len != line_len)) || stream->m_spliced)
+            sentence->m_checksum = WL_NMEA_CHECKSUM_BAD;
+        sentence->m_fields_cut = stream->m_fields_cut;
+        ret = WL_NMEA_STREAM_SENTENCE;
+    }
+
+    stream->m_len = 0;
+    stream->m_sum = 0;
+    stream->m_too_long = 0;
+    stream->m_fields_cut = 0;
+    stream->m_spliced = 0;
+    stream->m_star = -1;
+    stream->m_cr_len = -1;
+    stream->m_field_count = 0;
+    return ret;
+}
@@ -0,0 +1,212 @@
+#ifndef WL_NMEA_H
+#define WL_NMEA_H
+
+#include <stdint.h>
+#include <hardware/gps.h>
+
+/*sentence types, for NmeaParseCallbacks.nmea_mask*/
+#define WL_NMEA_GGA (1 << 0)
+#define WL_NMEA_GSA (1 << 1)
+#define WL_NMEA_GSV (1 << 2)
+#define WL_NMEA_VTG (1 << 3)
+#define WL_NMEA_RMC (1 << 4)
+#define WL_NMEA_ALL (0x1f)
+
+/*PRNs one epoch's GSA sentences may list, one GSA per constellation*/
+#define WL_NMEA_MAX_USED_SVS (64)
+/*fields a sentence is split into at most, more than any type needs*/
+#define WL_NMEA_MAX_FIELDS (32)
+
+/*what wl_nmea_stream_feed stopped at*/
+#define WL_NMEA_STREAM_MORE (0)
+#define WL_NMEA_STREAM_SENTENCE (1)
+#define WL_NMEA_STREAM_TOO_LONG (-1)
+
+/*NmeaSentence.m_checksum*/
+#define WL_NMEA_CHECKSUM_NONE (0)
+#define WL_NMEA_CHECKSUM_OK (1)
+#define WL_NMEA_CHECKSUM_BAD (-1)
+
+typedef struct
+{
+    int m_year;
+    int m_month;
+    int m_day;
+    int m_sub;
+} UtcInfo;
+
+typedef struct
+{
+    unsigned int m_count;
+    int m_number[WL_NMEA_MAX_USED_SVS];
+} UsingSatellitesInfo;
+
+/*sentences an NmeaMemo keeps, a few epochs' GSA and GSV of four constellations*/
+#define WL_NMEA_MEMO_ENTRIES (64)
+/*NMEA 0183 caps a sentence at 82 characters, longer ones are decoded every time*/
+#define WL_NMEA_MEMO_LINE (82)
+
+/*what a GSA decodes to: the PRNs before the first empty one, and the HDOP*/
+typedef struct
+{
+    int m_count;
+    int m_prn[12];
+    float m_accuracy;
+} NmeaGsaFields;
+
+/*what a GSV decodes to: its message number and up to 4 satellites*/
+typedef struct
+{
+    int m_msg_index;
+    int m_count;
+    GpsSvInfo m_sv[4];
+} NmeaGsvFields;
+
+typedef struct
+{
+    unsigned int m_type;
+    /*which callbacks' fields were decoded, a memo hit needs all the current ones*/
+    unsigned int m_wants;
+    int m_len;
+    char m_line[WL_NMEA_MEMO_LINE];
+    union
+    {
+        NmeaGsaFields m_gsa;
+        NmeaGsvFields m_gsv;
+    } m_fields;
+} NmeaMemoEntry;
+
+/*
+ * GSA and GSV sentences decoded lately, reused when one comes again byte for
+ * byte, as GSV does while the sky does not change and GSA while the
+ * satellites used do not. Any entry may hold any sentence; the keys, packed
+ * from talker, type, GSV message number and checksum, are a column of their
+ * own so a lookup scans them before it compares a line. The least recently
+ * used entry makes room. Owned by whoever owns the parse state.
+ */
+typedef struct
+{
+    /*0 for an empty entry*/
+    uint32_t m_keys[WL_NMEA_MEMO_ENTRIES];
+    uint32_t m_used[WL_NMEA_MEMO_ENTRIES];
+    uint32_t m_clock;
+    NmeaMemoEntry m_entries[WL_NMEA_MEMO_ENTRIES];
+    unsigned int m_hits;
+    unsigned int m_misses;
+} NmeaMemo;
+
+/*decoding state carried from one NMEA sentence to the next*/
+typedef struct
+{
+    GpsLocation m_loc;
+    UtcInfo m_utc_info;
+    UsingSatellitesInfo m_satellites_info;
+    unsigned char m_sv_status_flag;
+    GpsSvStatus m_sv_status_info;
+    /*sv_list entry of the current GSV group's first satellite*/
+    int m_gsv_base;
+    /*forwarding time of the current epoch's sentences, 0 until the first one*/
+    GpsUtcTime m_epoch_time;
+    /*NULL decodes every sentence; only a pointer, copies of the state share it*/
+    NmeaMemo *m_memo;
+} NmeaParseState;
+
+/*
+ * Where the parser reports. Same meaning as the GpsCallbacks members of the
+ * same name, plus the user pointer handed back on every call. nmea_cb only
+ * sees the sentence types in nmea_mask, all stamped with the time the
+ * epoch's first one was forwarded. epoch_cb, if set, follows the RMC that
+ * closes an epoch.
+ */
+typedef struct
+{
+    void (*location_cb)(void *user, GpsLocation *location);
+    void (*sv_status_cb)(void *user, GpsSvStatus *sv_status);
+    void (*nmea_cb)(void *user, GpsUtcTime timestamp, const char *nmea, int length);
+    void (*epoch_cb)(void *user);
+    unsigned int nmea_mask;
+    void *user;
+} NmeaParseCallbacks;
+
+/*
+ * Frames sentences out of bytes in the order they arrive, in one pass: each
+ * byte is copied into the line, added to the checksum and, at a ',' or the
+ * '*', ends a field. The sentence is split and checked by the time its '\n'
+ * is seen. '\r' is dropped; one with more of the line after it fails the
+ * checksum, like it does in wl_parse_nmea_line, and so does a '$' past the
+ * first byte.
+ */
+typedef struct
+{
+    /*m_max_line plus a NUL*/
+    char *m_line;
+    int m_max_line;
+    int m_len;
+    /*XOR of the bytes kept so far, and of those before the '*', '$' included*/
+    unsigned char m_sum;
+    unsigned char m_star_sum;
+    unsigned char m_too_long;
+    /*more fields than m_field_end holds, the rest are not split*/
+    unsigned char m_fields_cut;
+    /*a '$' past the first byte, the head of another sentence*/
+    unsigned char m_spliced;
+    /*offset of the '*', -1 until it comes*/
+    int m_star;
+    /*line length at the first '\r', -1 until one comes*/
+    int m_cr_len;
+    int m_field_count;
+    /*offset of the ',' or '*' ending each field, the first starts after the '$'*/
+    int m_field_end[WL_NMEA_MAX_FIELDS];
+} NmeaStream;
+
+/*a framed sentence, valid until the stream is fed again*/
+typedef struct
+{
+    /*NUL terminated, without its "\r\n"*/
+    const char *m_line;
+    int m_len;
+    int m_field_count;
+    const int *m_field_end;
+    int m_checksum;
+    /*1 when it had more than WL_NMEA_MAX_FIELDS fields, the rest read as empty*/
+    int m_fields_cut;
+} NmeaSentence;
+
+/*WL_NMEA_* bit of a sentence's type, 0 for types the parser does not know*/
+unsigned int wl_nmea_sentence_type(const char *line_buf, int line_len);
+
+/*leaves the state without a memo*/
+void wl_reset_parse_state(NmeaParseState *state);
+
+/*empties memo, counters included, and has state decode through it*/
+void wl_attach_parse_memo(NmeaParseState *state, NmeaMemo *memo);
+
+/*
+ * Decodes one sentence without its "\n" terminator, '\r's before it are
+ * skipped. The line does not need to be NUL terminated and is not modified.
+ * A sentence without a "*hh" checksum at its end, one that does not match,
+ * or one with a '\r' or a second '$' inside, is ignored.
+ */
+void wl_parse_nmea_line(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const char *line_buf, int line_len);
+
+void wl_nmea_stream_init(NmeaStream *stream, char *line_buf, int max_line);
+
+/*
+ * Takes bytes of data up to and including the next '\n' and sets *taken to
+ * how many. Returns WL_NMEA_STREAM_SENTENCE with *sentence filled when a '\n'
+ * ended one, WL_NMEA_STREAM_TOO_LONG when it ended a line longer than
+ * max_line, which is dropped whole, and WL_NMEA_STREAM_MORE when all len
+ * bytes were taken without reaching a '\n'.
+ */
+int wl_nmea_stream_feed(NmeaStream *stream, const char *data, int len, int *taken,
+            NmeaSentence *sentence);
+
+/*
+ * Decodes a sentence the stream framed, from the fields it already split.
+ * Like wl_parse_nmea_line, only what carries a matching checksum.
+ */
+void wl_parse_nmea_sentence(NmeaParseState *state, const NmeaParseCallbacks *callbacks,
+            const NmeaSentence *sentence);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef WL_RX_STATS_H
+#define WL_RX_STATS_H
+
+#include <stddef.h>
+
+/*
+ * What GpsInterface.get_extension returns for WL_GPS_RX_STATS_INTERFACE: the
+ * buffer thread's line counts since the HAL was loaded. Every line the
+ * receiver sent ends up in exactly one of framed and dropped; proprietary
+ * "$P" lines are counted like the others although nmea_cb never sees them.
+ */
+#define WL_GPS_RX_STATS_INTERFACE "wl-gps-rx-stats"
+
+typedef struct
+{
+    /*whole lines handed to the parser*/
+    unsigned int m_framed;
+    /*longer than MAX_LINE, thrown away by the framer*/
+    unsigned int m_dropped;
+    /*framed, then thrown away for their checksum*/
+    unsigned int m_bad_checksum;
+    /*framed with more than WL_NMEA_MAX_FIELDS fields*/
+    unsigned int m_fields_cut;
+} WlGpsRxStats;
+
+typedef struct
+{
+    size_t size;
+    void (*get_rx_stats)(WlGpsRxStats *stats);
+} WlGpsRxStatsInterface;
+
+#endif
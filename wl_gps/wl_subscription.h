@@ -0,0 +1,24 @@
+#ifndef WL_SUBSCRIPTION_H
+#define WL_SUBSCRIPTION_H
+
+#include <stddef.h>
+
+/*
+ * What GpsInterface.get_extension returns for WL_GPS_SUBSCRIPTION_INTERFACE.
+ * GpsCallbacks only tells the HAL that a callback exists; the framework side
+ * knows whether any app listens to it right now and says so here as
+ * listeners come and go. The receiver is then only asked for the sentences
+ * somebody uses.
+ */
+#define WL_GPS_SUBSCRIPTION_INTERFACE "wl-gps-subscription"
+
+typedef struct
+{
+    size_t size;
+    /*whether anyone listens to sv_status_cb, taken as yes until told*/
+    void (*set_sv_status_wanted)(int wanted);
+    /*the WL_NMEA_* types anyone listens to on nmea_cb, all until told*/
+    void (*set_nmea_wanted)(unsigned int types);
+} WlGpsSubscriptionInterface;
+
+#endif
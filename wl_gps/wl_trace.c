@@ -0,0 +1,263 @@
+#ifdef WL_GPS_TRACE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "wl_log.h"
+#include "wl_trace.h"
+
+/*a thread keeps its latest events, 16 bytes each*/
+#define WL_TRACE_RING_EVENTS (16384)
+#define WL_TRACE_MAX_THREADS (32)
+
+static const char *g_trace_span_names[WL_TRACE_SPAN_COUNT] =
+{
+    "poll",
+    "read",
+    "io_uring_enter",
+    "rx lock wait",
+    "rx lock hold",
+    "frame line",
+    "parser idle",
+    "parse GGA",
+    "parse GSA",
+    "parse GSV",
+    "parse VTG",
+    "parse RMC",
+    "parse other",
+    "deliver idle",
+    "nmea_cb",
+    "sv_status_cb",
+    "location_cb",
+    "geofence check",
+    "AT command",
+};
+
+typedef struct
+{
+    char m_name[WL_TRACE_NAME_LEN];
+    int32_t m_tid;
+    /*set when the owner exits, another thread may then take the ring*/
+    int m_free;
+    /*events written so far, only the owner writes it*/
+    uint32_t m_head;
+    WlTraceEvent m_events[WL_TRACE_RING_EVENTS];
+} WlTraceRing;
+
+static WlTraceRing *g_trace_rings[WL_TRACE_MAX_THREADS];
+static int g_trace_ring_count;
+static volatile int g_trace_enabled;
+/*events before the last wl_trace_start belong to an older session*/
+static uint64_t g_trace_start_ns;
+static pthread_once_t g_trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_trace_key;
+/*what a thread gets when every ring is taken, its events are dropped*/
+static WlTraceRing g_trace_no_ring;
+
+static uint64_t wl_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void wl_trace_thread_exit(void *ring)
+{
+    if (ring != &g_trace_no_ring)
+        __atomic_store_n(&((WlTraceRing *)ring)->m_free, 1, __ATOMIC_RELEASE);
+}
+
+static void wl_trace_init_key(void)
+{
+    pthread_key_create(&g_trace_key, wl_trace_thread_exit);
+}
+
+/*the calling thread's ring, one left by an exited thread if there is one*/
+static WlTraceRing *wl_trace_ring(void)
+{
+    WlTraceRing *ring = pthread_getspecific(g_trace_key);
+    int count;
+    int i;
+
+    if (ring)
+        return ring;
+
+    count = __atomic_load_n(&g_trace_ring_count, __ATOMIC_ACQUIRE);
+    if (count > WL_TRACE_MAX_THREADS)
+        count = WL_TRACE_MAX_THREADS;
+    for (i = 0; i < count; i++)
+    {
+        WlTraceRing *old = __atomic_load_n(&g_trace_rings[i], __ATOMIC_ACQUIRE);
+        int expected = 1;
+
+        if (old && __atomic_compare_exchange_n(&old->m_free, &expected, 0, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            /*a dump running now sees the head go back and skips the ring*/
+            __atomic_store_n(&old->m_head, 0, __ATOMIC_RELEASE);
+            ring = old;
+            break;
+        }
+    }
+
+    if (NULL == ring)
+    {
+        /*the count may run past the table, only the slots below it are used*/
+        i = __atomic_fetch_add(&g_trace_ring_count, 1, __ATOMIC_ACQ_REL);
+        if (i < WL_TRACE_MAX_THREADS)
+        {
+            ring = calloc(1, sizeof(WlTraceRing));
+            if (ring)
+                __atomic_store_n(&g_trace_rings[i], ring, __ATOMIC_RELEASE);
+        }
+    }
+
+    if (NULL == ring)
+    {
+        LOGD("[wl_trace_ring]:no trace ring left of %d", WL_TRACE_MAX_THREADS);
+        ring = &g_trace_no_ring;
+    }
+    else
+    {
+        ring->m_tid = syscall(SYS_gettid);
+        snprintf(ring->m_name, sizeof(ring->m_name), "tid %d", ring->m_tid);
+    }
+    pthread_setspecific(g_trace_key, ring);
+    return ring;
+}
+
+void wl_trace_start(void)
+{
+    pthread_once(&g_trace_once, wl_trace_init_key);
+    g_trace_start_ns = wl_trace_now();
+    g_trace_enabled = 1;
+}
+
+void wl_trace_thread_name(const char *name)
+{
+    WlTraceRing *ring;
+
+    if (!g_trace_enabled)
+        return;
+    ring = wl_trace_ring();
+    if (ring != &g_trace_no_ring)
+        strncpy(ring->m_name, name, sizeof(ring->m_name) - 1);
+}
+
+void wl_trace_event(int span, int phase, uint32_t arg)
+{
+    WlTraceRing *ring;
+    WlTraceEvent *event;
+
+    if (!g_trace_enabled)
+        return;
+    ring = wl_trace_ring();
+    if (ring == &g_trace_no_ring)
+        return;
+
+    event = &ring->m_events[ring->m_head % WL_TRACE_RING_EVENTS];
+    event->m_time_ns = wl_trace_now();
+    event->m_span = span;
+    event->m_phase = phase;
+    event->m_arg = arg;
+    /*the dump reads the head first and the events up to it after*/
+    __atomic_store_n(&ring->m_head, ring->m_head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copies out what one ring holds of this session. The owner keeps writing;
+ * events it overwrote while they were copied are left out.
+ */
+static int wl_trace_copy_ring(WlTraceRing *ring, WlTraceEvent *out)
+{
+    uint32_t head = __atomic_load_n(&ring->m_head, __ATOMIC_ACQUIRE);
+    uint32_t first = (head > WL_TRACE_RING_EVENTS) ? head - WL_TRACE_RING_EVENTS : 0;
+    uint32_t now_head;
+    uint32_t i;
+    int count = 0;
+
+    for (i = first; i != head; i++)
+        out[i - first] = ring->m_events[i % WL_TRACE_RING_EVENTS];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    now_head = __atomic_load_n(&ring->m_head, __ATOMIC_RELAXED);
+
+    for (i = first; i != head; i++)
+    {
+        /*overwritten, or being overwritten, since the copy started*/
+        if (now_head - i >= WL_TRACE_RING_EVENTS)
+            continue;
+        if (out[i - first].m_time_ns < g_trace_start_ns)
+            continue;
+        out[count++] = out[i - first];
+    }
+    return count;
+}
+
+int wl_trace_dump(const char *path)
+{
+    WlTraceFileHeader header;
+    WlTraceFileThread thread;
+    WlTraceEvent *events;
+    FILE *fp;
+    int ring_count;
+    int i;
+
+    if (!g_trace_enabled)
+        return -1;
+
+    events = malloc(sizeof(WlTraceEvent) * WL_TRACE_RING_EVENTS);
+    fp = fopen(path, "wb");
+    if ((NULL == events) || (NULL == fp))
+    {
+        LOGE("[wl_trace_dump]:can not write %s, errno=%d", path, errno);
+        free(events);
+        if (fp)
+            fclose(fp);
+        return -1;
+    }
+
+    ring_count = __atomic_load_n(&g_trace_ring_count, __ATOMIC_ACQUIRE);
+    if (ring_count > WL_TRACE_MAX_THREADS)
+        ring_count = WL_TRACE_MAX_THREADS;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_magic, WL_TRACE_MAGIC, sizeof(header.m_magic));
+    header.m_span_count = WL_TRACE_SPAN_COUNT;
+    header.m_thread_count = ring_count;
+    fwrite(&header, sizeof(header), 1, fp);
+    for (i = 0; i < WL_TRACE_SPAN_COUNT; i++)
+        fwrite(g_trace_span_names[i], strlen(g_trace_span_names[i]) + 1, 1, fp);
+
+    for (i = 0; i < ring_count; i++)
+    {
+        WlTraceRing *ring = __atomic_load_n(&g_trace_rings[i], __ATOMIC_ACQUIRE);
+
+        memset(&thread, 0, sizeof(thread));
+        if (ring)
+        {
+            memcpy(thread.m_name, ring->m_name, sizeof(thread.m_name));
+            thread.m_tid = ring->m_tid;
+            thread.m_event_count = wl_trace_copy_ring(ring, events);
+        }
+        fwrite(&thread, sizeof(thread), 1, fp);
+        fwrite(events, sizeof(WlTraceEvent), thread.m_event_count, fp);
+    }
+
+    free(events);
+    if (fclose(fp) != 0)
+    {
+        LOGE("[wl_trace_dump]:can not write %s, errno=%d", path, errno);
+        return -1;
+    }
+    LOGD("[wl_trace_dump]:%d threads dumped to %s", ring_count, path);
+    return 0;
+}
+
+#endif
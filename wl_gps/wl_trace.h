@@ -0,0 +1,85 @@
+#ifndef WL_TRACE_H
+#define WL_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Begin/end spans of the HAL threads, for seeing how the reader, the buffer
+ * thread and the callbacks interleave. Only built with -DWL_GPS_TRACE, the
+ * macros are empty otherwise. Every thread appends to a ring of its own
+ * latest events without taking a lock; TRACE_FILE in the config turns
+ * recording on and names the file wl_gps_stop dumps the rings to.
+ * tools/wl_trace_json.c converts a dump to Chrome trace JSON.
+ */
+enum
+{
+    WL_TRACE_POLL = 0,
+    WL_TRACE_READ,
+    WL_TRACE_URING_ENTER,
+    /*m_mutex, the reader and buffer thread handover*/
+    WL_TRACE_RX_LOCK_WAIT,
+    WL_TRACE_RX_LOCK_HOLD,
+    WL_TRACE_FRAME,
+    WL_TRACE_PARSER_IDLE,
+    WL_TRACE_PARSE_GGA,
+    WL_TRACE_PARSE_GSA,
+    WL_TRACE_PARSE_GSV,
+    WL_TRACE_PARSE_VTG,
+    WL_TRACE_PARSE_RMC,
+    WL_TRACE_PARSE_OTHER,
+    WL_TRACE_DELIVER_IDLE,
+    WL_TRACE_NMEA_CB,
+    WL_TRACE_SV_STATUS_CB,
+    WL_TRACE_LOCATION_CB,
+    WL_TRACE_GEOFENCE_CHECK,
+    /*from taking the AT port to the answer, the arg is the ATCMD_* index*/
+    WL_TRACE_AT_CMD,
+    WL_TRACE_SPAN_COUNT
+};
+
+/*the dump: this header, the span names, then each thread and its events*/
+#define WL_TRACE_MAGIC "WLTRACE1"
+#define WL_TRACE_NAME_LEN (16)
+
+typedef struct
+{
+    char m_magic[8];
+    uint32_t m_span_count;
+    uint32_t m_thread_count;
+} WlTraceFileHeader;
+
+typedef struct
+{
+    char m_name[WL_TRACE_NAME_LEN];
+    int32_t m_tid;
+    uint32_t m_event_count;
+} WlTraceFileThread;
+
+typedef struct
+{
+    /*CLOCK_MONOTONIC*/
+    uint64_t m_time_ns;
+    uint16_t m_span;
+    /*'B' or 'E'*/
+    uint8_t m_phase;
+    uint8_t m_reserved;
+    uint32_t m_arg;
+} WlTraceEvent;
+
+#ifdef WL_GPS_TRACE
+void wl_trace_start(void);
+void wl_trace_thread_name(const char *name);
+void wl_trace_event(int span, int phase, uint32_t arg);
+int wl_trace_dump(const char *path);
+
+#define WL_TRACE_BEGIN(span, arg) wl_trace_event((span), 'B', (arg))
+#define WL_TRACE_END(span) wl_trace_event((span), 'E', 0)
+#else
+#define wl_trace_start() do {} while (0)
+#define wl_trace_thread_name(name) do {} while (0)
+#define wl_trace_dump(path) do {} while (0)
+#define WL_TRACE_BEGIN(span, arg) do {} while (0)
+#define WL_TRACE_END(span) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,284 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "wl_log.h"
+#include "wl_uring.h"
+
+#if defined(WL_HAVE_IO_URING) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+
+static int wl_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+int wl_uring_init(WlUring *ring, unsigned int entries)
+{
+    struct io_uring_params params;
+    unsigned char *sq;
+    unsigned char *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->m_fd = -1;
+    memset(&params, 0, sizeof(params));
+    ring->m_fd = wl_uring_setup(entries, &params);
+    if (ring->m_fd < 0)
+        return -errno;
+
+    /*
+     * FAST_POLL came with 5.7, after WRITE, POLL_ADD and TIMEOUT; it also means
+     * a read on the tty waits on poll instead of tying up a kernel worker.
+     */
+    if (!(params.features & IORING_FEAT_FAST_POLL) || !(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        close(ring->m_fd);
+        ring->m_fd = -1;
+        return -ENOSYS;
+    }
+
+    ring->m_entries = params.sq_entries;
+    ring->m_sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->m_cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->m_cq_map_len > ring->m_sq_map_len)
+        ring->m_sq_map_len = ring->m_cq_map_len;
+    ring->m_sq_map = mmap(NULL, ring->m_sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->m_fd, IORING_OFF_SQ_RING);
+    if (MAP_FAILED == ring->m_sq_map)
+    {
+        ring->m_sq_map = NULL;
+        wl_uring_exit(ring);
+        return -ENOMEM;
+    }
+    /*SINGLE_MMAP, both rings share the one mapping*/
+    ring->m_cq_map = ring->m_sq_map;
+
+    ring->m_sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->m_sqes = mmap(NULL, ring->m_sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->m_fd, IORING_OFF_SQES);
+    if (MAP_FAILED == ring->m_sqes)
+    {
+        ring->m_sqes = NULL;
+        wl_uring_exit(ring);
+        return -ENOMEM;
+    }
+
+    sq = ring->m_sq_map;
+    cq = ring->m_cq_map;
+    ring->m_sq_head = (unsigned int *)(sq + params.sq_off.head);
+    ring->m_sq_tail = (unsigned int *)(sq + params.sq_off.tail);
+    ring->m_sq_mask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    ring->m_sq_array = (unsigned int *)(sq + params.sq_off.array);
+    ring->m_cq_head = (unsigned int *)(cq + params.cq_off.head);
+    ring->m_cq_tail = (unsigned int *)(cq + params.cq_off.tail);
+    ring->m_cq_mask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    ring->m_cqes = cq + params.cq_off.cqes;
+    pthread_mutex_init(&ring->m_sq_lock, NULL);
+    return 0;
+}
+
+/*closing the ring cancels whatever is still queued on it*/
+void wl_uring_exit(WlUring *ring)
+{
+    if (ring->m_sqes)
+        munmap(ring->m_sqes, ring->m_sqes_len);
+    if (ring->m_sq_map)
+    {
+        munmap(ring->m_sq_map, ring->m_sq_map_len);
+        pthread_mutex_destroy(&ring->m_sq_lock);
+    }
+    if (ring->m_fd >= 0)
+        close(ring->m_fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->m_fd = -1;
+}
+
+int wl_uring_register_buffers(WlUring *ring, const struct iovec *iov, unsigned int count)
+{
+    if (syscall(__NR_io_uring_register, ring->m_fd, IORING_REGISTER_BUFFERS, iov, count) < 0)
+        return -errno;
+    return 0;
+}
+
+/*
+ * Fills the next SQE under m_sq_lock and publishes it; the kernel takes it on
+ * whichever wl_uring_enter comes next, from this thread or another.
+ */
+static int wl_uring_queue(WlUring *ring, const struct io_uring_sqe *sqe)
+{
+    struct io_uring_sqe *sqes = ring->m_sqes;
+    unsigned int tail;
+    unsigned int index;
+
+    pthread_mutex_lock(&ring->m_sq_lock);
+    tail = *ring->m_sq_tail;
+    if (tail - __atomic_load_n(ring->m_sq_head, __ATOMIC_ACQUIRE) >= ring->m_entries)
+    {
+        pthread_mutex_unlock(&ring->m_sq_lock);
+        return -EBUSY;
+    }
+    index = tail & *ring->m_sq_mask;
+    sqes[index] = *sqe;
+    ring->m_sq_array[index] = index;
+    __atomic_store_n(ring->m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&ring->m_sq_lock);
+    return 0;
+}
+
+int wl_uring_queue_read_fixed(WlUring *ring, int fd, void *buf, unsigned int len, int buf_index,
+            uint64_t user_data)
+{
+    struct io_uring_sqe sqe;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ_FIXED;
+    sqe.fd = fd;
+    sqe.addr = (uintptr_t)buf;
+    sqe.len = len;
+    sqe.buf_index = buf_index;
+    sqe.user_data = user_data;
+    return wl_uring_queue(ring, &sqe);
+}
+
+int wl_uring_queue_write(WlUring *ring, int fd, const void *buf, unsigned int len, uint64_t user_data)
+{
+    struct io_uring_sqe sqe;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE;
+    sqe.fd = fd;
+    sqe.addr = (uintptr_t)buf;
+    sqe.len = len;
+    sqe.user_data = user_data;
+    return wl_uring_queue(ring, &sqe);
+}
+
+int wl_uring_queue_poll(WlUring *ring, int fd, uint64_t user_data)
+{
+    struct io_uring_sqe sqe;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = fd;
+    sqe.poll32_events = POLLIN;
+    sqe.user_data = user_data;
+    return wl_uring_queue(ring, &sqe);
+}
+
+int wl_uring_queue_timeout(WlUring *ring, int timeout_ms, uint64_t user_data)
+{
+    struct io_uring_sqe sqe;
+
+    ring->m_timeout[0] = timeout_ms / 1000;
+    ring->m_timeout[1] = (int64_t)(timeout_ms % 1000) * 1000000;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_TIMEOUT;
+    sqe.fd = -1;
+    sqe.addr = (uintptr_t)ring->m_timeout;
+    sqe.len = 1;
+    sqe.user_data = user_data;
+    return wl_uring_queue(ring, &sqe);
+}
+
+int wl_uring_queue_cancel(WlUring *ring, uint64_t target, uint64_t user_data)
+{
+    struct io_uring_sqe sqe;
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = target;
+    sqe.user_data = user_data;
+    return wl_uring_queue(ring, &sqe);
+}
+
+int wl_uring_enter(WlUring *ring, unsigned int min_complete)
+{
+    unsigned int flags = (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0;
+    unsigned int to_submit;
+
+    /*
+     * The kernel skips the wait when it submits fewer than asked for, which
+     * another thread's enter taking our SQEs can cause; that costs a spurious
+     * return, nothing more.
+     */
+    to_submit = __atomic_load_n(ring->m_sq_tail, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(ring->m_sq_head, __ATOMIC_ACQUIRE);
+    if (syscall(__NR_io_uring_enter, ring->m_fd, to_submit, min_complete, flags, NULL, 0) < 0)
+        return -errno;
+    return 0;
+}
+
+int wl_uring_next_completion(WlUring *ring, uint64_t *user_data, int *res)
+{
+    struct io_uring_cqe *cqes = ring->m_cqes;
+    unsigned int head = *ring->m_cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(ring->m_cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    cqe = &cqes[head & *ring->m_cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->m_cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+#else
+
+int wl_uring_init(WlUring *ring, unsigned int entries)
+{
+    memset(ring, 0, sizeof(*ring));
+    ring->m_fd = -1;
+    return -ENOSYS;
+}
+
+void wl_uring_exit(WlUring *ring)
+{
+}
+
+int wl_uring_register_buffers(WlUring *ring, const struct iovec *iov, unsigned int count)
+{
+    return -ENOSYS;
+}
+
+int wl_uring_queue_read_fixed(WlUring *ring, int fd, void *buf, unsigned int len, int buf_index,
+            uint64_t user_data)
+{
+    return -ENOSYS;
+}
+
+int wl_uring_queue_write(WlUring *ring, int fd, const void *buf, unsigned int len, uint64_t user_data)
+{
+    return -ENOSYS;
+}
+
+int wl_uring_queue_poll(WlUring *ring, int fd, uint64_t user_data)
+{
+    return -ENOSYS;
+}
+
+int wl_uring_queue_timeout(WlUring *ring, int timeout_ms, uint64_t user_data)
+{
+    return -ENOSYS;
+}
+
+int wl_uring_queue_cancel(WlUring *ring, uint64_t target, uint64_t user_data)
+{
+    return -ENOSYS;
+}
+
+int wl_uring_enter(WlUring *ring, unsigned int min_complete)
+{
+    return -ENOSYS;
+}
+
+int wl_uring_next_completion(WlUring *ring, uint64_t *user_data, int *res)
+{
+    return 0;
+}
+
+#endif
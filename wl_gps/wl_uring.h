@@ -0,0 +1,63 @@
+#ifndef WL_URING_H
+#define WL_URING_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+ * Just enough io_uring for the reader thread, on the raw syscalls since the
+ * platforms this HAL builds for ship no liburing. Without the kernel header
+ * every call fails with -ENOSYS and the caller keeps to read()/write().
+ */
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define WL_HAVE_IO_URING (1)
+#endif
+#endif
+
+typedef struct
+{
+    int m_fd;
+    unsigned int m_entries;
+    /*producers of SQEs take turns, the reader and whoever sends AT commands*/
+    pthread_mutex_t m_sq_lock;
+    unsigned int *m_sq_head;
+    unsigned int *m_sq_tail;
+    unsigned int *m_sq_mask;
+    unsigned int *m_sq_array;
+    void *m_sqes;
+    /*only the reader consumes completions*/
+    unsigned int *m_cq_head;
+    unsigned int *m_cq_tail;
+    unsigned int *m_cq_mask;
+    void *m_cqes;
+    void *m_sq_map;
+    size_t m_sq_map_len;
+    void *m_cq_map;
+    size_t m_cq_map_len;
+    size_t m_sqes_len;
+    /*__kernel_timespec of the one timeout that may be queued*/
+    int64_t m_timeout[2];
+} WlUring;
+
+/*all of these return 0 or a negative errno*/
+int wl_uring_init(WlUring *ring, unsigned int entries);
+void wl_uring_exit(WlUring *ring);
+int wl_uring_register_buffers(WlUring *ring, const struct iovec *iov, unsigned int count);
+
+int wl_uring_queue_read_fixed(WlUring *ring, int fd, void *buf, unsigned int len, int buf_index,
+            uint64_t user_data);
+int wl_uring_queue_write(WlUring *ring, int fd, const void *buf, unsigned int len, uint64_t user_data);
+int wl_uring_queue_poll(WlUring *ring, int fd, uint64_t user_data);
+/*one at a time, a second one before the first is submitted replaces its time*/
+int wl_uring_queue_timeout(WlUring *ring, int timeout_ms, uint64_t user_data);
+int wl_uring_queue_cancel(WlUring *ring, uint64_t target, uint64_t user_data);
+
+/*submits everything queued, then waits for at least min_complete completions*/
+int wl_uring_enter(WlUring *ring, unsigned int min_complete);
+/*1 and the completion when there is one, 0 when the queue is empty*/
+int wl_uring_next_completion(WlUring *ring, uint64_t *user_data, int *res);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef WL_WAKEUPS_H
+#define WL_WAKEUPS_H
+
+#include <stddef.h>
+
+/*
+ * What GpsInterface.get_extension returns for WL_GPS_WAKEUPS_INTERFACE: how
+ * often each HAL thread has woken up since init. Between sessions none of
+ * them should, tools/wl_gps_idle_check.c holds the HAL to that.
+ */
+#define WL_GPS_WAKEUPS_INTERFACE "wl-gps-wakeups"
+
+typedef struct
+{
+    unsigned int m_reader;
+    unsigned int m_parser;
+    unsigned int m_deliver;
+} WlGpsWakeups;
+
+typedef struct
+{
+    size_t size;
+    void (*get_wakeups)(WlGpsWakeups *wakeups);
+} WlGpsWakeupsInterface;
+
+#endif